@@ -16,8 +16,7 @@ Compiler:
 
 //AVRCalculator.c : source file for the AVRCalculator project
 
-//CPU clock frequency in KHz
-#define CLOCK_FREQ		8000	//KHz
+//CPU clock frequency: see clock.h (CLOCK_KHZ)
 #define LCD_PORT			PORTB
 #define KBD1_PORT			PORTD
 #define KBD2_PORT			PORTA
@@ -26,6 +25,7 @@ Compiler:
 #include "AVRCalculator.h"
 #include "parser.h"
 #include "types.h"
+#include "membudget.h"
 #include <lcd.h>
 #include <stdlib.h>
 #include <string.h>
@@ -35,152 +35,20 @@ Compiler:
 #include "lcdmore.h"
 #include "keybrd.h"
 #include "AVRCalculatorTimer.h"
+#include "diag.h"
+#include "keytable.h"
+#include "gapbuf.h"
+#include "sched.h"
+#include "persist.h"
+#include "eestore.h"
+#include "history.h"
+#include "numfmt.h"
 
 //************************************************************************//
 //************************************************************************//
 //Constant definitions
 
-////////////////////////////////////////////////////////////////////////////
-//All used buttons
-#define								BUTTON_UNDEFINED				0xFF
-//Numbers
-#define								NUMBER_0								'0'
-#define								NUMBER_1								'1'
-#define								NUMBER_2								'2'
-#define								NUMBER_3								'3'
-#define								NUMBER_4								'4'
-#define								NUMBER_5								'5'
-#define								NUMBER_6								'6'
-#define								NUMBER_7								'7'
-#define								NUMBER_8								'8'
-#define								NUMBER_9								'9'
-//Main operators
-#define								OPERATOR_PLUS						'+'
-#define								OPERATOR_MINUS					'-'
-#define								OPERATOR_MUL						'*'
-#define								OPERATOR_DIV						'/'
-//Other operators
-#define								OPERATOR_POWER					'^'
-//Function buttons
-  //Triangular functions
-#define								FUNCTION_SIN						0
-#define								FUNCTION_COS						1
-#define								FUNCTION_TAN						2
-#define								FUNCTION_ARCSIN					3
-#define								FUNCTION_ARCCOS					4
-#define								FUNCTION_ARCTAN					5
-#define								FUNCTION_SINH						6
-#define								FUNCTION_COSH						7
-#define								FUNCTION_TANH						8
-#define								FUNCTION_ARCSINH				9
-#define								FUNCTION_ARCCOSH				10
-#define								FUNCTION_ARCTANH				11
-  //Other functions
-#define								FUNCTION_LN							12
-#define								FUNCTION_LOG						13
-#define								FUNCTION_EXP						14
-#define								FUNCTION_RAN						15
-#define								FUNCTION_SQRT						16
-//Formula control buttons
-#define								FORMULA_LEFT						17
-#define								FORMULA_RIGHT						18
-#define								FORMULA_HOME						19
-#define								FORMULA_END							20
-#define								FORMULA_DEL							21
-#define								FORMULA_INS							22
-//Constants
-#define								CONSTANT_PI							23
-//Variables
-#define								VARIABLE_ANS						24
-//Other buttons
-#define								BUTTON_ON								25
-#define								BUTTON_OFF							26
-#define								BUTTON_SHIFT						27
-#define								BUTTON_E								28
-#define								BUTTON_PERIOD						'.'
-#define								BUTTON_DRG							29
-#define								BUTTON_HYP							30
-#define								BUTTON_LPAREN						'('
-#define								BUTTON_RPAREN						')'
-#define								BUTTON_EQUAL						'='
-
-
-////////////////////////////////////////////////////////////////////////////
-//All formula diplay char codes
-//Mark end of each table with 0xFF
-//Thease tables only contain the text that will be displayed for for functions and
-//	characters on the LCD.
-//Note: Thease characters are also used for generating parsable formula for expression
-//	parser when a function or character is not defined in the parsable_strs_table.
-FLASH char formula_char_table_1len[][2] = {
-	{NUMBER_0, '0'},
-	{NUMBER_1, '1'},
-	{NUMBER_2, '2'},
-	{NUMBER_3, '3'},
-	{NUMBER_4, '4'},
-	{NUMBER_5, '5'},
-	{NUMBER_6, '6'},
-	{NUMBER_7, '7'},
-	{NUMBER_8, '8'},
-	{NUMBER_9, '9'},
-	{OPERATOR_PLUS, '+'},
-	{OPERATOR_MINUS, '-'},
-	{OPERATOR_MUL, 0x78},
-	{OPERATOR_DIV, 0xFD},
-	{OPERATOR_POWER, '^'},
-	{BUTTON_LPAREN, '('},
-	{BUTTON_RPAREN, ')'},
-	{BUTTON_PERIOD, '.'},
-	{BUTTON_E, 'E'},
-	{CONSTANT_PI, 0xB6},
-	{0xFF,'?'}  //End of tble
-};
-
-FLASH char formula_char_table_2len[][3] = {
-	{FUNCTION_SQRT, 0xE8, '('},
-	{0xFF, '?','?'}  //End of tble
-};
-
-FLASH char formula_char_table_3len[][4] = {
-	{FUNCTION_LN, 'L','n','('},
-	{VARIABLE_ANS, 'A','n','s'},
-	{0xFF, '?','?','?'}  //End of tble
-};
-
-FLASH char formula_char_table_4len[][5] = {
-	{FUNCTION_EXP, 'e','x','p','('},
-	{FUNCTION_SIN, 's','i','n','('},
-	{FUNCTION_COS, 'c','o','s','('},
-	{FUNCTION_TAN, 't','a','n','('},
-	{FUNCTION_LOG, 'l','o','g','('},
-	{FUNCTION_RAN, 'R','a','n','#'},
-	{0xFF, '?','?','?','?'}  //End of tble
-};
-
-FLASH char formula_char_table_5len[][6] = {
-	{FUNCTION_SINH, 's','i','n','h','('},
-	{FUNCTION_COSH, 'c','o','s','h','('},
-	{FUNCTION_TANH, 't','a','n','h','('},
-	{FUNCTION_ARCSIN, 's','i','n', 5, '('},
-	{FUNCTION_ARCCOS, 'c','o','s', 5, '('},
-	{FUNCTION_ARCTAN, 't','a','n', 5, '('},
-	{0xFF, '?','?','?','?','?'}  //End of tble
-};
-
-FLASH char formula_char_table_6len[][7] = {
-	{FUNCTION_ARCSINH, 's','i','n','h', 5, '('},
-	{FUNCTION_ARCCOSH, 'c','o','s','h', 5, '('},
-	{FUNCTION_ARCTANH, 't','a','n','h', 5, '('},
-	{0xFF, '?','?','?','?','?', '?'}  //End of tble
-};
-
-FLASH char formula_char_table_7len[][8] = {
-	{0xFF, '?','?','?','?','?','?','?'}  //End of tble
-};
 
-FLASH char formula_char_table_8len[][9] = {
-	{0xFF, '?','?','?','?','?', '?', '?', '?'}  //End of tble
-};
 
 ////////////////////////////////////////////////////////////////////////////
 //Calculator sub modes
@@ -188,9 +56,20 @@ FLASH char formula_char_table_8len[][9] = {
 #define					SM_NEWFORMULA					1
 #define					SM_DRGSELECT					2
 #define					SM_ERROR							3
+#define					SM_DIAG								4
+#define					SM_FMTSELECT					5
+
+//Time limit for auto power off feature (in timer ticks, see AVRCalculatorTimer.h)
+#define 				AUTO_POWER_OFF_BOUND					(230000 / TICK_MS)  //~230 Seconds
+
+//Cursor blinking period (in timer ticks)
+#define					BLINK_TICKS										(600 / TICK_MS)  //~600ms
 
-//Time limit for auto power off feature (according to timer1 compare match A (SIG_OUTPUT_COMPARE1A))
-#define 				AUTO_POWER_OFF_BOUND					1500  //~5 Seconds
+//Welcome animation: time the message is shown, time per scroll step (in timer ticks)
+//  and number of scroll steps
+#define					WELCOME_SHOW_TICKS						(2200 / TICK_MS)
+#define					WELCOME_STEP_TICKS						(220 / TICK_MS)
+#define					WELCOME_STEPS									15
 
 //************************************************************************//
 //************************************************************************//
@@ -202,11 +81,13 @@ typedef struct
 {
 	BOOLEAN shift:1;
 	BOOLEAN alpha:1;
-	BOOLEAN buttonreleased:1;
 	BOOLEAN poweron:1;
 	unsigned char anglebase:2;
 	unsigned char insertmode:1;
 	unsigned char hyp:1;
+	BOOLEAN welcome:1;  //Welcome animation enabled
+	unsigned char fmtmode:2;  //Result display mode (FMT_AUTO...FMT_ENG, numfmt.h)
+	unsigned char fmtdigits:4;
 	unsigned char submode;
 	unsigned int autopoweroff_counter;
 } CALC_STATUS;
@@ -231,7 +112,7 @@ typedef struct {
 FLASH char welcome_msg[] = "   welcome to     AVRCalculator";
 
 ////////////////////////////////////////////////////////////////////////////
-//Calculator keyboard button map for normal and shift modes (used by button_read function).
+//Calculator keyboard button map for normal and shift modes (used by button_get function).
 FLASH char kbd_table_normal[4][8] = {
 	{NUMBER_7, NUMBER_8, NUMBER_9, OPERATOR_MUL, BUTTON_SHIFT, FORMULA_LEFT, FORMULA_RIGHT, BUTTON_ON},
 	{NUMBER_4, NUMBER_5, NUMBER_6, OPERATOR_MINUS, OPERATOR_DIV, BUTTON_LPAREN, BUTTON_RPAREN, FORMULA_DEL},
@@ -240,10 +121,10 @@ FLASH char kbd_table_normal[4][8] = {
 };
 
 FLASH char kbd_table_shift[4][8] = {
-	{BUTTON_UNDEFINED, BUTTON_UNDEFINED, BUTTON_UNDEFINED, BUTTON_UNDEFINED, BUTTON_SHIFT, FORMULA_HOME, FORMULA_END, BUTTON_OFF},
-	{BUTTON_UNDEFINED, BUTTON_UNDEFINED, BUTTON_UNDEFINED, BUTTON_UNDEFINED, BUTTON_UNDEFINED, BUTTON_UNDEFINED, BUTTON_UNDEFINED, FORMULA_INS},
+	{BUTTON_WELCOME, BUTTON_HISTORY, BUTTON_FORMAT, BUTTON_UNDEFINED, BUTTON_SHIFT, FORMULA_HOME, FORMULA_END, BUTTON_OFF},
+	{BUTTON_UNDEFINED, BUTTON_UNDEFINED, BUTTON_UNDEFINED, BUTTON_UNDEFINED, BUTTON_UNDEFINED, BUTTON_PREVIEW, BUTTON_UNDEFINED, FORMULA_INS},
 	{BUTTON_UNDEFINED, BUTTON_UNDEFINED, BUTTON_UNDEFINED, BUTTON_UNDEFINED, BUTTON_UNDEFINED, BUTTON_DRG, BUTTON_UNDEFINED, FUNCTION_EXP},
-	{BUTTON_UNDEFINED, FUNCTION_RAN, CONSTANT_PI, VARIABLE_ANS, BUTTON_UNDEFINED, FUNCTION_ARCSIN, FUNCTION_ARCCOS, FUNCTION_ARCTAN}
+	{BUTTON_DIAG, FUNCTION_RAN, CONSTANT_PI, VARIABLE_ANS, BUTTON_UNDEFINED, FUNCTION_ARCSIN, FUNCTION_ARCCOS, FUNCTION_ARCTAN}
 };
 
 ////////////////////////////////////////////////////////////////////////////
@@ -264,32 +145,97 @@ FLASH LCC LCDCHAR_INSERT[]						= {0x1B, 0x11, 0x11, 0x00, 0x00, 0x11, 0x11, 0x1
 
 FLASH LCC LCDCHAR_INVERSE[]						= {0x01, 0x01, 0x1D, 0x01, 0x01, 0x00, 0x00, 0x00};
 
+//Glyph IDs for the CGRAM manager (lcdmore.h)
+#define GLYPH_LEFTARROWSHIFT		0
+#define GLYPH_LEFTARROWNOSHIFT	1
+#define GLYPH_SHIFT							2
+#define GLYPH_RIGHTARROW				3
+#define GLYPH_DSMALL						4
+#define GLYPH_RSMALL						5
+#define GLYPH_GSMALL						6
+#define GLYPH_HYP								7
+#define GLYPH_INSERT						8
+#define GLYPH_INVERSE						9
+
+//Requests a glyph from the CGRAM manager and returns its character code
+#define LCD_GLYPH(name)		lcd_glyph(GLYPH_##name, LCDCHAR_##name)
+
+//CGRAM slots of the glyphs with fixed character codes
+#define SLOT_INSERT		4		//Written by lcd_blink_task (display task)
+#define SLOT_INVERSE	5		//Used in key_table glyph strings ("sin\x05(")
+
 
 
 //************************************************************************//
 //************************************************************************//
 //Global SRAM variables
 
-CALC_STATUS calc_status = {OFF, OFF, False, RADIANS, OFF, OFF};
+CALC_STATUS calc_status = {OFF, OFF, RADIANS, OFF, OFF};
 
 LCD_STATUS lcd_status = {0,0,True,True,False};
 
 char lcd_line0[16], lcd_line1[16];
 
-//Input formula variables and constants
-#define 	FORMULA_MAX_LEN				50
-#define		FORMULA_BLINK_BOUND		45
-char formula[FORMULA_MAX_LEN];
+//Parser state (pools, compiled program, Ans and angle base)
+PARSER_CONTEXT parser_context;
+
+//Input formula: key codes in a gap buffer (FORMULA_MAX_LEN and FORMULA_BLINK_BOUND
+//  are in membudget.h)
+GAP_BUFFER formula;
 
-//Input formula display status
+//Input formula display status (the number of keys is gap_len(&formula))
 typedef struct
 {
-	int len;
 	int displeftpos, disprightpos, cursorpos;
+	int errorpos;  //Index of the key where the last syntax error was found
 } FORMULA_STATUS;
 
 FORMULA_STATUS formula_status;
 
+//Last formulas (SHIFT + 8 recalls them)
+HISTORY history;
+
+//History entry shown in the editor while it is not edited (HISTORY_NONE: none)
+unsigned char history_index = HISTORY_NONE;
+
+//History entries starting with the keys typed (prefix search) and the one shown
+HISTORY_MATCH history_match;
+unsigned char history_cand;
+
+//Evaluator task states
+#define EVAL_IDLE						0		//Nothing to do
+#define EVAL_COMPILE				1		//The formula changed: compile it
+#define EVAL_EVALUATE				2		//Compiled: evaluation started or suspended
+
+//Evaluator task status
+typedef struct
+{
+	BOOLEAN preview:1;  //Live result preview enabled
+	BOOLEAN shown:1;  //lcd_line1 holds a preview
+	BOOLEAN final:1;  //Evaluating for '=' (keys wait until it is done), else a preview
+	UCHAR state;
+	unsigned long seed;  //Ran# state before a preview evaluation
+} EVAL_STATUS;
+
+EVAL_STATUS eval = {False, False, False, EVAL_IDLE};
+
+//Submode to return to from the angle base and diagnostics screens
+unsigned char menu_old_mode;
+
+//Power task states
+#define POWER_ON						0
+#define POWER_DRAINING			1		//Display switched off, waiting for the LCD queue
+#define POWER_OFF						2		//Slow tick, waiting for ON
+#define POWER_WELCOME				3		//Welcome animation (any key skips it)
+
+unsigned char power_mode = POWER_ON;
+
+//Ticks until the Timer1 ISR posts EV_WORK to the power task (0: stopped)
+volatile unsigned int power_timer = 0;
+
+//Scroll steps of the welcome animation done
+unsigned char welcome_step;
+
 //************************************************************************//
 //************************************************************************//
 //Functions
@@ -304,87 +250,93 @@ FORMULA_STATUS formula_status;
 }*/
 
 //************************************************************************//
-//Return True if a keystroke is available
-BOOLEAN kbd_hitall(void)
-{
-  return(kbd_hit(&KBD1_PORT) || kbd_hit(&KBD2_PORT));
-}
-
-//************************************************************************//
-//Reads a key from both keyboards (waits for keystroke if necessary)
-//Returns row and column of the button pressed.
-void kbd_readkeyall(unsigned char *row, unsigned char *col)
-{
-	unsigned char kbd_num=0;
-	//Only one key can be pressed at any time
-	do {
-		while(kbd_hit(&KBD1_PORT) && kbd_hit(&KBD2_PORT))
-		{
-			//Check auto power off
-			if(calc_status.autopoweroff_counter >= AUTO_POWER_OFF_BOUND)
-			{
-				return;
-			}
-		}
-
-		if(kbd_hit(&KBD1_PORT))
-		{
-			kbd_readkey(&KBD1_PORT, row, col);
-			kbd_num = 1;
-		}
-		else if(kbd_hit(&KBD2_PORT))
-		{
-			kbd_readkey(&KBD2_PORT, row, col);
-			kbd_num = 2;
-		}
-	} while(kbd_num==0);
-	//0 <= *row <= 3, 0 <= *col <= 3
-	*row = (~*row) & 0x03;
-	*col = (~*col) & 0x03;
-	//Convert row and col to all keyboard
-	if(kbd_num==2)
-		*col += 4;
-}
+//Tasks run by the scheduler (sched.h). The task ID is its priority.
+#define TASK_EDITOR					0		//Key events
+#define TASK_DISPLAY				1		//Screen refresh and cursor blinking
+#define TASK_POWER					2		//Power off and on
+#define TASK_EVALUATOR			3		//'=' and the live preview (preemptible)
+#define TASK_STORE					4		//EEPROM write-back (eestore.h)
+
+//Keys of the EEPROM store
+#define STORE_ANS						0
+#define STORE_SEED					1		//Ran# state
+#define STORE_ANGLEBASE			2
+#define STORE_SETTINGS			3		//STORE_PREVIEW | STORE_WELCOME
+#define STORE_FORMAT				4		//Display mode | digits << 4
+
+#define STORE_PREVIEW				0x01
+#define STORE_WELCOME				0x02
+
+void display_redraw(void);
+void eval_restart(void);
+void eval_cancel(void);
+void eval_final(void);
+void show_calc_error(int errorpos);
+void show_result(NUMBER result);
+void menu_hide_cursor(void);
+void menu_shift_key(void);
+void menu_shift_show(void);
+void anglebase_show(void);
+void format_show(void);
+void settings_store(void);
+void formula_changed(void);
+void formula_recall(void);
 
 //************************************************************************//
-//NOT USED IN THIS VERSION
-//This function can be implemented to read combination of buttons pressed simultaneously.
-/*BOOLEAN button_multipressed(void)
+//Power state accounted by the Timer1 ISR (DIAG_POWER_*)
+volatile unsigned char power_state = DIAG_POWER_ACTIVE;
+
+//Sleeps in idle mode until the next interrupt (at the latest the next tick).
+//Power down sleep is not used: it can only be woken by INT0..INT2, and the ON key is
+//  on keyboard 2 (PORTA), which has no external interrupt pin. The timers must also
+//  keep running to scan the keyboard, so idle is the deepest usable mode.
+//Called by the scheduler with interrupts disabled when no task is ready. The
+//  instruction after sei() is always executed, so an interrupt that makes a task
+//  ready can not slip in between the check and the sleep.
+void cpu_idle(void)
 {
-	return(kbd_hitall());
-}*/
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	power_state = calc_status.poweron ? DIAG_POWER_IDLE : DIAG_POWER_OFF;
+	sleep_enable();
+	sei();
+	sleep_cpu();
+	sleep_disable();
+	power_state = DIAG_POWER_ACTIVE;
+}
 
 //************************************************************************//
-//NOT USED IN THIS VERSION
-//This function can be implemented to read combination of buttons pressed simultaneously.
-/*void button_multiread(void)
-{
-}*/
+//Converts between a key number of kbd_scan_pair (keyboard row * 8 + keyboard * 4 +
+//  keyboard column) and a row/column of the kbd_table_* maps.
+//The keyboards are wired in reverse, so keyboard row/column r is map row/column 3 - r
+//  (keyboard 2 is map columns 4..7).
+#define KEY_NUMBER(row, col)		(((3 - (row)) << 3) | ((col) & 4) | (3 - ((col) & 3)))
+#define KEY_ROW(key)						(3 - ((key) >> 3))
+#define KEY_COL(key)						(((key) & 4) | (3 - ((key) & 3)))
 
-//************************************************************************//
-//Returns True if a button is pressed and available.
-BOOLEAN button_pressed(void)
-{
-	return((kbd_hit(&KBD1_PORT) && !kbd_hit(&KBD2_PORT)) ||
-			   (kbd_hit(&KBD2_PORT) && !kbd_hit(&KBD1_PORT)));
-}
+//SHIFT key (held SHIFT + key is read as a shifted key)
+#define KEY_SHIFT								KEY_NUMBER(0, 4)
 
 //************************************************************************//
 //Reads a button from the keyboard. This function returns the button code depending on the
 //  shift status of the calculator.
-unsigned char button_read(void)
+//Takes the next key press from the key event FIFO (keys pressed while the
+//  calculator was busy are not lost). Returns False if no key was pressed.
+//A key pressed while SHIFT is held (chord) is always shifted.
+BOOLEAN button_get(unsigned char *button_code)
 {
 	unsigned char row, col;
+	unsigned char event;
 	char button;
 	
-	while(!calc_status.buttonreleased);
-	kbd_readkeyall(&row, &col);
-	calc_status.buttonreleased = False;
-
-	if(calc_status.autopoweroff_counter >= AUTO_POWER_OFF_BOUND)
+	do
 	{
-		return(BUTTON_OFF);
-	}
+		if(!kbd_event_get(&event))
+			return(False);
+	} while(event & KBD_EVENT_RELEASE);
+	row = KEY_ROW(event & KBD_EVENT_KEY);
+	col = KEY_COL(event & KBD_EVENT_KEY);
+	if(event & KBD_EVENT_CHORD)
+		calc_status.shift = ON;
 
 	if(calc_status.shift)
 	{
@@ -394,8 +346,11 @@ unsigned char button_read(void)
 	{
 		memcpy_P(&button, &kbd_table_normal[row][col], 1);
 	}
+	cli();
 	calc_status.autopoweroff_counter = 0;
-	return button;
+	sei();
+	*button_code = button;
+	return(True);
 
 /*	unsigned char debug_btns[]={FUNCTION_SIN, FUNCTION_SIN, FUNCTION_SIN, FUNCTION_SIN, FUNCTION_COS, NUMBER_3, NUMBER_6, BUTTON_RPAREN,  BUTTON_RPAREN,  BUTTON_RPAREN,  BUTTON_RPAREN,  BUTTON_RPAREN, BUTTON_EQUAL, FORMULA_LEFT, OPERATOR_PLUS, NUMBER_3, BUTTON_EQUAL, FORMULA_LEFT, OPERATOR_MINUS, NUMBER_6, NUMBER_5, BUTTON_EQUAL, FUNCTION_SIN, FUNCTION_SIN, FUNCTION_COS, BUTTON_EQUAL, FORMULA_LEFT, NUMBER_5, NUMBER_7, BUTTON_RPAREN, BUTTON_RPAREN, BUTTON_EQUAL, FORMULA_LEFT, BUTTON_RPAREN, OPERATOR_PLUS, NUMBER_2};
 	static int debug_charindex=0;
@@ -412,7 +367,7 @@ void lcd_applystatus(void)
 	
   char cmd_code = 0x00;
 	
-	lcd_gotoxy(lcd_status.col, lcd_status.row);
+	lcd_moveto(lcd_status.col, lcd_status.row);
 
 	if(lcd_status.showtext) 
 		cmd_code|=LCD_DISP_DISP_ON;
@@ -427,119 +382,114 @@ void lcd_applystatus(void)
 	else
 		cmd_code |= LCD_DISP_BLINK_OFF;
 
-	lcd_command(cmd_code);
+	lcd_set_display(cmd_code);
 }
 
 //************************************************************************//
 //Interrupt Service Routine for Timer1 Compare Match A:
-//  -- Show cursor blinking
-//  -- Check keyboards to see if all buttons are released.
+//  -- Count the auto power off time (EV_POWER_OFF), the power task timer (EV_WORK)
+//    and the EEPROM store write-back delay (EV_STORE)
+//  -- Count cursor blinking steps (EV_BLINK, the LCD is only written by lcd_blink_task)
+//  -- Scan and debounce the keyboards (EV_KEY).
 ISR(SIG_OUTPUT_COMPARE1A)
 {
-	static BOOLEAN show_insert_box = False;
+	DIAG_ISR_BEGIN();
 
-	calc_status.autopoweroff_counter++;
+	DIAG_POWER_TICK(power_state, tick_ms);
+	if(++calc_status.autopoweroff_counter >= AUTO_POWER_OFF_BOUND)
+	{
+		calc_status.autopoweroff_counter = 0;
+		sched_signal(EV_POWER_OFF);
+	}
+	DIAG_WAKE_TICK(tick_ms);
+	if(power_timer && !--power_timer)
+		sched_post(TASK_POWER, EV_WORK);
+	if(eestore_timer && !--eestore_timer)
+		sched_signal(EV_STORE);
 
 	if(lcd_status.cursorblinking)
 	{
 		lcd_status.temp_blinkstep++;
-		if(lcd_status.temp_blinkstep>=3)  //3 * 200ms = ~600ms
+		if(lcd_status.temp_blinkstep>=BLINK_TICKS)
 		{
-			if(calc_status.insertmode && !lcd_status.charblinking)
-			{
-				lcd_status.showcursor = False;
-				show_insert_box = !show_insert_box;
-				if(show_insert_box)
-					lcd_putchar(4);
-				else
-					lcd_putchar(lcd_line0[lcd_status.col]);
-			}
-			else
-			{
-				lcd_status.showcursor = !lcd_status.showcursor;
-			}
 			lcd_status.temp_blinkstep = 0;
+			sched_signal(EV_BLINK);
 		}
-		if(lcd_status.charblinking)
-			lcd_status.showcursor=False;
-		lcd_applystatus();
 	}
 
-	if(!calc_status.buttonreleased)
+	if(kbd_debounce(kbd_scan_pair(&KBD1_PORT, &KBD2_PORT)))
+		sched_signal(EV_KEY);
+	
+	DIAG_ISR_END(DIAG_ISR_TIMER1);
+}
+
+//************************************************************************//
+//Blinks the cursor or the insert box when the Timer1 ISR asks for it.
+//Called by the display task (EV_BLINK).
+//The block blinking of the LCD (charblinking) is done by the controller itself.
+void lcd_blink_task(void)
+{
+	static BOOLEAN show_insert_box = False;
+
+	if(!lcd_status.cursorblinking)
+		return;
+
+	if(calc_status.insertmode && !lcd_status.charblinking)
+	{
+		lcd_status.showcursor = False;
+		show_insert_box = !show_insert_box;
+		lcd_moveto(lcd_status.col, lcd_status.row);
+		if(show_insert_box)
+			lcd_write(SLOT_INSERT);
+		else
+			lcd_write(lcd_line0[lcd_status.col]);
+	}
+	else
 	{
-		calc_status.buttonreleased = !button_pressed();
+		lcd_status.showcursor = !lcd_status.showcursor;
 	}
-	
+	if(lcd_status.charblinking)
+		lcd_status.showcursor=False;
+	lcd_applystatus();
 }
 
 //************************************************************************//
-//Seraches for the string representing corresponding to the button code
-//Returns False if the specified button code does not exist in the tables (not used in this version)
+//Finds the string representing the button code on the LCD (one lookup in key_table).
+//Returns False if the specified button code can not be part of a formula.
 //Other return values:
 //  displen: length of the representing string
 //  char_address: address of the representing string in the flash memory
 BOOLEAN find_formula_char(unsigned char charcode, unsigned char *displen,
 		FLASH char **char_address)
 {
-	unsigned char code;
-	unsigned char row, table_num=1;
-	FLASH char *char_table;
+	KEY_DESC desc;
+
+	key_lookup(charcode, &desc);
+	*displen = desc.glyph_len;
+	*char_address = key_glyph_addr(&desc);
+	return(desc.glyph_len != 0);
+}
+
+//************************************************************************//
+//Returns the number of LCD cells used by the keys from..to of the formula.
+//Stops counting as soon as the width exceeds limit.
+int formula_width(int from, int to, int limit)
+{
+	int width=0;
 	
-	while(table_num<=8)
-	{
-		switch(table_num)
-		{
-		case 1:
-			char_table = (FLASH char *) &formula_char_table_1len;
-			break;
-		case 2:
-			char_table = (FLASH char *) &formula_char_table_2len;
-			break;
-		case 3:
-			char_table = (FLASH char *) &formula_char_table_3len;
-			break;
-		case 4:
-			char_table = (FLASH char *) &formula_char_table_4len;
-			break;
-		case 5:
-			char_table = (FLASH char *) &formula_char_table_5len;
-			break;
-		case 6:
-			char_table = (FLASH char *) &formula_char_table_6len;
-			break;
-		case 7:
-			char_table = (FLASH char *) &formula_char_table_7len;
-			break;
-		case 8:
-			char_table = (FLASH char *) &formula_char_table_8len;
-			break;
-		}
-		row=0;
-		do
-		{
-			memcpy_P(&code, char_table+row*(table_num+1), 1);
-			row++;
-		} while((code!=charcode) && (code!=0xFF));
-		if(code==charcode)
-			break;
-		table_num++;
-	}
-	if(code==charcode)
-	{
-		*displen = table_num;
-		row--;
-		*char_address = char_table+row*(table_num+1)+1;
-		return(True);
-	}
-	return(False);
+	while((from<=to) && (width<=limit))
+		width+=key_glyph_len(gap_at(&formula, from++));
+	return(width);
 }
 
 //************************************************************************//
 //Updates lcd_line0 to be displayed in the first line of the LCD.
+//The window (displeftpos..disprightpos) is kept from the previous call and only
+//  scrolled as far as needed to show the cursor.
 void generate_disp_formula(void)
 {
-	int displeftpos;
-	int space_len;
+	int displeftpos, lastpos, len;
+	int space_len, width;
 	char c;
 	FLASH char *addr;
 	unsigned char char_len;
@@ -549,7 +499,8 @@ void generate_disp_formula(void)
 	for(i=1;i<=12;i++)
 		lcd_line0[i]=' ';
 	
-	if(formula_status.len==0)
+	len=gap_len(&formula);
+	if(len==0)
 	{
 		lcd_status.col=1;
 		lcd_status.row=0;
@@ -558,36 +509,47 @@ void generate_disp_formula(void)
 		return;
 	}
 	
-	if(calc_status.submode==SM_FORMULA)
+	space_len=12;
+	if((calc_status.submode==SM_FORMULA) && (formula_status.cursorpos==len))
+		space_len=11;  //Keep a free cell for the cursor after the last key
+	
+	//Last key that must be visible: the key at the cursor or the one before it
+	if(formula_status.cursorpos<len)
+		lastpos=formula_status.cursorpos;
+	else
+		lastpos=formula_status.cursorpos-1;
+	
+	//Start from the previous window, so it only scrolls when the cursor leaves it.
+	//Every step below looks at no more keys than fit in the window.
+	displeftpos=formula_status.displeftpos;
+	if(displeftpos>lastpos)
+		displeftpos=lastpos;
+	width=formula_width(displeftpos, lastpos, space_len);
+	if(width>space_len)
 	{
-		if(formula_status.cursorpos==formula_status.len)
-			space_len=11;
-		else
-			space_len=12;
+		//Cursor is right of the window: make lastpos the last key of the window
+		displeftpos=lastpos+1;
+		width=0;
 	}
-	else if(calc_status.submode==SM_NEWFORMULA)
-		space_len=12;
-	
-	if(formula_status.cursorpos<formula_status.len)
-		displeftpos=formula_status.cursorpos;
 	else
-		displeftpos=formula_status.cursorpos-1;
-	displeftpos++;
-	do
 	{
-		c=formula[displeftpos-1];
-		find_formula_char(c, &char_len, &addr);
-		space_len-=char_len;
-		if(space_len>=0)
-			displeftpos--;
-	} while((space_len>0) && (displeftpos>0));
+		//Cursor is in the window: fill the free cells at the right end (after a delete)
+		width=formula_width(displeftpos, len-1, space_len);
+	}
+	while(displeftpos>0)
+	{
+		char_len=key_glyph_len(gap_at(&formula, displeftpos-1));
+		if((width+char_len)>space_len)
+			break;
+		width+=char_len;
+		displeftpos--;
+	}
 	
-	space_len=11;
 	formula_status.displeftpos=displeftpos;
 	char_index=1;
 	do
 	{
-		c=formula[displeftpos];
+		c=gap_at(&formula, displeftpos);
 		find_formula_char(c, &char_len, &addr);
 		if(displeftpos==formula_status.cursorpos)
 		{
@@ -602,19 +564,18 @@ void generate_disp_formula(void)
 		memcpy_P(&lcd_line0[char_index], addr, char_len);
 		char_index+=char_len;
 		displeftpos++;
-	} while((char_index<13) && (displeftpos<formula_status.len));
+	} while((char_index<13) && (displeftpos<len));
 	lcd_status.row=0;
 	formula_status.disprightpos = --displeftpos;
 }
 
 //************************************************************************//
-//Puts special character codes in the LCD display line (lcd_line0) and also
-//  changes character maps in the LCD RAM if necessary.
+//Puts special character codes in the LCD display line (lcd_line0). The CGRAM
+//  manager only uploads a glyph when it is not in the LCD already.
 void update_special_chars(void)
 {
 	BOOLEAN showleftarrow = False;
-	LCC lcc;
-	FLASH char *lcc_p;
+	int len = gap_len(&formula);
 	
 	//Update left arrow
 	if((calc_status.submode==SM_FORMULA) || (calc_status.submode==SM_NEWFORMULA))
@@ -622,14 +583,11 @@ void update_special_chars(void)
 	if(calc_status.shift || showleftarrow)
 	{
 		if(calc_status.shift && showleftarrow)
-			lcc_p = (FLASH char *) &LCDCHAR_LEFTARROWSHIFT;
+			lcd_line0[0] = LCD_GLYPH(LEFTARROWSHIFT);
 		else if(calc_status.shift)
-			lcc_p = (FLASH char *) &LCDCHAR_SHIFT;
-		else if(showleftarrow)
-			lcc_p = (FLASH char *) &LCDCHAR_LEFTARROWNOSHIFT;
-		memcpy_P(&lcc, lcc_p, 8);
-		lcd_set_custom_char(0, &lcc);
-		lcd_line0[0] = 0;
+			lcd_line0[0] = LCD_GLYPH(SHIFT);
+		else
+			lcd_line0[0] = LCD_GLYPH(LEFTARROWNOSHIFT);
 	}
 	else
 		lcd_line0[0] = ' ';
@@ -637,9 +595,9 @@ void update_special_chars(void)
 	//Update right arrow
 	if((calc_status.submode == SM_FORMULA) || (calc_status.submode == SM_NEWFORMULA))
 	{
-		if( (formula_status.disprightpos < (formula_status.len-1)) ||
-			( (formula_status.disprightpos == (formula_status.len-1)) && (formula_status.len >= 12) && (formula_status.cursorpos != formula_status.len) ) )
-			lcd_line0[13] = 1;
+		if( (formula_status.disprightpos < (len-1)) ||
+			( (formula_status.disprightpos == (len-1)) && (len >= 12) && (formula_status.cursorpos != len) ) )
+			lcd_line0[13] = LCD_GLYPH(RIGHTARROW);
 		else
 			lcd_line0[13] = ' ';
 	}
@@ -652,52 +610,38 @@ void update_special_chars(void)
 	switch(calc_status.anglebase)
 	{
 	case DEGREE:
-		lcc_p = (FLASH char *) &LCDCHAR_DSMALL;
+		lcd_line0[15] = LCD_GLYPH(DSMALL);
 		break;
 	case RADIANS:
-			lcc_p = (FLASH char *) &LCDCHAR_RSMALL;
+			lcd_line0[15] = LCD_GLYPH(RSMALL);
 			break;
 	case GRADIANS:
-			lcc_p = (FLASH char *) &LCDCHAR_GSMALL;
+			lcd_line0[15] = LCD_GLYPH(GSMALL);
 			break;
 	default:
-			lcc_p = (FLASH char *) &LCDCHAR_DSMALL;
+			lcd_line0[15] = LCD_GLYPH(DSMALL);
 			calc_status.anglebase = DEGREE;
 	}
-	memcpy_P(&lcc, lcc_p, 8);
-	lcd_set_custom_char(2, &lcc);
-	lcd_line0[15] = 2;
 	
 	//Update hyp char
 	if((calc_status.submode == SM_FORMULA) || (calc_status.submode == SM_NEWFORMULA))
 	{
 		if(calc_status.hyp)
-			lcd_line0[14] = 3;
+			lcd_line0[14] = LCD_GLYPH(HYP);
 		else
 			lcd_line0[14] = ' ';
 	}
 }
 
 //************************************************************************//
-//Writes one line to the LCD depending on the lineno parameter.
+//Writes one line to the LCD depending on the lineno parameter
+//  (only the characters that changed since the last write are sent).
 void lcd_updateline(unsigned char lineno)
 {
-	char *lcd_line;
-	int i;
-	
 	if(lineno==0)
-	{
-		lcd_gotoxy(0,0);
-		lcd_line = lcd_line0;
-	}
+		lcd_update_row(0, lcd_line0);
 	else
-	{
-		lcd_gotoxy(0, 1);
-		lcd_line = lcd_line1;
-	}
-
-	for(i=0;i<16;i++)
-		lcd_putchar(lcd_line[i]);
+		lcd_update_row(1, lcd_line1);
 	
 	lcd_applystatus();
 }
@@ -706,6 +650,8 @@ void lcd_updateline(unsigned char lineno)
 //Refreshes all LCD screen.
 void lcd_refresh(void)
 {
+	DIAG_BEGIN(DIAG_SITE_LCD_REFRESH);
+
 	if((calc_status.submode == SM_FORMULA) ||
 			(calc_status.submode == SM_NEWFORMULA))
 	{
@@ -714,16 +660,16 @@ void lcd_refresh(void)
 		
 	update_special_chars();
 		
-	lcd_updateline(0);
+	lcd_update_row(0, lcd_line0);
 		
-	lcd_updateline(1);
+	lcd_update_row(1, lcd_line1);
 	
 	
 	switch(calc_status.submode)
 	{
 	case SM_FORMULA:
 		{
-			lcd_status.charblinking=formula_status.len>=FORMULA_BLINK_BOUND;
+			lcd_status.charblinking=gap_len(&formula)>=FORMULA_BLINK_BOUND;
 			lcd_status.cursorblinking = True && !lcd_status.charblinking;
 			lcd_status.showcursor = !lcd_status.charblinking && !calc_status.insertmode;
 			break;
@@ -731,6 +677,8 @@ void lcd_refresh(void)
 	case SM_NEWFORMULA:
 	case SM_ERROR:
 	case SM_DRGSELECT:
+	case SM_DIAG:
+	case SM_FMTSELECT:
 		{
 			lcd_status.charblinking = False;
 			lcd_status.cursorblinking = False;
@@ -740,6 +688,8 @@ void lcd_refresh(void)
 	}
 	
 	lcd_applystatus();
+
+	DIAG_END(DIAG_SITE_LCD_REFRESH);
 }
 
 //************************************************************************//
@@ -789,447 +739,1086 @@ unsigned char correct_button(unsigned char button)
 FLASH char drg_select_msg_line0[] = " Deg  Rad  Gra  ";
 FLASH char drg_select_msg_line1[] = "  1    2    3   ";
 
+//Shows the angle base screen. The buttons are handled by anglebase_key.
 void select_anglebase(void)
 {
-	unsigned char button;
-	unsigned char old_mode;
-	LCC lcc;
-	
-	old_mode = calc_status.submode;
+	menu_old_mode = calc_status.submode;
 	calc_status.submode = SM_DRGSELECT;
-	lcd_refresh();
-	lcd_clear();
-	lcd_gotoxy(0,0);
-	lcd_puts_P(drg_select_msg_line0);
-	lcd_gotoxy(0,1);
-	lcd_puts_P(drg_select_msg_line1);
+	menu_hide_cursor();
+	anglebase_show();
 	
 	calc_status.shift = OFF;
+}
 
-	memcpy_P(&lcc, &LCDCHAR_SHIFT, 8);
-	lcd_set_custom_char(0, &lcc);
-	
-	do
+//Writes the angle base screen.
+void anglebase_show(void)
+{
+	lcd_cls();
+	lcd_moveto(0,0);
+	lcd_print_P(drg_select_msg_line0);
+	lcd_moveto(0,1);
+	lcd_print_P(drg_select_msg_line1);
+}
+
+//Handles a button of the angle base screen (SM_DRGSELECT).
+void anglebase_key(unsigned char button)
+{
+	switch(button)
 	{
-		button = button_read();
-		switch(button)
+	case NUMBER_1:
 		{
-		case NUMBER_1:
-			{
-				calc_status.anglebase = DEGREE;
-				parser_status.anglebase = DEGREE;
-				break;
-			}
-		case NUMBER_2:
-			{
-				calc_status.anglebase = RADIANS;
-				parser_status.anglebase = RADIANS;
-				break;
-			}
-		case NUMBER_3:
-			{
-				calc_status.anglebase = GRADIANS;
-				parser_status.anglebase = GRADIANS;
-				break;
-			}
-		case BUTTON_DRG:
-			{
-				break;
-			}
-		case BUTTON_SHIFT:
-			{
-				calc_status.shift = !calc_status.shift;
-					lcd_gotoxy(0,0);
-				if(calc_status.shift)
-					lcd_putchar(0);
-				else
-					lcd_putchar(' ');
-				break;
-			}
+			calc_status.anglebase = DEGREE;
+			parser_context.status.anglebase = DEGREE;
+			break;
 		}
-	} while((button != NUMBER_1) && (button != NUMBER_2) &&
-			(button != NUMBER_3) && (button != BUTTON_DRG));
-	calc_status.submode = old_mode;
-	lcd_refresh();
+	case NUMBER_2:
+		{
+			calc_status.anglebase = RADIANS;
+			parser_context.status.anglebase = RADIANS;
+			break;
+		}
+	case NUMBER_3:
+		{
+			calc_status.anglebase = GRADIANS;
+			parser_context.status.anglebase = GRADIANS;
+			break;
+		}
+	case BUTTON_DRG:
+		{
+			break;
+		}
+	case BUTTON_SHIFT:
+		{
+			menu_shift_key();
+			return;
+		}
+	default:
+		return;
+	}
+	calc_status.submode = menu_old_mode;
+	eval_restart();
+	display_redraw();
+}
+
+//Hides the cursor for a menu screen (the menus are written directly, not by
+//  lcd_refresh).
+void menu_hide_cursor(void)
+{
+	lcd_status.charblinking = False;
+	lcd_status.cursorblinking = False;
+	lcd_status.showcursor = False;
+	lcd_applystatus();
+}
+
+//Toggles SHIFT in a menu screen.
+void menu_shift_key(void)
+{
+	calc_status.shift = !calc_status.shift;
+	menu_shift_show();
+}
+
+//Shows the SHIFT indicator of a menu screen in the top left corner.
+void menu_shift_show(void)
+{
+	char c;
+
+	//Get the glyph first: uploading it moves the LCD address to CGRAM
+	if(calc_status.shift)
+		c = LCD_GLYPH(SHIFT);
+	else
+		c = ' ';
+	lcd_moveto(0,0);
+	lcd_write(c);
 }
 
 //************************************************************************//
-//Displays a string in the result line of the LCD indicating no result is available.
-void show_empty_result(void)
+//Selects the result display mode (numfmt.h): 1 Norm, then for 2 Fix, 3 Sci and 4 Eng
+//  the number of decimals or significant digits (0 = 9 for Sci and Eng).
+FLASH char fmt_select_msg_line0[] = " Nrm Fix Sci Eng";
+FLASH char fmt_select_msg_line1[] = "  1   2   3   4 ";
+FLASH char fmt_digits_msg_line1[] = "Digits? (0~9)   ";
+
+//Mode chosen in the format screen while its digits are asked (FMT_AUTO = none yet)
+unsigned char fmt_select_mode;
+
+//Shows the format screen. The buttons are handled by format_key.
+void select_format(void)
 {
-	int i;
-	
-	for(i=0;i<15;i++)
-		lcd_line1[i] = ' ';
-	lcd_line1[15] = '.';
-	lcd_line1[14] = '0';
+	menu_old_mode = calc_status.submode;
+	calc_status.submode = SM_FMTSELECT;
+	fmt_select_mode = FMT_AUTO;
+	menu_hide_cursor();
+	format_show();
 	
-	lcd_updateline(1);
+	calc_status.shift = OFF;
 }
 
-//************************************************************************//
-//Formula flags returned by the get_formula function to the caller function.
-typedef struct
+//Writes the format screen (with the digits question once a mode is chosen).
+void format_show(void)
 {
-	BOOLEAN poweroff:1;
-	BOOLEAN formuladone:1;
-} FORMULA_FLAGS;
+	lcd_cls();
+	lcd_moveto(0,0);
+	lcd_print_P(fmt_select_msg_line0);
+	lcd_moveto(0,1);
+	if(fmt_select_mode == FMT_AUTO)
+		lcd_print_P(fmt_select_msg_line1);
+	else
+		lcd_print_P(fmt_digits_msg_line1);
+}
 
-//Function to get a formula from user.
-void get_formula(FORMULA_FLAGS *flags)
+//Handles a button of the format screen (SM_FMTSELECT).
+void format_key(unsigned char button)
 {
-	unsigned char button = 0;
-	
-	flags->poweroff=False;
-	flags->formuladone=False;
-	
-	while(True)
+	switch(button)
 	{
-		button = correct_button(button_read());
-		
-		switch(button)
+	case NUMBER_0: case NUMBER_1: case NUMBER_2: case NUMBER_3: case NUMBER_4:
+	case NUMBER_5: case NUMBER_6: case NUMBER_7: case NUMBER_8: case NUMBER_9:
 		{
-		case BUTTON_ON:
-			{
-				formula_status.len = 0;
-				formula_status.cursorpos = 0;
-				calc_status.submode = SM_FORMULA;
-				calc_status.insertmode = False;
-				show_empty_result();
-				break;
-			}
-		case BUTTON_OFF:
-			{
-				calc_status.shift = OFF;
-				flags->poweroff=True;
-				return;
-				break;
-			}
-		case FORMULA_LEFT:
-			{
-				if(calc_status.submode==SM_FORMULA)
-				{
-					formula_status.cursorpos--;
-					if(formula_status.cursorpos<0)
-						formula_status.cursorpos=0;
-				}
-				else if((calc_status.submode==SM_NEWFORMULA) ||
-						(calc_status.submode==SM_ERROR))
-				{
-					formula_status.cursorpos=formula_status.len;
-					calc_status.submode = SM_FORMULA;
-				}
-				break;
-			}
-		case FORMULA_RIGHT:
-			{
-				if(calc_status.submode==SM_FORMULA)
-				{
-					formula_status.cursorpos++;
-					if(formula_status.cursorpos>=formula_status.len)
-						formula_status.cursorpos=formula_status.len;
-				}
-				else if((calc_status.submode==SM_NEWFORMULA) ||
-						(calc_status.submode==SM_ERROR))
-				{
-					formula_status.cursorpos=0;
-					calc_status.submode = SM_FORMULA;
-				}
-				break;
-			}
-		case FORMULA_HOME:
-			{
-				if((calc_status.submode==SM_FORMULA) || (calc_status.submode==SM_NEWFORMULA))
-				{
-					formula_status.cursorpos=0;
-					calc_status.submode = SM_FORMULA;
-				}
-				break;
-			}
-		case FORMULA_END:
-			{
-				if((calc_status.submode==SM_FORMULA) || (calc_status.submode==SM_NEWFORMULA))
-				{
-					formula_status.cursorpos=formula_status.len;
-					calc_status.submode = SM_FORMULA;
-				}
-				break;
-			}
-		case FORMULA_DEL:
+			if(fmt_select_mode != FMT_AUTO)
 			{
-				if((calc_status.submode==SM_FORMULA) && (formula_status.len>0))
-				{
-					if(calc_status.insertmode)
-					{
-						//Interpret DEL as backspace
-						if(formula_status.cursorpos==0)
-						{
-							//Delete char at cursor
-							formula_status.len--;
-							memmove(&formula[formula_status.cursorpos], &formula[formula_status.cursorpos+1],
-									formula_status.len - formula_status.cursorpos);
-						}
-						else
-						{
-							//Delete char at left
-							memmove(&formula[formula_status.cursorpos-1], &formula[formula_status.cursorpos],
-									formula_status.len-formula_status.cursorpos);
-							formula_status.len--;
-							formula_status.cursorpos--;
-						}
-					}
-					else
-					{
-						if(formula_status.cursorpos==formula_status.len)
-						{
-							formula_status.cursorpos--;
-							formula_status.len--;
-						}
-						else
-						{
-							formula_status.len--;
-							memmove(&formula[formula_status.cursorpos], &formula[formula_status.cursorpos+1],
-									formula_status.len - formula_status.cursorpos);
-							if(formula_status.cursorpos>formula_status.len)
-								formula_status.len--;
-						}
-					}
-				}
+				calc_status.fmtmode = fmt_select_mode;
+				calc_status.fmtdigits = button - NUMBER_0;
 				break;
 			}
-		case FORMULA_INS:
+			if(button == NUMBER_1)
 			{
-				if(calc_status.submode==SM_FORMULA)
-				{
-					calc_status.insertmode=!calc_status.insertmode;
-				}
+				calc_status.fmtmode = FMT_AUTO;
+				calc_status.fmtdigits = 0;
 				break;
 			}
-		case BUTTON_SHIFT:
+			if((button < NUMBER_2) || (button > NUMBER_4))
+				return;
+			//Ask for the digits
+			fmt_select_mode = FMT_FIX + (button - NUMBER_2);
+			lcd_moveto(0,1);
+			lcd_print_P(fmt_digits_msg_line1);
+			return;
+		}
+	case BUTTON_FORMAT:
+		{
+			break;
+		}
+	case BUTTON_SHIFT:
+		{
+			menu_shift_key();
+			return;
+		}
+	default:
+		return;
+	}
+	calc_status.submode = menu_old_mode;
+	calc_status.shift = OFF;
+	if(calc_status.submode == SM_NEWFORMULA)
+		show_result(parser_context.status.ans);
+	eval_restart();
+	display_redraw();
+}
+
+//************************************************************************//
+//Shows the SRAM and stack diagnostics collected by diag.c.
+//DIAG or = shows the next page, any other button returns to the formula.
+//  Page 0: smallest free stack ever and stack used by parser_init, calc and lcd_refresh
+//  Page 1: peak/size of the parser pools (op stack, value stack, program, constants)
+//  Page 2: number of entries taken from each parser pool
+//  Page 3: LCD bus writes of the last keystroke, the most for one keystroke and the total
+//  Page 4: longest run of the Timer1 and LCD queue (Timer0) ISRs in microseconds
+//  Page 5: seconds active, idle and off, and the estimated average current in uA
+//  Page 6: ms from the last reset or ON key until keys were taken, and the longest
+//  Page 7: CPU cycles to format Ans for the result line (number.h) and with dtostre
+//  Page 8: floats over the whole range whose shortest decimal does not read back as the
+//    same float, and CPU cycles to convert the digits of Ans (number.h) and with strtod
+//  Page 9: benchmark of the number backend (number.h): results of the corpus shown as
+//    expected, and CPU cycles to compile and to evaluate all of its formulas
+#if _DIAG_ENABLED_
+FLASH char diag_stackfree_msg[] = "Stack free";
+FLASH char diag_alloc_msg[] = "Alloc ";
+FLASH char diag_lcd_msg[] = "LCD ";
+FLASH char diag_isr_msg[] = "ISR max us";
+FLASH char diag_power_msg[] = "uA";
+FLASH char diag_wake_msg[] = "Wake ms";
+FLASH char diag_fmt_msg[] = "Fmt cycles";
+FLASH char diag_roundtrip_msg[] = "Round trip";
+#if _DECIMAL_NUMBERS_
+FLASH char diag_bench_msg[] = "Bench dec";
+#else
+FLASH char diag_bench_msg[] = "Bench bin";
+#endif
+
+//Floats checked by diag_round_trip and the step between their bits
+#define DIAG_ROUND_TRIPS		256
+#define DIAG_ROUND_TRIP_STEP	0x007F7A5BUL
+
+//Benchmark corpus: formulas as key codes, each ended by '='. The first
+//  DIAG_BENCH_CHECKED are sums and products whose decimal result is exact; their
+//  result line in FMT_AUTO must show diag_bench_results. The others are timed only.
+#define DIAG_BENCH_ITEMS		12
+#define DIAG_BENCH_CHECKED	8
+FLASH UCHAR diag_bench_keys[] =
+{
+	'0', '.', '1', '+', '0', '.', '2', '=',
+	'1', '-', '0', '.', '9', '=',
+	'4', '.', '3', '5', '*', '1', '0', '0', '=',
+	'1', '.', '1', '*', '1', '.', '1', '=',
+	'1', '2', '3', '4', '5', '.', '6', '7', '-', '1', '2', '3', '4', '5', '.', '6', '=',
+	'1', BUTTON_E, '1', '0', '+', '1', '=',
+	'1', '/', '8', '=',
+	'2', '/', '3', '*', '3', '=',
+	FUNCTION_SIN, '1', ')', '=',
+	FUNCTION_LN, '2', ')', '=',
+	FUNCTION_SQRT, '2', ')', '=',
+	'2', '^', '0', '.', '5', '='
+};
+FLASH char diag_bench_results[DIAG_BENCH_CHECKED][13] =
+{
+	"0.3", "0.1", "435.", "1.21", "0.07", "10000000001.", "0.125", "2."
+};
+
+//Writes a label followed by a number to the LCD at the current position.
+void lcd_put_value(char label, unsigned long value)
+{
+	char temp[11];
+
+	ultoa(value, temp, 10);
+	lcd_write(label);
+	lcd_print(temp);
+}
+
+//Writes the shortest decimal of |value| (fmt_decimal) as a literal into lit and returns
+//  its exponent (0 for NaN and infinity).
+int diag_literal(double value, FMT_LITERAL *lit)
+{
+	FMT_DECIMAL dec;
+	char temp[11];
+	unsigned char i;
+
+	fmt_literal_start(lit);
+	if(!fmt_decimal(value, &dec))
+		return(0);
+	ultoa(dec.mantissa, temp, 10);
+	for(i=0;temp[i];i++)
+		fmt_literal_digit(lit, temp[i] - '0', False);
+	return(dec.exponent);
+}
+
+//Returns the number of positive finite floats, DIAG_ROUND_TRIP_STEP apart, whose
+//  shortest decimal does not read back as the same float.
+unsigned int diag_round_trip(void)
+{
+	union { double value; unsigned long bits; } x;
+	FMT_LITERAL lit;
+	double back;
+	unsigned int i, errors = 0;
+	int exp10;
+
+	x.bits = 1;
+	for(i=0;i<DIAG_ROUND_TRIPS;i++, x.bits += DIAG_ROUND_TRIP_STEP)
+	{
+		exp10 = diag_literal(x.value, &lit);
+		back = fmt_literal_value(&lit, exp10);
+		if(memcmp(&back, &x.value, sizeof(double)) != 0)
+			errors++;
+	}
+	return(errors);
+}
+
+//Runs the benchmark corpus with the parser context, adds the CPU cycles to compile
+//  and to evaluate its formulas to *compile_cycles and *eval_cycles and returns the
+//  number of checked results that are shown as expected.
+//The formulas are read from their own gap buffer, so the edited formula stays; its
+//  compiled program is lost and the preview starts again (eval_restart).
+GAP_BUFFER diag_bench_formula;
+
+unsigned char diag_bench(unsigned long *compile_cycles, unsigned long *eval_cycles)
+{
+	NUMBER result;
+	char line[FMT_WIDTH], expected[13];
+	unsigned int k = 0;
+	unsigned char item, len, exact = 0;
+	UCHAR key;
+	BOOLEAN valid;
+
+	eval_cancel();
+	parser_context.preempt = NULL;
+	for(item=0;item<DIAG_BENCH_ITEMS;item++)
+	{
+		gap_clear(&diag_bench_formula);
+		memcpy_P(&key, &diag_bench_keys[k++], 1);
+		while(key != BUTTON_EQUAL)
+		{
+			gap_insert(&diag_bench_formula, gap_len(&diag_bench_formula), key);
+			memcpy_P(&key, &diag_bench_keys[k++], 1);
+		}
+		diag_cycles_begin();
+		valid = parser_compile(&parser_context, &diag_bench_formula);
+		*compile_cycles += diag_cycles_end();
+		if(!valid)
+			continue;
+		diag_cycles_begin();
+		valid = parser_evaluate(&parser_context, &result);
+		*eval_cycles += diag_cycles_end();
+		if(!valid || (item >= DIAG_BENCH_CHECKED))
+			continue;
+		num_format(result, FMT_AUTO, 0, line);
+		memcpy_P(expected, diag_bench_results[item], sizeof(expected));
+		len = strlen(expected);
+		if((memcmp(line + FMT_WIDTH - len, expected, len) == 0) && (line[FMT_WIDTH - len - 1] == ' '))
+			exact++;
+	}
+	eval_restart();
+	return(exact);
+}
+
+//Current diagnostics page
+unsigned char diag_page;
+
+//Shows the current diagnostics page.
+void show_diagnostics_page(void)
+{
+	lcd_cls();
+	lcd_moveto(0,0);
+	switch(diag_page)
+	{
+	case 0:
+		{
+			lcd_print_P(diag_stackfree_msg);
+			lcd_put_value(' ', diag_stack_free());
+			lcd_moveto(0,1);
+			lcd_put_value('I', diag.stack_used[DIAG_SITE_PARSER_INIT]);
+			lcd_write(' ');
+			lcd_put_value('C', diag.stack_used[DIAG_SITE_CALC]);
+			lcd_write(' ');
+			lcd_put_value('L', diag.stack_used[DIAG_SITE_LCD_REFRESH]);
+			break;
+		}
+	case 1:
+		{
+			lcd_put_value('S', diag.pool_peak[DIAG_POOL_OPSTACK]);
+			lcd_put_value('/', PARSER_STACK_DEPTH);
+			lcd_write(' ');
+			lcd_put_value('V', diag.pool_peak[DIAG_POOL_VALSTACK]);
+			lcd_put_value('/', PARSER_VALUE_DEPTH);
+			lcd_moveto(0,1);
+			lcd_put_value('P', diag.pool_peak[DIAG_POOL_PROGRAM]);
+			lcd_put_value('/', PARSER_PROGRAM_LEN);
+			lcd_write(' ');
+			lcd_put_value('K', diag.pool_peak[DIAG_POOL_CONST]);
+			lcd_put_value('/', PARSER_CONST_LEN);
+			break;
+		}
+	case 2:
+		{
+			lcd_print_P(diag_alloc_msg);
+			lcd_put_value('S', diag.pool_allocs[DIAG_POOL_OPSTACK]);
+			lcd_write(' ');
+			lcd_put_value('V', diag.pool_allocs[DIAG_POOL_VALSTACK]);
+			lcd_moveto(0,1);
+			lcd_put_value('P', diag.pool_allocs[DIAG_POOL_PROGRAM]);
+			lcd_write(' ');
+			lcd_put_value('K', diag.pool_allocs[DIAG_POOL_CONST]);
+			break;
+		}
+	case 3:
+		{
+			lcd_print_P(diag_lcd_msg);
+			lcd_put_value('L', diag.lcd_writes_last);
+			lcd_write(' ');
+			lcd_put_value('P', diag.lcd_writes_peak);
+			lcd_moveto(0,1);
+			lcd_put_value('T', lcd_bus_writes);
+			break;
+		}
+	case 4:
+		{
+			lcd_print_P(diag_isr_msg);
+			lcd_moveto(0,1);
+			lcd_put_value('T', diag.isr_wcet[DIAG_ISR_TIMER1]);
+			lcd_write(' ');
+			lcd_put_value('L', diag.isr_wcet[DIAG_ISR_LCD]);
+			break;
+		}
+	case 5:
+		{
+			lcd_print_P(diag_power_msg);
+			lcd_put_value(' ', diag_avg_current());
+			lcd_moveto(0,1);
+			lcd_put_value('A', diag.power_ms[DIAG_POWER_ACTIVE] / 1000);
+			lcd_write(' ');
+			lcd_put_value('I', diag.power_ms[DIAG_POWER_IDLE] / 1000);
+			lcd_write(' ');
+			lcd_put_value('O', diag.power_ms[DIAG_POWER_OFF] / 1000);
+			break;
+		}
+	case 6:
+		{
+			lcd_print_P(diag_wake_msg);
+			lcd_moveto(0,1);
+			lcd_put_value('L', diag.wake_ms_last);
+			lcd_write(' ');
+			lcd_put_value('P', diag.wake_ms_peak);
+			break;
+		}
+	case 7:
+		{
+			char temp[20];
+			unsigned long fmt_cycles, dtostre_cycles;
+
+			diag_cycles_begin();
+			num_format(parser_context.status.ans, calc_status.fmtmode, calc_status.fmtdigits, temp);
+			fmt_cycles = diag_cycles_end();
+			diag_cycles_begin();
+			dtostre(num_to_double(parser_context.status.ans), temp, 8, DTOSTR_UPPERCASE);
+			dtostre_cycles = diag_cycles_end();
+			lcd_print_P(diag_fmt_msg);
+			lcd_moveto(0,1);
+			lcd_put_value('F', fmt_cycles);
+			lcd_write(' ');
+			lcd_put_value('D', dtostre_cycles);
+			break;
+		}
+	case 8:
+		{
+			FMT_LITERAL lit;
+			char temp[20];
+			unsigned long literal_cycles, strtod_cycles;
+			unsigned int errors;
+			int exp10;
+
+			errors = diag_round_trip();
+			exp10 = diag_literal(num_to_double(parser_context.status.ans), &lit);
+			diag_cycles_begin();
+			num_literal(&lit, exp10);
+			literal_cycles = diag_cycles_end();
+			dtostre(num_to_double(parser_context.status.ans), temp, 8, 0);
+			diag_cycles_begin();
+			strtod(temp, NULL);
+			strtod_cycles = diag_cycles_end();
+			lcd_print_P(diag_roundtrip_msg);
+			lcd_put_value(' ', errors);
+			lcd_moveto(0,1);
+			lcd_put_value('L', literal_cycles);
+			lcd_write(' ');
+			lcd_put_value('S', strtod_cycles);
+			break;
+		}
+	case 9:
+		{
+			unsigned long compile_cycles = 0, eval_cycles = 0;
+			unsigned char exact;
+
+			exact = diag_bench(&compile_cycles, &eval_cycles);
+			lcd_print_P(diag_bench_msg);
+			lcd_put_value(' ', exact);
+			lcd_put_value('/', DIAG_BENCH_CHECKED);
+			lcd_moveto(0,1);
+			lcd_put_value('C', compile_cycles);
+			lcd_write(' ');
+			lcd_put_value('E', eval_cycles);
+			break;
+		}
+	}
+}
+
+//Shows the diagnostics screen. The buttons are handled by diagnostics_key.
+void show_diagnostics(void)
+{
+	menu_old_mode = calc_status.submode;
+	calc_status.submode = SM_DIAG;
+	menu_hide_cursor();
+	calc_status.shift = OFF;
+	diag_page = 0;
+	show_diagnostics_page();
+}
+
+//Handles a button of the diagnostics screen (SM_DIAG).
+void diagnostics_key(unsigned char button)
+{
+	if(button == BUTTON_SHIFT)
+	{
+		calc_status.shift = !calc_status.shift;
+		return;
+	}
+	calc_status.shift = OFF;
+	if((button == BUTTON_DIAG) || (button == BUTTON_EQUAL))
+	{
+		if(++diag_page >= 10)
+			diag_page = 0;
+		show_diagnostics_page();
+		return;
+	}
+	calc_status.submode = menu_old_mode;
+	display_redraw();
+	sched_post(TASK_EVALUATOR, EV_WORK);
+}
+#endif
+
+//************************************************************************//
+//Displays a string in the result line of the LCD indicating no result is available.
+void show_empty_result(void)
+{
+	int i;
+	
+	for(i=0;i<15;i++)
+		lcd_line1[i] = ' ';
+	lcd_line1[15] = '.';
+	lcd_line1[14] = '0';
+	
+	lcd_updateline(1);
+}
+
+//************************************************************************//
+//Handles a button of the formula editor (all submodes but the menus).
+void formula_key(unsigned char button)
+{
+	switch(button)
+	{
+	case BUTTON_ON:
+		{
+			gap_clear(&formula);
+			history_index = HISTORY_NONE;
+			history_match_start(&history, &history_match);
+			formula_status.cursorpos = 0;
+			calc_status.submode = SM_FORMULA;
+			calc_status.insertmode = False;
+			show_empty_result();
+			eval_cancel();
+			eval.shown = False;
+			break;
+		}
+	case BUTTON_OFF:
+		{
+			calc_status.shift = OFF;
+			sched_post(TASK_POWER, EV_POWER_OFF);
+			return;
+		}
+	case FORMULA_LEFT:
+		{
+			if(calc_status.submode==SM_FORMULA)
 			{
-				calc_status.shift = !calc_status.shift;
-				break;
+				formula_status.cursorpos--;
+				if(formula_status.cursorpos<0)
+					formula_status.cursorpos=0;
 			}
-		case BUTTON_DRG:
+			else if(calc_status.submode==SM_NEWFORMULA)
 			{
-				select_anglebase();
-				break;
+				formula_status.cursorpos=gap_len(&formula);
+				calc_status.submode = SM_FORMULA;
 			}
-		case BUTTON_HYP:
+			else if(calc_status.submode==SM_ERROR)
 			{
-				if((calc_status.submode==SM_FORMULA) || (calc_status.submode==SM_NEWFORMULA))
-				{
-					calc_status.hyp = !calc_status.hyp;
-				}
-				break;
+				//Put the cursor on the error
+				formula_status.cursorpos=formula_status.errorpos;
+				calc_status.submode = SM_FORMULA;
+			}
+			break;
+		}
+	case FORMULA_RIGHT:
+		{
+			if(calc_status.submode==SM_FORMULA)
+			{
+				formula_status.cursorpos++;
+				if(formula_status.cursorpos>=gap_len(&formula))
+					formula_status.cursorpos=gap_len(&formula);
+			}
+			else if(calc_status.submode==SM_NEWFORMULA)
+			{
+				formula_status.cursorpos=0;
+				calc_status.submode = SM_FORMULA;
 			}
-		case BUTTON_EQUAL:
+			else if(calc_status.submode==SM_ERROR)
+			{
+				//Put the cursor on the error
+				formula_status.cursorpos=formula_status.errorpos;
+				calc_status.submode = SM_FORMULA;
+			}
+			break;
+		}
+	case FORMULA_HOME:
+		{
+			if((calc_status.submode==SM_FORMULA) || (calc_status.submode==SM_NEWFORMULA))
 			{
-				if((calc_status.submode==SM_FORMULA) || (calc_status.submode==SM_NEWFORMULA))
+				formula_status.cursorpos=0;
+				calc_status.submode = SM_FORMULA;
+			}
+			break;
+		}
+	case FORMULA_END:
+		{
+			if((calc_status.submode==SM_FORMULA) || (calc_status.submode==SM_NEWFORMULA))
+			{
+				formula_status.cursorpos=gap_len(&formula);
+				calc_status.submode = SM_FORMULA;
+			}
+			break;
+		}
+	case FORMULA_DEL:
+		{
+			if((calc_status.submode==SM_FORMULA) && (gap_len(&formula)>0))
+			{
+				if(calc_status.insertmode)
 				{
-					if(formula_status.len>0)
+					//Interpret DEL as backspace
+					if(formula_status.cursorpos==0)
+					{
+						//Delete char at cursor
+						gap_delete(&formula, 0);
+					}
+					else
 					{
-						flags->formuladone=True;
-						formula_status.cursorpos=0;
-						calc_status.insertmode = False;
-						return;
+						//Delete char at left
+						formula_status.cursorpos--;
+						gap_delete(&formula, formula_status.cursorpos);
 					}
 				}
-				break;
+				else
+				{
+					//Delete char at cursor (the last char when the cursor is at the end)
+					if(formula_status.cursorpos==gap_len(&formula))
+						formula_status.cursorpos--;
+					gap_delete(&formula, formula_status.cursorpos);
+				}
+				formula_changed();
+			}
+			break;
+		}
+	case FORMULA_INS:
+		{
+			if(calc_status.submode==SM_FORMULA)
+			{
+				calc_status.insertmode=!calc_status.insertmode;
+			}
+			break;
+		}
+	case BUTTON_SHIFT:
+		{
+			calc_status.shift = !calc_status.shift;
+			break;
+		}
+	case BUTTON_DRG:
+		{
+			select_anglebase();
+			return;
+		}
+	case BUTTON_FORMAT:
+		{
+			select_format();
+			return;
+		}
+#if _DIAG_ENABLED_
+	case BUTTON_DIAG:
+		{
+			show_diagnostics();
+			return;
+		}
+#endif
+	case BUTTON_PREVIEW:
+		{
+			eval.preview = !eval.preview;
+			if(eval.preview)
+			{
+				eval_restart();
+			}
+			else
+			{
+				eval_cancel();
+				if(eval.shown && (calc_status.submode==SM_FORMULA))
+					show_empty_result();
+				eval.shown = False;
+			}
+			break;
+		}
+	case BUTTON_HISTORY:
+		{
+			if((calc_status.submode==SM_FORMULA) || (calc_status.submode==SM_NEWFORMULA) ||
+					(calc_status.submode==SM_ERROR))
+			{
+				formula_recall();
+			}
+			break;
+		}
+	case BUTTON_WELCOME:
+		{
+			calc_status.welcome = !calc_status.welcome;
+			break;
+		}
+	case BUTTON_HYP:
+		{
+			if((calc_status.submode==SM_FORMULA) || (calc_status.submode==SM_NEWFORMULA))
+			{
+				calc_status.hyp = !calc_status.hyp;
+			}
+			break;
+		}
+	case BUTTON_EQUAL:
+		{
+			if((calc_status.submode==SM_FORMULA) || (calc_status.submode==SM_NEWFORMULA))
+			{
+				if(gap_len(&formula)>0)
+				{
+					formula_status.cursorpos=0;
+					calc_status.insertmode = False;
+					eval_final();
+					return;
+				}
 			}
-		case BUTTON_UNDEFINED:
 			break;
-		default:
+		}
+	case BUTTON_UNDEFINED:
+		break;
+	default:
+		{
+			//Append character to formula
+			if(calc_status.submode==SM_FORMULA)
 			{
-				//Append character to formula
-				if(calc_status.submode==SM_FORMULA)
+				if(formula_status.cursorpos<gap_len(&formula))
 				{
-					if(formula_status.cursorpos<formula_status.len)
+					if(calc_status.insertmode)
 					{
-						if(calc_status.insertmode && formula_status.len < FORMULA_MAX_LEN)
-						{
-							memmove(&formula[formula_status.cursorpos+1], &formula[formula_status.cursorpos],
-									formula_status.len-formula_status.cursorpos);
-							formula_status.len++;
-							formula[formula_status.cursorpos]=button;
+						if(gap_insert(&formula, formula_status.cursorpos, button))
 							formula_status.cursorpos++;
-						}
-						else if(!calc_status.insertmode && formula_status.cursorpos<formula_status.len)
-						{
-							formula[formula_status.cursorpos]=button;
-							formula_status.cursorpos++;
-						}
 					}
-					else if(formula_status.len < FORMULA_MAX_LEN)
+					else
 					{
-						formula[formula_status.len++]=button;
-					  formula_status.cursorpos++;
+						gap_replace(&formula, formula_status.cursorpos, button);
+						formula_status.cursorpos++;
 					}
 				}
-				else if((calc_status.submode==SM_NEWFORMULA) || (calc_status.submode == SM_ERROR))
-				{
-					formula_status.len=1;
-					formula_status.cursorpos=1;
-					formula[0]=button;
-					calc_status.submode = SM_FORMULA;
-				}
-				else if(calc_status.submode==SM_DRGSELECT)
+				else if(gap_insert(&formula, formula_status.cursorpos, button))
 				{
+				  formula_status.cursorpos++;
 				}
+				formula_changed();
 			}
-		}  //switch		
+			else if((calc_status.submode==SM_NEWFORMULA) || (calc_status.submode == SM_ERROR))
+			{
+				gap_clear(&formula);
+				gap_insert(&formula, 0, button);
+				formula_status.cursorpos=1;
+				calc_status.submode = SM_FORMULA;
+				formula_changed();
+			}
+			else if(calc_status.submode==SM_DRGSELECT)
+			{
+			}
+		}
+	}  //switch		
 
-		if(button != BUTTON_SHIFT)
-			calc_status.shift = False;
+	if(button != BUTTON_SHIFT)
+		calc_status.shift = False;
 
-		lcd_refresh();
-	}  //while
+	display_redraw();
 }
 
 //************************************************************************//
-//Parsable string representation of buttons that are not directly parsable with the parser.
-FLASH char OPERATOR_MUL_PSTR[] = "*";  //Multiply sign() to '*'
-FLASH char OPERATOR_DIV_PSTR[] = "/";  //Division sign() to '/'
-FLASH char CONSTANT_PI_PSTR[] = "3.141592653589";  //Pi to its constant value
-FLASH char FUNCTION_SQRT_PSTR[] = "sqrt(";  //Sqrt sign to 'sqrt'
-FLASH char VARIABLE_ANS_PSTR[] = "ans(0)";  //Ans to a function representation to be parsable by parser
-FLASH char FUNCTION_RAN_PSTR[] = "rand(0)"; //Ran# to a function representation to be parsable by parser
-FLASH char FUNCTION_ARCSIN_PSTR[] = "arcsin(";
-FLASH char FUNCTION_ARCCOS_PSTR[] = "arccos(";
-FLASH char FUNCTION_ARCTAN_PSTR[] = "arctan(";
-FLASH char FUNCTION_ARCSINH_PSTR[] = "arcsinh(";
-FLASH char FUNCTION_ARCCOSH_PSTR[] = "arccosh(";
-FLASH char FUNCTION_ARCTANH_PSTR[] = "arctanh(";
+//Coverts the input number to string and displays it on the LCD result line in the
+//  display mode chosen with SHIFT + 9 (numfmt.h, number.h).
+void show_result(NUMBER result)
+{
+	num_format(result, calc_status.fmtmode, calc_status.fmtdigits, lcd_line1);
+	lcd_update_row(1, lcd_line1);
+}
 
-typedef struct
+//************************************************************************//
+//Called after every edit of the formula.
+//Typing a key at the end narrows the history prefix search by that key; after other
+//  edits it is started again with the keys of the formula.
+void formula_changed(void)
 {
-	unsigned char code;
-	FLASH char *romaddress;
-} PARSABLE_STR;
-
-//Table containing all extra parsable strings
-PARSABLE_STR parsable_strs_table[] = {  //Mark end of table with 0xFF code
-	{OPERATOR_MUL, 0},
-	{OPERATOR_DIV, 0},
-	{CONSTANT_PI, 0},
-	{FUNCTION_SQRT, 0},
-	{VARIABLE_ANS, 0},
-	{FUNCTION_RAN, 0},
-	{FUNCTION_ARCSIN, 0},
-	{FUNCTION_ARCCOS, 0},
-	{FUNCTION_ARCTAN, 0},
-	{FUNCTION_ARCSINH, 0},
-	{FUNCTION_ARCCOSH, 0},
-	{FUNCTION_ARCTANH, 0},
-	{0xFF, 0}  //End of table
-};
+	int i, len;
+
+	len = gap_len(&formula);
+	if((len == history_match.depth + 1) && (formula_status.cursorpos == len))
+	{
+		history_match_key(&history, &history_match, gap_at(&formula, len - 1));
+	}
+	else
+	{
+		history_match_start(&history, &history_match);
+		for(i=0;i<len;i++)
+			history_match_key(&history, &history_match, gap_at(&formula, i));
+	}
+	history_index = HISTORY_NONE;
+	eval_restart();
+}
 
 //************************************************************************//
-//Initializes parsable_strs_table with string addresses in the flash memory.
-void fill_parsable_strs_table(void)
-{
-	parsable_strs_table[0].romaddress = (FLASH char *) &OPERATOR_MUL_PSTR;
-	parsable_strs_table[1].romaddress = (FLASH char *) &OPERATOR_DIV_PSTR;
-	parsable_strs_table[2].romaddress = (FLASH char *) &CONSTANT_PI_PSTR;
-	parsable_strs_table[3].romaddress = (FLASH char *) &FUNCTION_SQRT_PSTR;
-	parsable_strs_table[4].romaddress = (FLASH char *) &VARIABLE_ANS_PSTR;
-	parsable_strs_table[5].romaddress = (FLASH char *) &FUNCTION_RAN_PSTR;
-	parsable_strs_table[6].romaddress = (FLASH char *) &FUNCTION_ARCSIN_PSTR;
-	parsable_strs_table[7].romaddress = (FLASH char *) &FUNCTION_ARCCOS_PSTR;
-	parsable_strs_table[8].romaddress = (FLASH char *) &FUNCTION_ARCTAN_PSTR;
-	parsable_strs_table[9].romaddress = (FLASH char *) &FUNCTION_ARCSINH_PSTR;
-	parsable_strs_table[10].romaddress = (FLASH char *) &FUNCTION_ARCCOSH_PSTR;
-	parsable_strs_table[11].romaddress = (FLASH char *) &FUNCTION_ARCTANH_PSTR;
+//Replaces the formula with a history entry and shows its last result. '=' evaluates
+//  it with the compiled program kept in the entry until it is edited.
+//If no keys were typed, each call recalls the next older entry (the newest after
+//  the last one), else the next entry starting with the typed keys.
+void formula_recall(void)
+{
+	unsigned char matches;
+	NUMBER result;
+
+	if(history_match.depth == 0)
+	{
+		if(history.count == 0)
+			return;
+		if((history_index == HISTORY_NONE) || (++history_index >= history.count))
+			history_index = 0;
+	}
+	else
+	{
+		matches = history_match.hi - history_match.lo;
+		if(matches == 0)
+			return;
+		if((history_index == HISTORY_NONE) || (++history_cand >= matches))
+			history_cand = 0;
+		history_index = history_match_get(&history, &history_match, history_cand);
+	}
+	if(history_recall(&history, history_index, &formula, &result))
+		show_result(result);
+	else
+		show_empty_result();
+	formula_status.cursorpos = gap_len(&formula);
+	calc_status.submode = SM_FORMULA;
+	calc_status.insertmode = False;
+	eval_restart();
 }
 
 //************************************************************************//
-//Seraches for a button code and find and returns its parsable string representation.
-//Returns True if successful.
-BOOLEAN find_parse_str(unsigned char char_code, unsigned char *len,
-		FLASH char **char_address)
+//Evaluator task
+//Compiles and evaluates the formula for '=' (eval_final) and, while the live result
+//  preview is enabled (SHIFT + '('), after every change of the formula.
+//The work gives way to every task with a higher priority (sched_preempt): compiling
+//  is cancelled and the evaluation is suspended before the next opcode, and the task
+//  goes on when the scheduler gets back to it (EV_WORK), so typing is never delayed.
+//  A suspended preview is started again if a key changed the formula or the angle
+//  base (eval_restart). Keys wait while the result of '=' is computed.
+
+//Stops the preview work. Ran# in a preview must not change the numbers of the next
+//  evaluation, so the generator state is restored.
+void eval_cancel(void)
+{
+	if((eval.state == EVAL_EVALUATE) && !eval.final)
+		parser_context.seed = eval.seed;
+	eval.state = EVAL_IDLE;
+}
+
+//Starts the preview again for a changed formula.
+void eval_restart(void)
 {
-	//First search parsable_strs_table,
-	//if not in table, call find_formula_char to search in formula_char_table_?len table.
+	eval_cancel();
+	if(eval.preview)
+	{
+		eval.state = EVAL_COMPILE;
+		sched_post(TASK_EVALUATOR, EV_WORK);
+	}
+}
 
-	int i;	
+//Starts the evaluation for '=' (the preview work uses the same parser context).
+void eval_final(void)
+{
+	eval_cancel();
+	eval.shown = False;
+	eval.final = True;
+	eval.state = EVAL_COMPILE;
+	sched_post(TASK_EVALUATOR, EV_WORK);
+}
 
-	//Search parsable_strs_table
-	i=0;
-	while((parsable_strs_table[i].code!=char_code) && (parsable_strs_table[i].code!=0xFF))
-		i++;
-	if(parsable_strs_table[i].code==char_code)
+//Shows the preview result, or clears the result line if the formula is incomplete.
+void preview_show(BOOLEAN valid, NUMBER value)
+{
+	if(valid)
+		show_result(value);
+	else if(gap_len(&formula) == 0)
+		show_empty_result();
+	else
 	{
-		*char_address = parsable_strs_table[i].romaddress;
-		*len = strlen_P(*char_address);
-		return(True);
+		memset(lcd_line1, ' ', sizeof(lcd_line1));
+		lcd_update_row(1, lcd_line1);
 	}
-	
-	//Not in table, search formula_char_table_?len
-	return(find_formula_char(char_code, len, char_address));
+	lcd_applystatus();
+	eval.shown = True;
 }
 
-//************************************************************************//
-//Variable to store the formula passed to parser.
-char parser_formula[350];
+//Shows the result of '=' or the error message.
+void final_show(BOOLEAN valid, NUMBER value)
+{
+	eval.final = False;
+	if(valid)
+	{
+		calc_status.submode = SM_NEWFORMULA;
+		formula_status.cursorpos=0;
+		formula_status.displeftpos=0;
+		lcd_refresh();
+		show_result(value);
+		parser_context.status.ans = value;
+		settings_store();
+		history_add(&history, &formula, &parser_context, value);
+		history_index = 0;
+		history_match_start(&history, &history_match);
+	}
+	else if(parser_context.errpos < 0)
+		show_calc_error(gap_len(&formula));
+	else
+		show_calc_error(parser_context.errpos);
+	//Keys pressed meanwhile
+	if(kbd_press_pending())
+		sched_post(TASK_EDITOR, EV_KEY);
+}
 
-//Generates a formula from the input formula which is parsable by the parser.
-void create_parsable_formula(void)
+void evaluator_task(UCHAR events)
 {
-	int i;
-	int parse_len=0;
-	unsigned char char_len;
-	FLASH char *char_address;
-	
-/*	//realloc does NOT work properly.
-	parser_formula = realloc(NULL, 1);
-	
-	for(i=0;i<formula_status.len;i++)
+	NUMBER value;
+	UCHAR status;
+
+	if(eval.state == EVAL_IDLE)
+		return;
+	//The preview goes on when the angle base or diagnostics screen is left
+	if(!eval.final && (calc_status.submode != SM_FORMULA))
+		return;
+
+	parser_context.preempt = sched_preempt;
+	status = PARSER_PREEMPTED;
+	//Passed to final_show/preview_show with a compile error too
+	value = num_from_int(0);
+	if(eval.state == EVAL_COMPILE)
 	{
-		if(find_parse_str(formula[i], &char_len, &char_address))
+		DIAG_BEGIN(DIAG_SITE_PARSER_INIT);
+		//A recalled formula is not compiled again
+		if(history_program(&history, history_index, &parser_context) ||
+				parser_compile(&parser_context, &formula))
 		{
-			parser_formula = realloc(parser_formula, parse_len+char_len);
-			memcpy_P(parser_formula+parse_len, char_address, char_len); 
-			parse_len+=char_len;
+			eval.seed = parser_context.seed;
+			parser_eval_start(&parser_context);
+			eval.state = EVAL_EVALUATE;
 		}
+		else if(!parser_context.preempted)
+			status = PARSER_ERROR;
+		DIAG_END(DIAG_SITE_PARSER_INIT);
 	}
-	parser_formula = realloc(parser_formula, parse_len + 1);
-	parser_formula[parse_len] = 0;
-	*/
+	if(eval.state == EVAL_EVALUATE)
+		status = parser_eval_resume(&parser_context, &value);
+	parser_context.preempt = NULL;
 
-	parser_formula[0] =0;
-	
-	for(i=0;i<formula_status.len;i++)
+	if(status == PARSER_PREEMPTED)
+	{
+		sched_post(TASK_EVALUATOR, EV_WORK);
+		return;
+	}
+	eval_cancel();
+	if(eval.final)
+		final_show(status == PARSER_DONE, value);
+	else
+		preview_show(status == PARSER_DONE, value);
+}
+
+//************************************************************************//
+//Draws the current screen again after the LCD queue was full (lcdmore.h). The
+//  formula screens are left to the refresh: returns EV_REDRAW for them.
+UCHAR display_repaint(void)
+{
+	if(!calc_status.poweron)
 	{
-		if(find_parse_str(formula[i], &char_len, &char_address))
+		lcd_applystatus();
+		return(0);
+	}
+	switch(calc_status.submode)
+	{
+	case SM_DRGSELECT:
+		{
+			menu_hide_cursor();
+			anglebase_show();
+			break;
+		}
+	case SM_FMTSELECT:
+		{
+			menu_hide_cursor();
+			format_show();
+			break;
+		}
+#if _DIAG_ENABLED_
+	case SM_DIAG:
 		{
-			memcpy_P(&parser_formula[parse_len], char_address, char_len); 
-			parse_len+=char_len;
+			menu_hide_cursor();
+			show_diagnostics_page();
+			return(0);
 		}
+#endif
+	default:
+		return(EV_REDRAW);
 	}
-	parser_formula[parse_len] = 0;
-	
+	if(calc_status.shift)
+		menu_shift_show();
+	return(0);
+}
+
+//Display task: refreshes the screen after changes (EV_REDRAW, several requests are
+//  done in one refresh), draws it again when LCD output was lost (EV_LCD_READY) and
+//  blinks the cursor (EV_BLINK).
+//The angle base, format and diagnostics screens are written directly.
+void display_task(UCHAR events)
+{
+	unsigned long bus_writes;
+
+	if((events & EV_LCD_READY) && lcd_resync())
+		events |= display_repaint();
+	if((events & EV_REDRAW) &&
+			(calc_status.submode != SM_DRGSELECT) && (calc_status.submode != SM_DIAG) &&
+			(calc_status.submode != SM_FMTSELECT))
+	{
+		bus_writes = lcd_bus_writes;
+		lcd_refresh();
+		DIAG_LCD_WRITES(lcd_bus_writes - bus_writes);
+	}
+	if(events & EV_BLINK)
+		lcd_blink_task();
+}
+
+//Asks the display task for a refresh.
+void display_redraw(void)
+{
+	sched_post(TASK_DISPLAY, EV_REDRAW);
 }
 
 //************************************************************************//
-//Coverts the input floating point number to string and displays it on the LCD result line.
-void show_result(double result)
+//Editor task: handles one key press per run (EV_KEY) and posts itself again while
+//  more keys are waiting, so a burst of keys is handled before the screen is
+//  refreshed.
+void editor_task(UCHAR events)
 {
-	char temp[20];
-	int i, old_len;
-	
-  dtostre(result, temp, 8, DTOSTR_UPPERCASE);  //Use 8 digit precision for conversion, but only show 6 digits
-	// temp = "[-]d.dddddd00Edd"
-	memmove(&temp[strlen(temp) - 6], &temp[strlen(temp) - 4], 5);  //Truncate trailing zeros
-
-	old_len = strlen(temp);
-	memmove(&temp[16 - old_len], temp, old_len + 1);
-	for(i=0;i<(16 - old_len);i++)
-		temp[i] = ' ';
-	for(i=0;i<=15;i++)
-		lcd_line1[i] = temp[i];
-	
-	lcd_gotoxy(0, 1);
-	lcd_puts(temp);
+	unsigned char button;
+
+	//Keys wait for the result of '=' (final_show posts EV_KEY)
+	if(eval.final)
+		return;
+	if(!button_get(&button))
+		return;
+	if(kbd_press_pending())
+		sched_post(TASK_EDITOR, EV_KEY);
+
+	if(!calc_status.poweron)
+	{
+		//Any key skips the welcome animation
+		if(power_mode == POWER_WELCOME)
+		{
+			sched_post(TASK_POWER, EV_POWER_ON);
+		}
+		else if(button == BUTTON_ON)
+		{
+			DIAG_WAKE_BEGIN();
+			sched_post(TASK_POWER, EV_POWER_ON);
+		}
+		return;
+	}
+	switch(calc_status.submode)
+	{
+	case SM_DRGSELECT:
+		anglebase_key(button);
+		break;
+	case SM_FMTSELECT:
+		format_key(button);
+		break;
+#if _DIAG_ENABLED_
+	case SM_DIAG:
+		diagnostics_key(button);
+		break;
+#endif
+	default:
+		formula_key(correct_button(button));
+	}
+	settings_store();
 }
 
 //************************************************************************//
@@ -1266,23 +1855,15 @@ static void io_init(void)
 }
 
 //************************************************************************//
-//Sets lcd custom characters which will not be changed.
+//Sets lcd custom characters which will not be changed (all other custom
+//  characters are uploaded on demand by the CGRAM manager).
 void set_lcd_fixed_custom_chars(void)
 {
-	LCC lcc;
-	
-	//Set Right Arrow character
-	memcpy_P(&lcc, &LCDCHAR_RIGHTARROW, 8);
-	lcd_set_custom_char(1, &lcc);
-	//Set Hyp character
-	memcpy_P(&lcc, &LCDCHAR_HYP, 8);
-	lcd_set_custom_char(3, &lcc);
+	lcd_glyph_reset();
 	//Set inser mode character
-	memcpy_P(&lcc, &LCDCHAR_INSERT, 8);
-	lcd_set_custom_char(4, &lcc);
+	lcd_glyph_pin(SLOT_INSERT, GLYPH_INSERT, LCDCHAR_INSERT);
 	//Set inverse character
-	memcpy_P(&lcc, &LCDCHAR_INVERSE, 8);
-	lcd_set_custom_char(5, &lcc);
+	lcd_glyph_pin(SLOT_INVERSE, GLYPH_INVERSE, LCDCHAR_INVERSE);
 }
 
 //************************************************************************//
@@ -1291,8 +1872,8 @@ void initialize_calculator(void)
 {
 	kbd_init(&KBD1_PORT);
 	kbd_init(&KBD2_PORT);
+	kbd_set_modifier(KEY_SHIFT);
 	set_lcd_fixed_custom_chars();
-	fill_parsable_strs_table();
 }
 
 //************************************************************************//
@@ -1303,12 +1884,18 @@ void reset_calculator(BOOLEAN full_reset)
 	{
 		//Discard all calculator settings if a full reset (power on reset) is requested.
 		initialize_calculator();
+		parser_context_init(&parser_context);
+		history_clear(&history);
+		history_match_start(&history, &history_match);
 		calc_status.anglebase=RADIANS;
-		parser_status.anglebase = RADIANS;
-		parser_status.ans = 0.0;
+		parser_context.status.anglebase = RADIANS;
+		parser_context.status.ans = num_from_int(0);
+		calc_status.welcome = True;
+		calc_status.fmtmode = FMT_AUTO;
+		calc_status.fmtdigits = 0;
 	}
 
-	lcd_clear();
+	lcd_cls();
 	lcd_status.cursorblinking=True;
 	lcd_status.showcursor=True;
 	lcd_status.showtext=True;
@@ -1316,7 +1903,7 @@ void reset_calculator(BOOLEAN full_reset)
 	lcd_status.row=0;
 	lcd_applystatus();
 	
-	formula_status.len=0;
+	gap_clear(&formula);
 	formula_status.cursorpos=0;
 	formula_status.displeftpos=0;
 	formula_status.disprightpos=0;
@@ -1336,12 +1923,18 @@ void reset_calculator(BOOLEAN full_reset)
 }
 
 //************************************************************************//
-//Displays welcome message.
-void welcome(void)
+//Sets the power task timer (EV_WORK after ticks timer ticks, 0 stops it).
+void power_timer_set(unsigned int ticks)
 {
-	unsigned char i;
+	cli();
+	power_timer = ticks;
+	sei();
+}
 
-	lcd_clear();
+//************************************************************************//
+//Displays welcome message. The power task scrolls it out (welcome_next).
+void welcome(void)
+{
   lcd_status.cursorblinking = False;
   lcd_status.charblinking = False;
 	lcd_status.showcursor = False;
@@ -1349,33 +1942,151 @@ void welcome(void)
 	lcd_status.col = 0;
 	lcd_status.row = 0;
 	lcd_applystatus();
-	lcd_puts_P(welcome_msg);
-	delay(2200, CLOCK_FREQ);
-	for(i=1;i<=15;i++)
-	{
-		lcd_command(LCD_SHIFT_DISP_LEFT);
-		delay(220, CLOCK_FREQ);
-	}
+	lcd_cls();
+	lcd_print_P(welcome_msg);
+	calc_status.poweron = False;
+	welcome_step = 0;
+	power_mode = POWER_WELCOME;
+	power_timer_set(WELCOME_SHOW_TICKS);
+}
+
+//Scrolls the welcome message one step. Returns False when the animation is over.
+BOOLEAN welcome_next(void)
+{
+	if(welcome_step >= WELCOME_STEPS)
+		return(False);
+	lcd_cmd(LCD_SHIFT_DISP_LEFT);
+	welcome_step++;
+	power_timer_set(WELCOME_STEP_TICKS);
+	return(True);
 }
 
 //************************************************************************//
-//Function invoked when the ON button wakes up the calculator.
-void poweron(void)
+//Continues with the formula, result and settings the calculator had when it was
+//  switched off: they stay in SRAM while it is off, and state_restore reads them
+//  from EEPROM after a reset. The menus are left.
+void resume_calculator(void)
 {
-	welcome();
+	power_mode = POWER_ON;
+	power_timer_set(0);
+	if((calc_status.submode == SM_DRGSELECT) || (calc_status.submode == SM_DIAG) ||
+			(calc_status.submode == SM_FMTSELECT))
+		calc_status.submode = menu_old_mode;
+	calc_status.shift = OFF;
+	calc_status.poweron = True;
+	//The formula may change again: an unfinished snapshot is left invalid
+	persist_cancel();
+	cli();
+	calc_status.autopoweroff_counter = 0;
+	sei();
 	
-	reset_calculator(False);
+	lcd_cls();
+	lcd_status.showtext = True;
+	lcd_refresh();
 	
 	DDRC = 0x00;
 	PORTC = 0xFF;
+	
+	eval_restart();
+	DIAG_WAKE_END();
+}
+
+//************************************************************************//
+//Function invoked when the ON button wakes up the calculator (and after a reset).
+//The editor takes keys right away unless the welcome animation is enabled
+//  (SHIFT + 7); then it takes them when the animation is over or skipped.
+void poweron(void)
+{
+	if(calc_status.welcome)
+		welcome();
+	else
+		resume_calculator();
 }
 
 //************************************************************************//
-//Function invoked when the OFF button is pressed.
+//Hands Ans, the Ran# state, the angle base, the settings and the display mode to the
+//  EEPROM store.
+//Only the values that changed are written back (eestore.h).
+void settings_store(void)
+{
+	unsigned char settings;
+
+	eestore_set(STORE_ANS, &parser_context.status.ans, sizeof(NUMBER));
+	eestore_set(STORE_SEED, &parser_context.seed, sizeof(unsigned long));
+	settings = calc_status.anglebase;
+	eestore_set(STORE_ANGLEBASE, &settings, 1);
+	settings = 0;
+	if(eval.preview)
+		settings |= STORE_PREVIEW;
+	if(calc_status.welcome)
+		settings |= STORE_WELCOME;
+	eestore_set(STORE_SETTINGS, &settings, 1);
+	settings = calc_status.fmtmode | (calc_status.fmtdigits << 4);
+	eestore_set(STORE_FORMAT, &settings, 1);
+}
+
+//************************************************************************//
+//Starts saving the formula and result line to EEPROM (persist.h); the store task
+//  writes them while the calculator is off.
+//A syntax error is saved as the formula with the cursor at the error.
+void state_save(void)
+{
+	PERSIST_STATE state;
+	unsigned char mode;
+
+	memset(&state, 0, sizeof(state));
+	mode = calc_status.submode;
+	if((mode == SM_DRGSELECT) || (mode == SM_DIAG) || (mode == SM_FMTSELECT))
+		mode = menu_old_mode;
+	state.submode = (mode == SM_NEWFORMULA) ? SM_NEWFORMULA : SM_FORMULA;
+	state.cursorpos = (mode == SM_ERROR) ? formula_status.errorpos : formula_status.cursorpos;
+	state.displeftpos = formula_status.displeftpos;
+	state.insertmode = calc_status.insertmode;
+	memcpy(state.result, lcd_line1, sizeof(state.result));
+	persist_save(&state, &formula);
+}
+
+//Restores the settings from the EEPROM store and the state saved by state_save after
+//  a reset (the defaults of reset_calculator stay for what is not stored).
+void state_restore(void)
+{
+	PERSIST_STATE state;
+	unsigned char settings;
+
+	eestore_init();
+	eestore_get(STORE_ANS, &parser_context.status.ans, sizeof(NUMBER));
+	eestore_get(STORE_SEED, &parser_context.seed, sizeof(unsigned long));
+	if(eestore_get(STORE_ANGLEBASE, &settings, 1))
+	{
+		calc_status.anglebase = settings;
+		parser_context.status.anglebase = settings;
+	}
+	if(eestore_get(STORE_SETTINGS, &settings, 1))
+	{
+		eval.preview = (settings & STORE_PREVIEW) != 0;
+		calc_status.welcome = (settings & STORE_WELCOME) != 0;
+	}
+	if(eestore_get(STORE_FORMAT, &settings, 1))
+	{
+		calc_status.fmtmode = settings & 0x03;
+		calc_status.fmtdigits = settings >> 4;
+	}
+
+	if(!persist_load(&state, &formula))
+		return;
+	calc_status.submode = state.submode;
+	formula_status.cursorpos = state.cursorpos;
+	if(formula_status.cursorpos > gap_len(&formula))
+		formula_status.cursorpos = gap_len(&formula);
+	formula_status.displeftpos = state.displeftpos;
+	calc_status.insertmode = state.insertmode;
+	memcpy(lcd_line1, state.result, sizeof(state.result));
+}
+
+//************************************************************************//
+//Switches the display off (power task).
 void poweroff(void)
 {
-	unsigned char button;
-	
 	lcd_status.showtext=False;
 	lcd_status.showcursor=False;
 	lcd_status.charblinking=False;
@@ -1384,18 +2095,50 @@ void poweroff(void)
 	
 	calc_status.poweron=False;
 	PORTC = 0x00;
-	
-	while((button = button_read()) != BUTTON_ON)
+}
+
+//************************************************************************//
+//Power task
+//OFF and the auto power off (EV_POWER_OFF) switch the display off and hand the state
+//  and the settings to the store task, which writes them to EEPROM. The slow tick is
+//  started only when the LCD queue has sent the display off command (EV_LCD_READY),
+//  then the keyboard is scanned slowly until ON is pressed (EV_POWER_ON). The welcome
+//  animation is stepped by the power task timer (EV_WORK) and skipped by any key
+//  (EV_POWER_ON).
+void power_task(UCHAR events)
+{
+	if((events & EV_POWER_OFF) && (power_mode == POWER_ON))
 	{
+		poweroff();
+		state_save();
+		settings_store();
+		eestore_flush();
+		power_mode = POWER_DRAINING;
+	}
+	if((power_mode == POWER_DRAINING) && lcd_queue_empty())
+	{
+		timers_slow_tick(True);
+		power_mode = POWER_OFF;
+	}
+	if(power_mode == POWER_WELCOME)
+	{
+		if((events & EV_POWER_ON) || ((events & EV_WORK) && !welcome_next()))
+			resume_calculator();
+	}
+	else if((events & EV_POWER_ON) && (power_mode != POWER_ON))
+	{
+		timers_slow_tick(False);
+		poweron();
 	}
-	
-	poweron();
 }
 
 //************************************************************************//
 //Function to display calculation error messages
-void show_calc_error(void)
+//errorpos is the index of the key in the formula where the cursor goes when the user presses
+//  LEFT or RIGHT to edit the formula.
+void show_calc_error(int errorpos)
 {
+	formula_status.errorpos = errorpos;
 	calc_status.submode = SM_ERROR;
 	strcpy(&lcd_line0[1], "Syntax ERROR");
 	lcd_line0[13] =' ';
@@ -1407,59 +2150,28 @@ void show_calc_error(void)
 //************************************************************************//
 int main(void)
 {
-	FORMULA_FLAGS formula_flags;
-	BOOLEAN parser_success;
-	double result_value;
-
 	//{{WIZARD_MAP(Initialization)
 	io_init();
 	lcd_init(16, 2, &LCD_PORT);	// LCD Using PORTC
+	lcd_queue_init();	// All further LCD output is queued (lcdmore.c)
 	timers_init();
 	//}}WIZARD_MAP(Initialization)
-	// TODO: Add extra initialization here
-	
+	sched_task(TASK_EDITOR, EV_KEY, editor_task);
+	sched_task(TASK_DISPLAY, EV_BLINK | EV_LCD_READY, display_task);
+	sched_task(TASK_POWER, EV_POWER_OFF | EV_LCD_READY, power_task);
+	sched_task(TASK_EVALUATOR, 0, evaluator_task);
+	sched_task(TASK_STORE, EV_STORE, eestore_task);
 	
 	//{{WIZARD_MAP(Global interrupt)
 	sei();
 	//}}WIZARD_MAP(Global interrupt)
 
-	//Full reset calculator
+	//Full reset calculator, then continue where the calculator was switched off
 	reset_calculator(True);
+	state_restore();
 	
 	poweron();
 	
-	while(1)
-	{
-		//Input formula
-		get_formula(&formula_flags);
-		
-		//Check for power off
-		if(formula_flags.poweroff)
-		{
-			poweroff();
-		}
-		else if(formula_flags.formuladone)
-		{
-			//Generate parsable formula and...
-			create_parsable_formula();
-			// pass it to the parser.
-			parser_success = parser_init(parser_formula, &result_value);
-			
-			//If parsing the expression was successful, display the result, else show error message.
-			if(parser_success)
-			{
-				calc_status.submode = SM_NEWFORMULA;
-				formula_status.cursorpos=0;
-				formula_status.displeftpos=0;
-				lcd_refresh();
-				show_result(result_value);
-				parser_status.ans = result_value;
-			}
-			else
-			{
-				//Show error message
-				show_calc_error();
-			}
-		}
-	}
+	//Everything else is done by the tasks
+	sched_run(cpu_idle);
 }
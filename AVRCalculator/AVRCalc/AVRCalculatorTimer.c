@@ -3,41 +3,89 @@
 
 #include "AVRCalculator.h"
 #include "AVRCalculatorTimer.h"
+#include "clock.h"
 
 /////////////////////////////////////////////////////////////////////////////
 //AVRCalculatorTimer
 
+volatile unsigned char tick_ms = TICK_MS;
+
+//True while the slow tick is used (calculator off)
+static unsigned char timers_slow = 0;
+
 void timers_init(void)
 {
 	//{{WIZARD_MAP(Timers)
 	// Timer/Counter0 Clock source: System Clock
-	// Timer/Counter0 Clock value: Stopped
+	// Timer/Counter0 Clock value: 1000.000kHz
 	// Timer/Counter0 Mode: CTC, TOP=OCR0
 	// Timer/Counter0 Output: Disconnected
-	OCR0 = 0x00;
+	// COMP0 interrupt drains the LCD output queue (enabled by lcdmore.c when needed)
 	TCNT0 = 0x00;
-	TCCR0 = 0x08;
+	TCCR0 = 0b00001010;
 
 	// Timer/Counter1 Clock source: System Clock
 	// Timer/Counter1 Clock value: 125.000kHz
 	// Timer/Counter1 Mode: CTC, TOP=OCR1A
 	// Timer/Counter1 Output: A: Disconnected, B: Disconnected
-	OCR1A = 1200;//1562;  //~200 ms COMP1A interrupt
 	OCR1B = 0;
 	TCNT1 = 0;
 	TCCR1A = 0b00000000;
-	TCCR1B = 0b00001101;
 
 	// Timer/Counter2 Clock source: System Clock
-	// Timer/Counter2 Clock value: Stopped
+	// Timer/Counter2 Clock value: 1000.000kHz
 	// Timer/Counter2 Mode: Normal
 	// Timer/Counter2 Output: Disconnected
+	// Free running: measures ISR run times (diag.h)
 	ASSR = 0x00;
 	OCR2 = 0x00;
 	TCNT2 = 0x00;
-	TCCR2 = 0x00;
 
 	TIMSK = 0b00010000;
 	//}}WIZARD_MAP(Timers)
+
+	//Compare values and prescalers depend on the clock frequency
+	timers_update();
 }
 
+//Sets the compare values and prescalers for the clock frequency (CLOCK_KHZ)
+//  and tick. Must be called with interrupts disabled or before sei().
+//  Timer0: clk/8, 100 us COMP0 interrupt
+//  Timer1: clk/64, TICK_MS COMP1A interrupt, or clk/1024, TICK_OFF_MS while off
+//  Timer2: clk/8 (1 MHz), stopped while off
+void timers_update(void)
+{
+	unsigned long khz = CLOCK_KHZ;
+
+	OCR0 = khz / 80 - 1;
+	if(timers_slow)
+	{
+		OCR1A = khz * TICK_OFF_MS / 1024 - 1;
+		TCCR1B = 0b00001101;
+		TCCR2 = 0x00;
+		tick_ms = TICK_OFF_MS;
+	}
+	else
+	{
+		OCR1A = khz * TICK_MS / 64 - 1;
+		TCCR1B = 0b00001011;
+		TCCR2 = 0b00000010;
+		tick_ms = TICK_MS;
+	}
+	if(TCNT1 > OCR1A)
+		TCNT1 = 0;
+}
+
+//Switches Timer1 between the normal tick and the slow tick used while the calculator
+//  is off. The slow tick also stops Timer2 (ISR timing), so idle sleep is only woken
+//  to scan the keyboard.
+void timers_slow_tick(unsigned char slow)
+{
+	unsigned char sreg = SREG;
+
+	cli();
+	timers_slow = slow;
+	timers_update();
+	TCNT1 = 0;
+	SREG = sreg;
+}
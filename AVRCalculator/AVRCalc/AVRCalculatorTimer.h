@@ -7,6 +7,17 @@
 /////////////////////////////////////////////////////////////////////////////
 //AVRCalculatorTimer
 
+//Period of the Timer1 compare match interrupt (system tick): keyboard scan,
+//  cursor blinking and auto power off
+#define TICK_MS				5
+//Slow tick used while the calculator is off (only the keyboard is scanned)
+#define TICK_OFF_MS		32
+
+//Length of the current tick in ms
+extern volatile unsigned char tick_ms;
+
 void timers_init(void);
+void timers_update(void);
+void timers_slow_tick(unsigned char slow);
 
 #endif
@@ -0,0 +1,20 @@
+//clock.h : header file for the AVRCalculator CPU clock
+//
+
+#ifndef _CLOCK_H_
+#define _CLOCK_H_
+
+/////////////////////////////////////////////////////////////////////////////
+//CPU clock
+//
+//Notes:
+//  1) CLOCK_KHZ is the oscillator frequency set by the fuses. The ATmega32 has no
+//    system clock prescaler (CLKPR) and its clock source can only be changed by the
+//    fuses, so the clock cannot be lowered while editing or waiting; the power is
+//    saved by idle sleep instead (cpu_idle, AVRCalculator.c).
+//  2) Everything that depends on the clock uses CLOCK_KHZ: the timer compare values
+//    and prescalers (timers_update).
+
+#define CLOCK_KHZ		8000
+
+#endif
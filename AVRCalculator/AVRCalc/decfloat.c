@@ -0,0 +1,495 @@
+//************************************************************************//
+//   -- DECIMAL FLOATING POINT MODULE --
+//12 digit decimal numbers of the evaluator when it is built with _DECIMAL_NUMBERS_
+//  (see decfloat.h and number.h)
+//
+//Every operation computes an unsigned mantissa with more digits than DEC_DIGITS and
+//  a code for the digits dropped below it (DEC_REST_*), and dec_make rounds that to a
+//  normalized DEC. The products are 32 x 32 bit on halves of DEC_DIGITS / 2 digits
+//  and the quotient is a long division, so no 64 bit multiply or divide routine runs
+//  more than a few times per operation.
+//************************************************************************//
+
+//************************************************************************//
+//Include header files
+#include <math.h>
+#include "decfloat.h"
+//************************************************************************//
+
+//************************************************************************//
+//Definitions
+#define DEC_MIN						100000000000LL		//10^(DEC_DIGITS - 1)
+#define DEC_LIMIT					1000000000000LL		//10^DEC_DIGITS
+#define DEC_HALF_DIGITS		1000000UL					//10^(DEC_DIGITS / 2)
+#define DEC_FLOAT_EXP			38								//Float range: 1E-37 <= |x| < 1E+38
+
+//Digits dropped below the mantissa
+#define DEC_REST_ZERO			0
+#define DEC_REST_BELOW		1			//Less than half a unit
+#define DEC_REST_HALF			2
+#define DEC_REST_ABOVE		3			//More than half a unit
+//************************************************************************//
+
+//********************************************************************
+//Returns NaN.
+static DEC dec_nan(void)
+{
+	DEC r;
+
+	r.mantissa = 0;
+	r.exponent = DEC_SPECIAL;
+	return(r);
+}
+//********************************************************************
+
+//********************************************************************
+//Returns (-)infinity.
+static DEC dec_inf(BOOLEAN negative)
+{
+	DEC r;
+
+	r.mantissa = negative ? -1 : 1;
+	r.exponent = DEC_SPECIAL;
+	return(r);
+}
+//********************************************************************
+
+//********************************************************************
+//Returns the rest code of the remainder r of a division by d.
+static UCHAR dec_rest(uint32_t r, uint32_t d)
+{
+	if(r == 0)
+		return(DEC_REST_ZERO);
+	r *= 2;
+	if(r < d)
+		return(DEC_REST_BELOW);
+	return((r == d) ? DEC_REST_HALF : DEC_REST_ABOVE);
+}
+//********************************************************************
+
+//********************************************************************
+//Returns m * 10^exp rounded half to even to DEC_DIGITS digits. rest is the code of
+//  the digits dropped below m (m has DEC_DIGITS digits or more if rest is not 0).
+static DEC dec_make(BOOLEAN negative, uint64_t m, int exp, UCHAR rest)
+{
+	DEC r;
+	UCHAR digit;
+
+	r.mantissa = 0;
+	r.exponent = 0;
+	if(m == 0)
+		return(r);
+	while(m >= DEC_LIMIT)
+	{
+		digit = m % 10;
+		m /= 10;
+		exp++;
+		if(digit > 5 || (digit == 5 && rest != DEC_REST_ZERO))
+			rest = DEC_REST_ABOVE;
+		else if(digit == 5)
+			rest = DEC_REST_HALF;
+		else if(digit != 0 || rest != DEC_REST_ZERO)
+			rest = DEC_REST_BELOW;
+	}
+	while(m < DEC_MIN)
+	{
+		m *= 10;
+		exp--;
+	}
+	if(rest == DEC_REST_ABOVE || (rest == DEC_REST_HALF && (m & 1)))
+	{
+		if(++m == DEC_LIMIT)
+		{
+			m = DEC_MIN;
+			exp++;
+		}
+	}
+	//Exponent of the first digit
+	if(exp + DEC_DIGITS - 1 > DEC_EXP_LIMIT)
+		return(dec_inf(negative));
+	if(exp + DEC_DIGITS - 1 < -DEC_EXP_LIMIT)
+		return(r);
+	r.mantissa = negative ? -(int64_t) m : (int64_t) m;
+	r.exponent = exp;
+	return(r);
+}
+//********************************************************************
+
+//********************************************************************
+DEC dec_add(DEC a, DEC b)
+{
+	DEC t;
+	uint64_t ma, mb;
+	uint32_t p;
+	UCHAR d, rest;
+
+	if(a.exponent == DEC_SPECIAL || b.exponent == DEC_SPECIAL)
+	{
+		if(a.exponent != DEC_SPECIAL)
+			return(b);
+		if(b.exponent == DEC_SPECIAL && a.mantissa != b.mantissa)
+			return(dec_nan());		//Inf - Inf
+		return(a);
+	}
+	if(b.mantissa == 0)
+		return(a);
+	if(a.mantissa == 0)
+		return(b);
+	if(a.exponent < b.exponent)
+	{
+		t = a;
+		a = b;
+		b = t;
+	}
+	d = a.exponent - b.exponent;
+	if(d > DEC_DIGITS + 1)
+		return(a);		//b is less than 1/100 of the last digit of a
+
+	//Scale a up by 10^d, or by 10^6 and b down by the rest of d
+	ma = (a.mantissa < 0) ? -a.mantissa : a.mantissa;
+	mb = (b.mantissa < 0) ? -b.mantissa : b.mantissa;
+	for(p = 1; d > 0 && p < DEC_HALF_DIGITS; d--)
+	{
+		ma *= 10;
+		p *= 10;
+	}
+	if(d == 0)
+	{
+		//Exact: a sign change is possible
+		if((a.mantissa < 0) == (b.mantissa < 0))
+			return(dec_make(a.mantissa < 0, ma + mb, b.exponent, DEC_REST_ZERO));
+		if(ma >= mb)
+			return(dec_make(a.mantissa < 0, ma - mb, b.exponent, DEC_REST_ZERO));
+		return(dec_make(b.mantissa < 0, mb - ma, b.exponent, DEC_REST_ZERO));
+	}
+	//|a| > |b|, the digits of b below 10^d of its units are rounded in
+	for(p = 1; d > 0; d--)
+		p *= 10;
+	rest = dec_rest(mb % p, p);
+	mb /= p;
+	if((a.mantissa < 0) == (b.mantissa < 0))
+		return(dec_make(a.mantissa < 0, ma + mb, a.exponent - 6, rest));
+	//a - (mb + rest) = (a - mb - 1) + (1 - rest)
+	ma -= mb;
+	if(rest != DEC_REST_ZERO)
+	{
+		ma--;
+		rest = DEC_REST_ABOVE + DEC_REST_BELOW - rest;
+	}
+	return(dec_make(a.mantissa < 0, ma, a.exponent - 6, rest));
+}
+//********************************************************************
+
+//********************************************************************
+DEC dec_sub(DEC a, DEC b)
+{
+	return(dec_add(a, dec_neg(b)));
+}
+//********************************************************************
+
+//********************************************************************
+//Exact product of two mantissas (< 10^DEC_DIGITS) in base 10^6 digits:
+//  ma * mb = *hi * 10^12 + *mid * 10^6 + *lo.
+static void dec_product(uint64_t ma, uint64_t mb, uint64_t *hi, uint32_t *mid, uint32_t *lo)
+{
+	uint64_t l, m;
+	uint32_t ah, al, bh, bl;
+
+	ah = ma / DEC_HALF_DIGITS;
+	al = ma % DEC_HALF_DIGITS;
+	bh = mb / DEC_HALF_DIGITS;
+	bl = mb % DEC_HALF_DIGITS;
+	l = (uint64_t) al * bl;
+	m = (uint64_t) ah * bl + (uint64_t) al * bh;
+	*hi = (uint64_t) ah * bh;
+
+	//Carry in base 10^6
+	*lo = l % DEC_HALF_DIGITS;
+	m += l / DEC_HALF_DIGITS;
+	*mid = m % DEC_HALF_DIGITS;
+	*hi += m / DEC_HALF_DIGITS;
+}
+//********************************************************************
+
+//********************************************************************
+DEC dec_mul(DEC a, DEC b)
+{
+	BOOLEAN negative;
+	uint64_t hi;
+	uint32_t mid, lo;
+
+	negative = (a.mantissa < 0) != (b.mantissa < 0);
+	if(a.exponent == DEC_SPECIAL || b.exponent == DEC_SPECIAL)
+	{
+		//NaN, 0 * Inf
+		if(a.mantissa == 0 || b.mantissa == 0)
+			return(dec_nan());
+		return(dec_inf(negative));
+	}
+	if(a.mantissa == 0 || b.mantissa == 0)
+		return(dec_make(False, 0, 0, DEC_REST_ZERO));
+
+	//The low 6 digits only decide the rounding
+	dec_product((a.mantissa < 0) ? -a.mantissa : a.mantissa, (b.mantissa < 0) ? -b.mantissa : b.mantissa,
+		&hi, &mid, &lo);
+	return(dec_make(negative, hi * DEC_HALF_DIGITS + mid, a.exponent + b.exponent + 6,
+		dec_rest(lo, DEC_HALF_DIGITS)));
+}
+//********************************************************************
+
+//********************************************************************
+DEC dec_div(DEC a, DEC b)
+{
+	BOOLEAN negative;
+	uint64_t r, mb, q;
+	UCHAR i, digit, rest;
+	int exp;
+
+	negative = (a.mantissa < 0) != (b.mantissa < 0);
+	if(a.exponent == DEC_SPECIAL || b.exponent == DEC_SPECIAL)
+	{
+		//NaN, Inf / Inf
+		if((a.exponent == DEC_SPECIAL && a.mantissa == 0) || (b.exponent == DEC_SPECIAL && b.mantissa == 0) ||
+				a.exponent == b.exponent)
+			return(dec_nan());
+		if(a.exponent == DEC_SPECIAL)
+			return(dec_inf(negative));
+		return(dec_make(False, 0, 0, DEC_REST_ZERO));
+	}
+	if(b.mantissa == 0)
+		return((a.mantissa == 0) ? dec_nan() : dec_inf(negative));
+	if(a.mantissa == 0)
+		return(a);
+
+	//Long division: DEC_DIGITS + 1 quotient digits, the remainder gives the rest
+	r = (a.mantissa < 0) ? -a.mantissa : a.mantissa;
+	mb = (b.mantissa < 0) ? -b.mantissa : b.mantissa;
+	exp = a.exponent - b.exponent - DEC_DIGITS;
+	if(r < mb)
+	{
+		r *= 10;
+		exp--;
+	}
+	q = 0;
+	for(i = 0; i <= DEC_DIGITS; i++)
+	{
+		for(digit = 0; r >= mb; digit++)
+			r -= mb;
+		q = q * 10 + digit;
+		r *= 10;
+	}
+	//r is 10 * the remainder: compare it with 5 * mb
+	mb *= 5;
+	if(r == 0)
+		rest = DEC_REST_ZERO;
+	else if(r < mb)
+		rest = DEC_REST_BELOW;
+	else
+		rest = (r == mb) ? DEC_REST_HALF : DEC_REST_ABOVE;
+	return(dec_make(negative, q, exp, rest));
+}
+//********************************************************************
+
+//********************************************************************
+DEC dec_neg(DEC a)
+{
+	a.mantissa = -a.mantissa;
+	return(a);
+}
+//********************************************************************
+
+//********************************************************************
+DEC dec_abs(DEC a)
+{
+	if(a.mantissa < 0)
+		a.mantissa = -a.mantissa;
+	return(a);
+}
+//********************************************************************
+
+//********************************************************************
+//Returns -1, 0 or 1 (0 for NaN).
+int dec_sign(DEC a)
+{
+	if(a.mantissa == 0)
+		return(0);
+	return((a.mantissa < 0) ? -1 : 1);
+}
+//********************************************************************
+
+//********************************************************************
+//Returns False if the float of a would be infinity or 0 (1E-37 <= |a| < 1E+38 fit).
+BOOLEAN dec_float_range(DEC a)
+{
+	int x;
+
+	if(a.mantissa == 0 || a.exponent == DEC_SPECIAL)
+		return(True);
+	x = a.exponent + DEC_DIGITS - 1;
+	return(x >= -DEC_FLOAT_EXP && x < DEC_FLOAT_EXP);
+}
+//********************************************************************
+
+//********************************************************************
+//sqrt(m * 10^e) = sqrt(n) * 10^((e - 12 + (e odd)) / 2) with the integer
+//  n = m * 10^12 or m * 10^11 (even exponent) in [10^22, 10^24), so the root has
+//  DEC_DIGITS integer digits and n is in the float range for any e.
+//The float root of n has 7 digits; one Newton step y = (y + n / y) / 2 gives about
+//  12. The integer root q is then corrected until -q < n - q^2 <= q, which makes it
+//  the root rounded to the nearest integer (n has no root halfway between two).
+DEC dec_sqrt(DEC a)
+{
+	DEC n, y, half;
+	uint64_t q, hi;
+	uint32_t mid, lo;
+	int64_t d;
+	int exp;
+
+	if(a.mantissa < 0)
+		return(dec_nan());
+	if(a.mantissa == 0 || a.exponent == DEC_SPECIAL)
+		return(a);
+	n.mantissa = a.mantissa;
+	n.exponent = (a.exponent & 1) ? DEC_DIGITS - 1 : DEC_DIGITS;
+	exp = (a.exponent - n.exponent) / 2;
+
+	y = dec_from_double(sqrt(dec_to_double(n)));
+	half.mantissa = 5 * DEC_MIN;
+	half.exponent = -DEC_DIGITS;
+	y = dec_mul(dec_add(y, dec_div(n, y)), half);
+	for(q = y.mantissa; y.exponent > 0; y.exponent--)
+		q *= 10;
+	for(; y.exponent < 0; y.exponent++)
+		q /= 10;
+
+	//n = m * 10^12 or (m / 10) * 10^12 + (m % 10) * 10^11
+	for(;;)
+	{
+		dec_product(q, q, &hi, &mid, &lo);
+		if(n.exponent == DEC_DIGITS)
+			d = ((int64_t) (n.mantissa - hi)) * DEC_LIMIT;
+		else
+			d = ((int64_t) (n.mantissa / 10 - hi)) * DEC_LIMIT + (n.mantissa % 10) * DEC_MIN;
+		d -= (int64_t) mid * DEC_HALF_DIGITS + lo;
+		if(d > (int64_t) q)
+			q++;
+		else if(d <= -(int64_t) q)
+			q--;
+		else
+			break;
+	}
+	return(dec_make(False, q, exp, DEC_REST_ZERO));
+}
+//********************************************************************
+
+//********************************************************************
+DEC dec_from_int(long value)
+{
+	return(dec_make(value < 0, (value < 0) ? -(uint64_t) value : (uint64_t) value, 0, DEC_REST_ZERO));
+}
+//********************************************************************
+
+//********************************************************************
+//The shortest decimal of the float, so 0.1 as a float becomes exactly 0.1.
+DEC dec_from_double(double value)
+{
+	FMT_DECIMAL dec;
+
+	if(!fmt_decimal(value, &dec))
+		return((value != value) ? dec_nan() : dec_inf(dec.negative));
+	return(dec_make(dec.negative, dec.mantissa, dec.exponent, DEC_REST_ZERO));
+}
+//********************************************************************
+
+//********************************************************************
+//The float nearest to the first FMT_MAX_DIGITS digits (rounded half up).
+double dec_to_double(DEC a)
+{
+	uint32_t m;
+	int exp;
+	double value;
+
+	if(a.exponent == DEC_SPECIAL)
+	{
+		if(a.mantissa == 0)
+			return(NAN);
+		return((a.mantissa < 0) ? -INFINITY : INFINITY);
+	}
+	m = (((a.mantissa < 0) ? -a.mantissa : a.mantissa) + 500) / 1000;
+	exp = a.exponent + DEC_DIGITS - FMT_MAX_DIGITS;
+	if(m >= 1000000000UL)
+	{
+		m /= 10;
+		exp++;
+	}
+	value = fmt_value(m, exp);
+	return((a.mantissa < 0) ? -value : value);
+}
+//********************************************************************
+
+//********************************************************************
+//Rounds the digits of the literal (fmt_literal_digit) times 10^exp10.
+DEC dec_from_literal(FMT_LITERAL *lit, int exp10)
+{
+	uint64_t m;
+	UCHAR i, n, digit, rest;
+
+	m = 0;
+	n = (lit->count < DEC_DIGITS) ? lit->count : DEC_DIGITS;
+	for(i = 0; i < n; i++)
+		m = m * 10 + lit->digit[i];
+	//The first dropped digit decides, the ones after it only break a tie
+	rest = DEC_REST_ZERO;
+	if(lit->count > DEC_DIGITS)
+	{
+		digit = lit->digit[DEC_DIGITS];
+		for(i = DEC_DIGITS + 1; i < lit->count && lit->digit[i] == 0; i++)
+			;
+		if(digit > 5 || (digit == 5 && i < lit->count))
+			rest = DEC_REST_ABOVE;
+		else if(digit == 5)
+			rest = DEC_REST_HALF;
+		else if(digit != 0 || i < lit->count)
+			rest = DEC_REST_BELOW;
+	}
+	return(dec_make(False, m, lit->exponent + exp10 + lit->count - n, rest));
+}
+//********************************************************************
+
+//********************************************************************
+//Writes the number into the FMT_WIDTH characters of line (not 0 terminated) in the
+//  given mode (see numfmt.h).
+void dec_format(DEC a, UCHAR mode, UCHAR digits, char *line)
+{
+	UCHAR d[DEC_DIGITS], i;
+	uint64_t m;
+	uint32_t half;
+
+	if(a.exponent == DEC_SPECIAL)
+	{
+		fmt_special(a.mantissa == 0, a.mantissa < 0, line);
+		return;
+	}
+	//Two halves of DEC_DIGITS / 2 digits, so the digit loop divides 32 bit numbers
+	m = (a.mantissa < 0) ? -a.mantissa : a.mantissa;
+	half = m % DEC_HALF_DIGITS;
+	for(i = DEC_DIGITS; i > DEC_DIGITS / 2; half /= 10)
+		d[--i] = half % 10;
+	half = m / DEC_HALF_DIGITS;
+	for(; i > 0; half /= 10)
+		d[--i] = half % 10;
+	fmt_layout(d, (m != 0) ? DEC_DIGITS : 0, a.exponent + DEC_DIGITS - 1, a.mantissa < 0,
+		mode, digits, DEC_DIGITS, line);
+}
+//********************************************************************
+
+//********************************************************************
+DEC dec_pi(void)
+{
+	DEC r;
+
+	r.mantissa = 314159265359LL;
+	r.exponent = -(DEC_DIGITS - 1);
+	return(r);
+}
+//********************************************************************
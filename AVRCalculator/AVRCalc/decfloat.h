@@ -0,0 +1,56 @@
+//decfloat.h : header file for the AVRCalculator decimal floating point numbers
+//
+
+#ifndef _DECFLOAT_H_
+#define _DECFLOAT_H_
+
+#include <inttypes.h>
+#include "types.h"
+#include "numfmt.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//Decimal floating point
+//
+//Notes:
+//  1) A DEC is a signed 64 bit integer mantissa and a power of 10 exponent:
+//    value = mantissa * 10^exponent. A non-zero mantissa always has DEC_DIGITS
+//    digits, so every value has one representation and 0.1 + 0.2 is exactly 0.3.
+//  2) +, -, *, / and sqrt are exact before they are rounded to DEC_DIGITS digits
+//    (half to even; a square root is never halfway). The other functions of the
+//    calculator go through the float kernels of avr-libc (number.h): their results
+//    have float precision, and their arguments must be in the float range
+//    (dec_float_range, 1E-37 to 1E+38) or the evaluation fails.
+//  3) Results beyond 1E+DEC_EXP_LIMIT are infinity (exponent DEC_SPECIAL, mantissa
+//    -1 or 1), NaN has exponent DEC_SPECIAL and mantissa 0. Results below
+//    1E-DEC_EXP_LIMIT are 0.
+//  4) Literals and the result line are base 10 already: dec_from_literal rounds the
+//    digits as they were typed and dec_format hands the mantissa digits to fmt_layout
+//    (numfmt.h).
+
+#define DEC_DIGITS				12
+#define DEC_EXP_LIMIT			99		//Largest exponent of the first digit
+#define DEC_SPECIAL				127		//Exponent of infinity and NaN
+
+typedef struct
+{
+	int64_t mantissa;				//0 or DEC_DIGITS digits
+	signed char exponent;		//Value = mantissa * 10^exponent
+} __attribute__ ((packed)) DEC;
+
+DEC dec_add(DEC a, DEC b);
+DEC dec_sub(DEC a, DEC b);
+DEC dec_mul(DEC a, DEC b);
+DEC dec_div(DEC a, DEC b);
+DEC dec_neg(DEC a);
+DEC dec_abs(DEC a);
+DEC dec_sqrt(DEC a);
+int dec_sign(DEC a);
+BOOLEAN dec_float_range(DEC a);
+DEC dec_from_int(long value);
+DEC dec_from_double(double value);
+double dec_to_double(DEC a);
+DEC dec_from_literal(FMT_LITERAL *lit, int exp10);
+void dec_format(DEC a, UCHAR mode, UCHAR digits, char *line);
+DEC dec_pi(void);
+
+#endif
@@ -0,0 +1,208 @@
+//************************************************************************//
+//   -- DIAGNOSTICS MODULE --
+//SRAM and stack high-water instrumentation for AVRCalculator
+//  (plus the LCD bus writes per keystroke counted by lcdmore.c, ISR run times and
+//  the time spent in each power state and waking up, and cycle counts)
+//
+//The free SRAM between the end of .bss (_end) and the stack is painted with
+//  DIAG_STACK_PAINT at reset. The lowest painted byte that has been overwritten
+//  is the deepest point the stack has reached.
+//diag_begin/diag_end bracket a measured site: the unused stack is repainted when a
+//  site begins and scanned again when it ends, so each site gets its own high-water
+//  mark (nested sites are charged for the inner ones too).
+//************************************************************************//
+
+//************************************************************************//
+//Include header files
+#include "AVRCalculator.h"
+#include "diag.h"
+//************************************************************************//
+
+//************************************************************************//
+//Global variables
+DIAG_INFO diag;
+
+//Linker symbols: end of .bss and top of the stack
+extern UCHAR _end;
+extern UCHAR __stack;
+
+//diag_cycles_begin state
+static UCHAR diag_cycles_sreg;
+static USHORT diag_cycles_start;
+//************************************************************************//
+
+//********************************************************************
+//Paints the whole free SRAM before the C runtime starts.
+//Runs from .init1, so the stack and r1 (zero register) must not be used.
+void diag_paint_stack(void) __attribute__ ((naked, used, section (".init1")));
+void diag_paint_stack(void)
+{
+	__asm volatile ("    ldi r30,lo8(_end)\n"
+									"    ldi r31,hi8(_end)\n"
+									"    ldi r24,%0\n"
+									"    ldi r25,hi8(__stack)\n"
+									"    rjmp 2f\n"
+									"1:\n"
+									"    st Z+,r24\n"
+									"2:\n"
+									"    cpi r30,lo8(__stack)\n"
+									"    cpc r31,r25\n"
+									"    brlo 1b\n"
+									"    breq 1b"
+									: : "M" (DIAG_STACK_PAINT));
+}
+//********************************************************************
+
+#if _DIAG_ENABLED_
+
+//********************************************************************
+//Finds the lowest stack byte overwritten since the last paint and charges it
+//  to all active sites.
+static void diag_scan(void)
+{
+	UCHAR *p = &_end;
+	USHORT used;
+	UCHAR site;
+
+	while((p < &__stack) && (*p == DIAG_STACK_PAINT))
+		p++;
+
+	if((diag.stack_low == 0) || ((USHORT) p < diag.stack_low))
+		diag.stack_low = (USHORT) p;
+
+	used = (USHORT) &__stack - (USHORT) p;
+	for(site=0;site<DIAG_SITES;site++)
+	{
+		if((diag.active_sites & (1 << site)) && (used > diag.stack_used[site]))
+			diag.stack_used[site] = used;
+	}
+}
+//********************************************************************
+
+//********************************************************************
+//Starts measuring a site.
+void diag_begin(UCHAR site)
+{
+	UCHAR *p;
+
+	diag_scan();
+	//Repaint everything below the current stack pointer
+	for(p=&_end;p<(UCHAR *) SP;p++)
+		*p = DIAG_STACK_PAINT;
+	diag.active_sites |= (1 << site);
+}
+//********************************************************************
+
+//********************************************************************
+//Stops measuring a site.
+void diag_end(UCHAR site)
+{
+	diag_scan();
+	diag.active_sites &= ~(1 << site);
+}
+//********************************************************************
+
+//********************************************************************
+//Records an allocation from a parser pool which now has used entries in use.
+void diag_pool_alloc(UCHAR pool, USHORT used)
+{
+	diag.pool_allocs[pool]++;
+	if(used > diag.pool_peak[pool])
+		diag.pool_peak[pool] = used;
+}
+//********************************************************************
+
+//********************************************************************
+//Records the number of LCD bus writes caused by one keystroke.
+void diag_lcd_writes(USHORT writes)
+{
+	diag.lcd_writes_last = writes;
+	if(writes > diag.lcd_writes_peak)
+		diag.lcd_writes_peak = writes;
+}
+//********************************************************************
+
+//********************************************************************
+//Returns the average supply current in uA estimated from the time spent in each
+//  power state. A simulator can read diag.power_ms directly for its own model.
+unsigned long diag_avg_current(void)
+{
+	double total, charge;
+
+	total = (double) diag.power_ms[DIAG_POWER_ACTIVE] + diag.power_ms[DIAG_POWER_IDLE] +
+					diag.power_ms[DIAG_POWER_OFF];
+	if(total == 0)
+		return(0);
+	charge = (double) diag.power_ms[DIAG_POWER_ACTIVE] * DIAG_CURRENT_ACTIVE_UA +
+					 ((double) diag.power_ms[DIAG_POWER_IDLE] + diag.power_ms[DIAG_POWER_OFF]) * DIAG_CURRENT_IDLE_UA;
+	return((unsigned long) (charge / total));
+}
+//********************************************************************
+
+//********************************************************************
+//Starts measuring the wake time (at the ON key).
+void diag_wake_begin(void)
+{
+	UCHAR sreg = SREG;
+
+	cli();
+	diag.wake_ms = 0;
+	SREG = sreg;
+}
+//********************************************************************
+
+//********************************************************************
+//Records the time from the reset or ON key until the editor takes keys
+//  (DIAG_WAKE_BEGIN was used when it started).
+void diag_wake_end(void)
+{
+	UCHAR sreg = SREG;
+	USHORT ms;
+
+	cli();
+	ms = diag.wake_ms;
+	SREG = sreg;
+	diag.wake_ms_last = ms;
+	if(ms > diag.wake_ms_peak)
+		diag.wake_ms_peak = ms;
+}
+//********************************************************************
+
+//********************************************************************
+//Starts counting CPU cycles with Timer1; interrupts stay disabled until
+//  diag_cycles_end, so nothing else is counted. The Timer1 compare flag is cleared
+//  (that tick is lost) so one wrap of the tick period can be seen.
+void diag_cycles_begin(void)
+{
+	diag_cycles_sreg = SREG;
+	cli();
+	TIFR = (1 << OCF1A);
+	diag_cycles_start = TCNT1;
+}
+//********************************************************************
+
+//********************************************************************
+//Returns the CPU cycles since diag_cycles_begin in steps of DIAG_CYCLES_T1
+//  (the measured code must run for less than one tick).
+unsigned long diag_cycles_end(void)
+{
+	long ticks;
+
+	ticks = (long) TCNT1 - diag_cycles_start;
+	if(TIFR & (1 << OCF1A))
+		ticks += (long) OCR1A + 1;
+	SREG = diag_cycles_sreg;
+	return((unsigned long) ticks * DIAG_CYCLES_T1);
+}
+//********************************************************************
+
+//********************************************************************
+//Returns the smallest number of free bytes seen between .bss and the stack.
+USHORT diag_stack_free(void)
+{
+	diag_scan();
+	return(diag.stack_low - (USHORT) &_end);
+}
+//********************************************************************
+
+#endif
@@ -0,0 +1,112 @@
+//diag.h : header file for the AVRCalculator diagnostics
+//
+
+#ifndef _DIAG_H_
+#define _DIAG_H_
+
+#include "types.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//Diagnostics
+//
+//Notes:
+//  1) _DIAG_ENABLED_
+//    Change to 0 to remove all diagnostics code; the DIAG_* macros then expand to nothing.
+//  2) The diag variable is a plain global so that a simulator or debugger can read it
+//    by its symbol name (e.g. "print diag" in avr-gdb) as well as the diagnostics screen.
+
+#ifndef _DIAG_ENABLED_
+#define _DIAG_ENABLED_		1
+#endif
+
+//Value painted in the free SRAM between the end of .bss and the stack
+#define DIAG_STACK_PAINT	0xC5
+
+//Measured sites (bit masks are 1 << site)
+#define DIAG_SITE_PARSER_INIT		0
+#define DIAG_SITE_CALC					1
+#define DIAG_SITE_LCD_REFRESH		2
+#define DIAG_SITES							3
+
+//Measured interrupt service routines
+#define DIAG_ISR_TIMER1					0
+#define DIAG_ISR_LCD						1
+#define DIAG_ISRS								2
+
+//Power states (time spent in each is accounted by the Timer1 ISR)
+#define DIAG_POWER_ACTIVE				0			//Running
+#define DIAG_POWER_IDLE					1			//Idle sleep while on
+#define DIAG_POWER_OFF					2			//Idle sleep while off (slow tick)
+#define DIAG_POWER_STATES				3
+
+//Typical ATmega32 supply current at 8 MHz, 5 V (datasheet curves, LCD not included)
+#define DIAG_CURRENT_ACTIVE_UA	12000
+#define DIAG_CURRENT_IDLE_UA		5500
+
+//CPU cycles per Timer1 count with the normal tick (clk/64, AVRCalculatorTimer.c)
+#define DIAG_CYCLES_T1					64
+
+//Parser pools
+#define DIAG_POOL_OPSTACK				0
+#define DIAG_POOL_VALSTACK			1
+#define DIAG_POOL_PROGRAM				2
+#define DIAG_POOL_CONST					3
+#define DIAG_POOLS							4
+
+typedef struct
+{
+	USHORT stack_low;										//Lowest stack address reached since reset (0 = not measured)
+	USHORT stack_used[DIAG_SITES];			//Max stack bytes used while each site was active
+	USHORT pool_peak[DIAG_POOLS];				//Max entries in use of each parser pool
+	unsigned long pool_allocs[DIAG_POOLS];	//Entries taken from each pool since reset
+	USHORT lcd_writes_last;							//LCD bus writes caused by the last keystroke
+	USHORT lcd_writes_peak;							//Max LCD bus writes caused by one keystroke
+	UCHAR isr_wcet[DIAG_ISRS];					//Longest run of each ISR in microseconds (Timer2 ticks)
+	unsigned long power_ms[DIAG_POWER_STATES];	//Time in each power state (sampled every tick)
+	USHORT wake_ms;											//Time since reset or the ON key (counted every tick)
+	USHORT wake_ms_last;								//Time from the last reset or ON key until keys were taken
+	USHORT wake_ms_peak;								//Longest wake time
+	UCHAR active_sites;
+} DIAG_INFO;
+
+extern DIAG_INFO diag;
+
+#if _DIAG_ENABLED_
+void diag_begin(UCHAR site);
+void diag_end(UCHAR site);
+void diag_pool_alloc(UCHAR pool, USHORT used);
+USHORT diag_stack_free(void);
+void diag_lcd_writes(USHORT writes);
+unsigned long diag_avg_current(void);
+void diag_wake_begin(void);
+void diag_wake_end(void);
+void diag_cycles_begin(void);
+unsigned long diag_cycles_end(void);
+
+#define DIAG_BEGIN(site)						diag_begin(site)
+#define DIAG_END(site)							diag_end(site)
+#define DIAG_POOL_ALLOC(pool, used)	diag_pool_alloc(pool, used)
+#define DIAG_LCD_WRITES(writes)			diag_lcd_writes(writes)
+//Timer2 runs at 1 MHz; the check is inline so the ISR does not save more registers.
+//DIAG_ISR_BEGIN must be the first statement of the ISR.
+#define DIAG_POWER_TICK(state, ms)	diag.power_ms[state] += (ms)
+#define DIAG_WAKE_TICK(ms)					diag.wake_ms += (ms)
+#define DIAG_WAKE_BEGIN()						diag_wake_begin()
+#define DIAG_WAKE_END()							diag_wake_end()
+#define DIAG_ISR_BEGIN()						UCHAR diag_isr_start = TCNT2
+#define DIAG_ISR_END(isr)						{ UCHAR diag_isr_time = TCNT2 - diag_isr_start; \
+																			if(diag_isr_time > diag.isr_wcet[isr]) diag.isr_wcet[isr] = diag_isr_time; }
+#else
+#define DIAG_BEGIN(site)
+#define DIAG_END(site)
+#define DIAG_POOL_ALLOC(pool, used)
+#define DIAG_LCD_WRITES(writes)
+#define DIAG_POWER_TICK(state, ms)
+#define DIAG_WAKE_TICK(ms)
+#define DIAG_WAKE_BEGIN()
+#define DIAG_WAKE_END()
+#define DIAG_ISR_BEGIN()
+#define DIAG_ISR_END(isr)
+#endif
+
+#endif
@@ -0,0 +1,312 @@
+//************************************************************************//
+//   -- EEPROM STORE MODULE --
+//Wear leveled, write-back key-value store for AVRCalculator (see eestore.h)
+//
+//Page layout: header (sequence number, 0xFF = erased; format) followed by
+//  EESTORE_RECORDS records. A page of another format (a build with the other number
+//  backend has other records and pages) counts as erased. Record layout: value (EESTORE_VALUE_LEN bytes), check, key. The bytes
+//  are written in address order, so the key is written last and a record whose key
+//  is still 0xFF is free. Only the bytes that differ are written.
+//************************************************************************//
+
+//************************************************************************//
+//Include header files
+#include "AVRCalculator.h"
+#include <string.h>
+#include <eeprom.h>
+#include "eestore.h"
+#include "persist.h"
+#include "sched.h"
+#include "AVRCalculatorTimer.h"
+//************************************************************************//
+
+//************************************************************************//
+//Definitions
+#define EESTORE_RECORD_SIZE		(EESTORE_VALUE_LEN + 2)
+#define EESTORE_HEADER_SIZE		2
+#define EESTORE_RECORDS				((EESTORE_PAGE_SIZE - EESTORE_HEADER_SIZE) / EESTORE_RECORD_SIZE)
+#define EESTORE_CHECK					EESTORE_VALUE_LEN
+#define EESTORE_KEY						(EESTORE_VALUE_LEN + 1)
+#define EESTORE_FREE					0xFF
+#define EESTORE_NONE					0xFF
+#define EESTORE_FORMAT				(0xA0 + EESTORE_VALUE_LEN)		//Change when the layout changes
+
+//Writer states
+#define EESTORE_ACTIVE				0		//Appending records to the active page
+#define EESTORE_ERASE					1		//Erasing the next page
+#define EESTORE_COPY					2		//Copying every key to the next page
+
+//Every key must fit in a page together with at least one new record
+typedef char EESTORE_CHECK_KEYS[(EESTORE_KEYS < EESTORE_RECORDS) ? 1 : -1];
+//************************************************************************//
+
+//************************************************************************//
+//Global variables
+EEMEM UCHAR eestore_pages[EESTORE_PAGES][EESTORE_PAGE_SIZE];
+
+volatile unsigned int eestore_timer = 0;
+
+static UCHAR ee_cache[EESTORE_KEYS][EESTORE_VALUE_LEN];
+static UCHAR ee_valid;				//Bit n: key n has a value
+static UCHAR ee_dirty;				//Bit n: key n must be written
+static UCHAR ee_copy;					//Bit n: key n must be copied to the new page
+static UCHAR ee_state;
+static UCHAR ee_page;					//Active page (or the one being erased/copied)
+static UCHAR ee_seq;					//Its sequence number
+static UCHAR ee_slot;					//Next free record of ee_page
+static UCHAR ee_erase;				//Bytes of ee_page erased
+
+static UCHAR ee_record[EESTORE_RECORD_SIZE];	//Record being written
+static UCHAR ee_pos = EESTORE_RECORD_SIZE;		//Bytes of ee_record written
+//************************************************************************//
+
+//********************************************************************
+//Interrupt Service Routine for EEPROM Ready:
+//  -- Give eestore_task the next byte to write (EV_STORE).
+ISR(SIG_EEPROM_READY)
+{
+	EECR &= ~(1 << EERIE);
+	sched_signal(EV_STORE);
+}
+//********************************************************************
+
+//********************************************************************
+//Writes a byte if it differs from the EEPROM (the EEPROM must be ready).
+static void ee_update(UCHAR *addr, UCHAR value)
+{
+	if(eeprom_read_byte(addr) != value)
+		eeprom_write_byte(addr, value);
+}
+//********************************************************************
+
+//********************************************************************
+//Returns the check byte of a record.
+static UCHAR ee_check(UCHAR *record)
+{
+	UCHAR i, sum;
+
+	sum = record[EESTORE_KEY];
+	for(i=0;i<EESTORE_VALUE_LEN;i++)
+		sum += record[i];
+	return(~sum);
+}
+//********************************************************************
+
+//********************************************************************
+//Returns the EEPROM address of a record.
+static UCHAR *ee_record_addr(UCHAR page, UCHAR slot)
+{
+	return(&eestore_pages[page][EESTORE_HEADER_SIZE + slot * EESTORE_RECORD_SIZE]);
+}
+//********************************************************************
+
+//********************************************************************
+//Returns the index of the lowest bit set in mask (mask must not be 0).
+static UCHAR ee_lowest(UCHAR mask)
+{
+	UCHAR key;
+
+	for(key=0;!(mask & (1 << key));key++)
+		;
+	return(key);
+}
+//********************************************************************
+
+//********************************************************************
+//Builds the record of a key from the cache; its bytes are written by ee_step.
+static void ee_record_start(UCHAR key)
+{
+	memcpy(ee_record, ee_cache[key], EESTORE_VALUE_LEN);
+	ee_record[EESTORE_KEY] = key;
+	ee_record[EESTORE_CHECK] = ee_check(ee_record);
+	ee_dirty &= ~(1 << key);
+	ee_pos = 0;
+}
+//********************************************************************
+
+//********************************************************************
+//Does the next step of the write-back; at most one byte is written.
+//Returns False when there is nothing to write.
+static BOOLEAN ee_step(void)
+{
+	if(ee_pos < EESTORE_RECORD_SIZE)
+	{
+		ee_update(ee_record_addr(ee_page, ee_slot) + ee_pos, ee_record[ee_pos]);
+		if(++ee_pos == EESTORE_RECORD_SIZE)
+			ee_slot++;
+		return(True);
+	}
+
+	switch(ee_state)
+	{
+	case EESTORE_ERASE:
+		{
+			//The header is erased first, so the page is invalid until it is complete; the
+			//  format byte is written with the erase
+			if(ee_erase < EESTORE_PAGE_SIZE)
+			{
+				ee_update(&eestore_pages[ee_page][ee_erase], (ee_erase == 1) ? EESTORE_FORMAT : EESTORE_FREE);
+				ee_erase++;
+			}
+			else
+			{
+				ee_slot = 0;
+				ee_copy = ee_valid;
+				ee_state = EESTORE_COPY;
+			}
+			return(True);
+		}
+	case EESTORE_COPY:
+		{
+			if(ee_copy)
+			{
+				ee_record_start(ee_lowest(ee_copy));
+				ee_copy &= ~(1 << ee_record[EESTORE_KEY]);
+			}
+			else
+			{
+				ee_update(&eestore_pages[ee_page][0], ee_seq);
+				ee_state = EESTORE_ACTIVE;
+			}
+			return(True);
+		}
+	default:
+		{
+			if(!ee_dirty)
+				return(False);
+			if(ee_slot < EESTORE_RECORDS)
+			{
+				ee_record_start(ee_lowest(ee_dirty));
+			}
+			else
+			{
+				//Page full: continue on the next one
+				if(++ee_page >= EESTORE_PAGES)
+					ee_page = 0;
+				if(++ee_seq == EESTORE_NONE)
+					ee_seq = 0;
+				ee_erase = 0;
+				ee_state = EESTORE_ERASE;
+			}
+			return(True);
+		}
+	}
+}
+//********************************************************************
+
+//********************************************************************
+//Loads the values from the newest page. Must be called once at reset.
+void eestore_init(void)
+{
+	UCHAR page, seq, slot;
+	UCHAR record[EESTORE_RECORD_SIZE];
+
+	ee_page = EESTORE_NONE;
+	for(page=0;page<EESTORE_PAGES;page++)
+	{
+		seq = eeprom_read_byte(&eestore_pages[page][0]);
+		if((seq == EESTORE_NONE) || (eeprom_read_byte(&eestore_pages[page][1]) != EESTORE_FORMAT))
+			continue;
+		//The sequence numbers of the pages in use are within EESTORE_PAGES of each other
+		if((ee_page == EESTORE_NONE) || ((signed char) (seq - ee_seq) > 0))
+		{
+			ee_page = page;
+			ee_seq = seq;
+		}
+	}
+
+	ee_valid = 0;
+	ee_dirty = 0;
+	ee_state = EESTORE_ACTIVE;
+	if(ee_page == EESTORE_NONE)
+	{
+		//Empty EEPROM: the first write starts page 0
+		ee_page = EESTORE_PAGES - 1;
+		ee_seq = EESTORE_NONE - 1;
+		ee_slot = EESTORE_RECORDS;
+		return;
+	}
+
+	//Later records of a key replace the earlier ones
+	for(slot=0;slot<EESTORE_RECORDS;slot++)
+	{
+		eeprom_read_block(record, ee_record_addr(ee_page, slot), EESTORE_RECORD_SIZE);
+		if(record[EESTORE_KEY] == EESTORE_FREE)
+			break;
+		if((record[EESTORE_KEY] < EESTORE_KEYS) && (record[EESTORE_CHECK] == ee_check(record)))
+		{
+			memcpy(ee_cache[record[EESTORE_KEY]], record, EESTORE_VALUE_LEN);
+			ee_valid |= (1 << record[EESTORE_KEY]);
+		}
+	}
+	ee_slot = slot;
+}
+//********************************************************************
+
+//********************************************************************
+//Reads the value of a key. Returns False if it was never stored.
+BOOLEAN eestore_get(UCHAR key, void *value, UCHAR len)
+{
+	if(!(ee_valid & (1 << key)))
+		return(False);
+	memcpy(value, ee_cache[key], len);
+	return(True);
+}
+//********************************************************************
+
+//********************************************************************
+//Changes the value of a key. It is written back after EESTORE_DELAY_MS without
+//  changes (or by eestore_flush).
+void eestore_set(UCHAR key, void *value, UCHAR len)
+{
+	UCHAR buf[EESTORE_VALUE_LEN];
+
+	memset(buf, 0, EESTORE_VALUE_LEN);
+	memcpy(buf, value, len);
+	if((ee_valid & (1 << key)) && !memcmp(buf, ee_cache[key], EESTORE_VALUE_LEN))
+		return;
+	memcpy(ee_cache[key], buf, EESTORE_VALUE_LEN);
+	ee_valid |= (1 << key);
+	ee_dirty |= (1 << key);
+	cli();
+	eestore_timer = EESTORE_DELAY_MS / TICK_MS;
+	sei();
+}
+//********************************************************************
+
+//********************************************************************
+//Writes the changed values without waiting for the write-back delay (power off).
+void eestore_flush(void)
+{
+	cli();
+	eestore_timer = 0;
+	sei();
+	sched_signal(EV_STORE);
+}
+//********************************************************************
+
+//********************************************************************
+//Store task (EV_STORE): writes back the dirty keys, then the state snapshot
+//  (persist.h), while the EEPROM is ready.
+void eestore_task(UCHAR events)
+{
+	unsigned int timer;
+
+	cli();
+	timer = eestore_timer;
+	sei();
+	if(timer)
+		return;
+	while(True)
+	{
+		if(!eeprom_is_ready())
+		{
+			//EV_STORE again when the byte is written
+			EECR |= (1 << EERIE);
+			return;
+		}
+		if(!ee_step() && !persist_step())
+			return;
+	}
+}
+//********************************************************************
@@ -0,0 +1,53 @@
+//eestore.h : header file for the AVRCalculator EEPROM key-value store
+//
+
+#ifndef _EESTORE_H_
+#define _EESTORE_H_
+
+#include "types.h"
+#include "membudget.h"  //MEM_NUMBER_SIZE
+
+/////////////////////////////////////////////////////////////////////////////
+//EEPROM key-value store
+//
+//Notes:
+//  1) The values live in a RAM cache. eestore_set only changes the cache and marks the
+//    key dirty if the value is different; the dirty keys are written back by
+//    eestore_task when no value changed for EESTORE_DELAY_MS (or at once after
+//    eestore_flush), so a value that changes often (Ans) is written once per burst.
+//  2) eestore_task is the lowest priority task and writes one byte at a time: when the
+//    EEPROM is busy (~8.5ms per byte) it returns and the EEPROM ready interrupt gives
+//    it EV_STORE again, so writing never blocks the other tasks. The state snapshot
+//    (persist.h) is written the same way when no key is dirty.
+//  3) Wear leveling: the store is a log of records (key, value, check) in EESTORE_PAGES
+//    pages used round-robin. A new record is appended to the active page; when it is
+//    full the next page is erased, gets the current value of every key and becomes
+//    the active page when its sequence number is written last. A reset in the middle
+//    of a write therefore leaves the previous page or record in effect. The page
+//    header also holds a format byte for the page and record layout, so the EEPROM of
+//    a build with the other number backend reads as erased.
+//  4) Values are up to EESTORE_VALUE_LEN bytes (the size of Ans, number.h); keys are
+//    0..EESTORE_KEYS-1. With the decimal numbers the pages are fewer and larger, so a
+//    page still holds a record of every key.
+
+#define EESTORE_KEYS					5		//Up to 8, fewer than the records per page
+#define EESTORE_VALUE_LEN			MEM_NUMBER_SIZE		//Ans
+#if EESTORE_VALUE_LEN > 4
+#define EESTORE_PAGES					4
+#define EESTORE_PAGE_SIZE			128
+#else
+#define EESTORE_PAGES					8
+#define EESTORE_PAGE_SIZE			64
+#endif
+#define EESTORE_DELAY_MS			2000
+
+//Write-back delay counted down by the Timer1 ISR (sched_signal(EV_STORE) at 0)
+extern volatile unsigned int eestore_timer;
+
+void eestore_init(void);
+BOOLEAN eestore_get(UCHAR key, void *value, UCHAR len);
+void eestore_set(UCHAR key, void *value, UCHAR len);
+void eestore_flush(void);
+void eestore_task(UCHAR events);
+
+#endif
@@ -0,0 +1,104 @@
+//************************************************************************//
+//   -- GAP BUFFER MODULE --
+//Formula editing buffer for AVRCalculator (see gapbuf.h)
+//************************************************************************//
+
+//************************************************************************//
+//Include header files
+#include <string.h>
+#include "gapbuf.h"
+//************************************************************************//
+
+//********************************************************************
+//Moves the gap so that it starts at the logical position pos.
+static void gap_moveto(GAP_BUFFER *gb, int pos)
+{
+	int n;
+
+	if(pos < gb->gap_start)
+	{
+		//Keys pos..gap_start-1 go to the end of the gap
+		n = gb->gap_start - pos;
+		gb->gap_start -= n;
+		gb->gap_end -= n;
+		memmove(&gb->keys[gb->gap_end], &gb->keys[gb->gap_start], n);
+	}
+	else if(pos > gb->gap_start)
+	{
+		//Keys after the gap up to pos go to the start of the gap
+		n = pos - gb->gap_start;
+		memmove(&gb->keys[gb->gap_start], &gb->keys[gb->gap_end], n);
+		gb->gap_start += n;
+		gb->gap_end += n;
+	}
+}
+//********************************************************************
+
+//********************************************************************
+//Removes all keys.
+void gap_clear(GAP_BUFFER *gb)
+{
+	gb->gap_start = 0;
+	gb->gap_end = FORMULA_MAX_LEN;
+}
+//********************************************************************
+
+//********************************************************************
+//Returns the number of keys in the buffer.
+int gap_len(GAP_BUFFER *gb)
+{
+	return(FORMULA_MAX_LEN - (gb->gap_end - gb->gap_start));
+}
+//********************************************************************
+
+//********************************************************************
+//Returns the key at the logical position pos.
+UCHAR gap_at(GAP_BUFFER *gb, int pos)
+{
+	if(pos < gb->gap_start)
+		return(gb->keys[pos]);
+	return(gb->keys[pos + gb->gap_end - gb->gap_start]);
+}
+//********************************************************************
+
+//********************************************************************
+//Inserts a key before the key at pos (pos = gap_len() appends).
+//Returns False if the buffer is full.
+BOOLEAN gap_insert(GAP_BUFFER *gb, int pos, UCHAR key)
+{
+	if(gb->gap_start == gb->gap_end)
+		return(False);
+	gap_moveto(gb, pos);
+	gb->keys[gb->gap_start++] = key;
+	return(True);
+}
+//********************************************************************
+
+//********************************************************************
+//Deletes the key at pos. The gap is moved to the nearer side of the key,
+//  so a backspace after an insert does not move any key.
+void gap_delete(GAP_BUFFER *gb, int pos)
+{
+	if(pos < gb->gap_start)
+	{
+		gap_moveto(gb, pos + 1);
+		gb->gap_start--;
+	}
+	else
+	{
+		gap_moveto(gb, pos);
+		gb->gap_end++;
+	}
+}
+//********************************************************************
+
+//********************************************************************
+//Overwrites the key at pos.
+void gap_replace(GAP_BUFFER *gb, int pos, UCHAR key)
+{
+	if(pos < gb->gap_start)
+		gb->keys[pos] = key;
+	else
+		gb->keys[pos + gb->gap_end - gb->gap_start] = key;
+}
+//********************************************************************
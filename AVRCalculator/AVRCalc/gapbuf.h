@@ -0,0 +1,34 @@
+//gapbuf.h : header file for the AVRCalculator formula gap buffer
+//
+
+#ifndef _GAPBUF_H_
+#define _GAPBUF_H_
+
+#include "types.h"
+#include "membudget.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//Gap buffer of key codes
+//
+//Notes:
+//  1) The keys are stored in keys[0..gap_start-1] and keys[gap_end..FORMULA_MAX_LEN-1];
+//    keys[gap_start..gap_end-1] is the free space. Positions passed to the functions
+//    are logical key indexes (0..gap_len()-1), the gap is invisible to the caller.
+//  2) Inserting or deleting moves the gap to the position first, which only moves the
+//    keys between the old and the new gap position. Edits at the cursor therefore move
+//    at most one key; gap_replace never moves the gap.
+
+typedef struct
+{
+	UCHAR keys[FORMULA_MAX_LEN];
+	int gap_start, gap_end;
+} GAP_BUFFER;
+
+void gap_clear(GAP_BUFFER *gb);
+int gap_len(GAP_BUFFER *gb);
+UCHAR gap_at(GAP_BUFFER *gb, int pos);
+BOOLEAN gap_insert(GAP_BUFFER *gb, int pos, UCHAR key);
+void gap_delete(GAP_BUFFER *gb, int pos);
+void gap_replace(GAP_BUFFER *gb, int pos, UCHAR key);
+
+#endif
@@ -0,0 +1,324 @@
+//************************************************************************//
+//   -- HISTORY MODULE --
+//Formula history ring for AVRCalculator (see history.h)
+//
+//Entry layout: size (bytes of the whole entry), flags, number of keys, keys; with
+//  HISTORY_PROGRAM in flags: result, program length, opcodes, number of constants,
+//  constants. The ring positions wrap at HISTORY_BYTES, so an entry may be split.
+//Entries are never moved in the ring, so index[] can hold their positions.
+//************************************************************************//
+
+//************************************************************************//
+//Include header files
+#include <string.h>
+#include "history.h"
+//************************************************************************//
+
+//************************************************************************//
+//Definitions
+#define HISTORY_HEADER			3			//size, flags, number of keys
+
+//Entry flags
+#define HISTORY_PROGRAM			0x01	//Result and compiled program follow the keys
+//************************************************************************//
+
+//********************************************************************
+//Returns a ring position (pos < 2 * HISTORY_BYTES).
+static UCHAR hist_wrap(UINT pos)
+{
+	if(pos >= HISTORY_BYTES)
+		pos -= HISTORY_BYTES;
+	return(pos);
+}
+//********************************************************************
+
+//********************************************************************
+//Copies len bytes to the ring at pos. Returns the position after them.
+static UCHAR hist_put(HISTORY *hist, UCHAR pos, void *src, UCHAR len)
+{
+	UCHAR *p = src;
+
+	while(len--)
+	{
+		hist->ring[pos] = *p++;
+		pos = hist_wrap(pos + 1);
+	}
+	return(pos);
+}
+//********************************************************************
+
+//********************************************************************
+//Copies len bytes from the ring at pos. Returns the position after them.
+static UCHAR hist_get(HISTORY *hist, UCHAR pos, void *dst, UCHAR len)
+{
+	UCHAR *p = dst;
+
+	while(len--)
+	{
+		*p++ = hist->ring[pos];
+		pos = hist_wrap(pos + 1);
+	}
+	return(pos);
+}
+//********************************************************************
+
+//********************************************************************
+//Returns the ring position of an entry (index < count, 0 = newest).
+static UCHAR hist_entry(HISTORY *hist, UCHAR index)
+{
+	UCHAR pos, n;
+
+	pos = hist->tail;
+	for(n=hist->count-1-index;n;n--)
+		pos = hist_wrap(pos + hist->ring[pos]);
+	return(pos);
+}
+//********************************************************************
+
+//********************************************************************
+//Returns the key at position depth of the entry at ring position pos, or -1 if the
+//  entry is shorter (a shorter entry sorts before the longer ones).
+static int hist_key(HISTORY *hist, UCHAR pos, UCHAR depth)
+{
+	if(depth >= hist->ring[hist_wrap(pos + 2)])
+		return(-1);
+	return(hist->ring[hist_wrap(pos + HISTORY_HEADER + depth)]);
+}
+//********************************************************************
+
+//********************************************************************
+//Returns the first i in lo..hi-1 whose entry has a key >= key at depth (hi if none).
+//The entries index[lo..hi-1] must have the same first depth keys.
+static UCHAR hist_lower(HISTORY *hist, UCHAR lo, UCHAR hi, UCHAR depth, int key)
+{
+	UCHAR mid;
+
+	while(lo < hi)
+	{
+		mid = (lo + hi) >> 1;
+		if(hist_key(hist, hist->index[mid], depth) < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return(lo);
+}
+//********************************************************************
+
+//********************************************************************
+//Adds the entry at ring position pos (holding the keys of formula) to the index.
+static void hist_index_add(HISTORY *hist, UCHAR pos, GAP_BUFFER *formula)
+{
+	UCHAR lo, hi, depth, len;
+
+	//Narrow down to the entries starting with the keys of formula; it goes after the
+	//  equal ones and before the longer ones
+	lo = 0;
+	hi = hist->count;
+	len = gap_len(formula);
+	for(depth=0;(depth<len) && (lo<hi);depth++)
+	{
+		lo = hist_lower(hist, lo, hi, depth, gap_at(formula, depth));
+		hi = hist_lower(hist, lo, hi, depth, gap_at(formula, depth) + 1);
+	}
+	lo = hist_lower(hist, lo, hi, depth, 0);
+	memmove(&hist->index[lo + 1], &hist->index[lo], hist->count - lo);
+	hist->index[lo] = pos;
+}
+//********************************************************************
+
+//********************************************************************
+//Removes the entry at ring position pos from the index.
+static void hist_index_remove(HISTORY *hist, UCHAR pos)
+{
+	UCHAR i;
+
+	for(i=0;hist->index[i]!=pos;i++)
+		;
+	memmove(&hist->index[i], &hist->index[i + 1], hist->count - i - 1);
+}
+//********************************************************************
+
+//********************************************************************
+//Returns True if the newest entry holds the keys of formula.
+static BOOLEAN hist_same(HISTORY *hist, GAP_BUFFER *formula)
+{
+	UCHAR pos, len, key, i;
+
+	if(hist->count == 0)
+		return(False);
+	pos = hist_wrap(hist_entry(hist, 0) + 2);
+	pos = hist_get(hist, pos, &len, 1);
+	if(len != gap_len(formula))
+		return(False);
+	for(i=0;i<len;i++)
+	{
+		pos = hist_get(hist, pos, &key, 1);
+		if(key != gap_at(formula, i))
+			return(False);
+	}
+	return(True);
+}
+//********************************************************************
+
+//********************************************************************
+//Removes all entries.
+void history_clear(HISTORY *hist)
+{
+	hist->tail = 0;
+	hist->used = 0;
+	hist->count = 0;
+}
+//********************************************************************
+
+//********************************************************************
+//Adds the formula evaluated last, with its result and the program compiled in ctx.
+//The same formula as the newest entry replaces it. Nothing is added if the keys do
+//  not fit in the ring; the program is left out if only the keys fit.
+void history_add(HISTORY *hist, GAP_BUFFER *formula, PARSER_CONTEXT *ctx, NUMBER result)
+{
+	UINT size;
+	UCHAR pos, flags, len, key, i;
+
+	len = gap_len(formula);
+	size = HISTORY_HEADER + len;
+	flags = 0;
+#if HISTORY_PROGRAMS
+	if(size + sizeof(NUMBER) + 2 + ctx->prog_len + ctx->const_len * sizeof(NUMBER) <= HISTORY_BYTES)
+	{
+		size += sizeof(NUMBER) + 2 + ctx->prog_len + ctx->const_len * sizeof(NUMBER);
+		flags = HISTORY_PROGRAM;
+	}
+#endif
+	if(size > HISTORY_BYTES)
+		return;
+
+	if(hist_same(hist, formula))
+	{
+		pos = hist_entry(hist, 0);
+		hist_index_remove(hist, pos);
+		hist->used -= hist->ring[pos];
+		hist->count--;
+	}
+	//Drop the oldest entries
+	while(hist->used + size > HISTORY_BYTES)
+	{
+		hist_index_remove(hist, hist->tail);
+		i = hist->ring[hist->tail];
+		hist->tail = hist_wrap(hist->tail + i);
+		hist->used -= i;
+		hist->count--;
+	}
+
+	pos = hist_wrap(hist->tail + hist->used);
+	hist_index_add(hist, pos, formula);
+	i = size;
+	pos = hist_put(hist, pos, &i, 1);
+	pos = hist_put(hist, pos, &flags, 1);
+	pos = hist_put(hist, pos, &len, 1);
+	for(i=0;i<len;i++)
+	{
+		key = gap_at(formula, i);
+		pos = hist_put(hist, pos, &key, 1);
+	}
+#if HISTORY_PROGRAMS
+	if(size > HISTORY_HEADER + len)
+	{
+		pos = hist_put(hist, pos, &result, sizeof(NUMBER));
+		len = ctx->prog_len;
+		pos = hist_put(hist, pos, &len, 1);
+		pos = hist_put(hist, pos, ctx->prog_ops, len);
+		len = ctx->const_len;
+		pos = hist_put(hist, pos, &len, 1);
+		for(i=0;i<len;i++)
+			pos = hist_put(hist, pos, &ctx->prog_consts[i], sizeof(NUMBER));
+	}
+#endif
+	hist->used += size;
+	hist->count++;
+}
+//********************************************************************
+
+//********************************************************************
+//Copies the keys of an entry (index < count, 0 = newest) to formula.
+//Returns True and sets *result if the entry holds the result.
+BOOLEAN history_recall(HISTORY *hist, UCHAR index, GAP_BUFFER *formula, NUMBER *result)
+{
+	UCHAR pos, flags, len, key, i;
+
+	pos = hist_wrap(hist_entry(hist, index) + 1);
+	pos = hist_get(hist, pos, &flags, 1);
+	pos = hist_get(hist, pos, &len, 1);
+	gap_clear(formula);
+	for(i=0;i<len;i++)
+	{
+		pos = hist_get(hist, pos, &key, 1);
+		gap_insert(formula, i, key);
+	}
+	if(!(flags & HISTORY_PROGRAM))
+		return(False);
+	hist_get(hist, pos, result, sizeof(NUMBER));
+	return(True);
+}
+//********************************************************************
+
+//********************************************************************
+//Loads the compiled program of an entry into ctx, as parser_compile would.
+//Returns False if index is not an entry (e.g. HISTORY_NONE) or the entry has no
+//  program.
+BOOLEAN history_program(HISTORY *hist, UCHAR index, PARSER_CONTEXT *ctx)
+{
+	UCHAR pos, flags, len, i;
+
+	if(index >= hist->count)
+		return(False);
+	pos = hist_wrap(hist_entry(hist, index) + 1);
+	pos = hist_get(hist, pos, &flags, 1);
+	if(!(flags & HISTORY_PROGRAM))
+		return(False);
+	pos = hist_get(hist, pos, &len, 1);
+	pos = hist_wrap(pos + len + sizeof(NUMBER));
+	pos = hist_get(hist, pos, &len, 1);
+	pos = hist_get(hist, pos, ctx->prog_ops, len);
+	ctx->prog_len = len;
+	pos = hist_get(hist, pos, &len, 1);
+	for(i=0;i<len;i++)
+		pos = hist_get(hist, pos, &ctx->prog_consts[i], sizeof(NUMBER));
+	ctx->const_len = len;
+	return(True);
+}
+//********************************************************************
+
+//********************************************************************
+//Starts a prefix search: every entry matches the empty prefix.
+void history_match_start(HISTORY *hist, HISTORY_MATCH *match)
+{
+	match->lo = 0;
+	match->hi = hist->count;
+	match->depth = 0;
+}
+//********************************************************************
+
+//********************************************************************
+//Narrows a prefix search to the entries whose next key is key.
+void history_match_key(HISTORY *hist, HISTORY_MATCH *match, UCHAR key)
+{
+	match->lo = hist_lower(hist, match->lo, match->hi, match->depth, key);
+	match->hi = hist_lower(hist, match->lo, match->hi, match->depth, key + 1);
+	match->depth++;
+}
+//********************************************************************
+
+//********************************************************************
+//Returns the entry index (0 = newest) of the matching entry n (n < hi - lo).
+UCHAR history_match_get(HISTORY *hist, HISTORY_MATCH *match, UCHAR n)
+{
+	UCHAR pos, target, index;
+
+	target = hist->index[match->lo + n];
+	pos = hist->tail;
+	for(index=hist->count-1;pos!=target;index--)
+		pos = hist_wrap(pos + hist->ring[pos]);
+	return(index);
+}
+//********************************************************************
@@ -0,0 +1,54 @@
+//history.h : header file for the AVRCalculator formula history
+//
+
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+#include "types.h"
+#include "membudget.h"
+#include "gapbuf.h"
+#include "parser.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//Formula history
+//
+//Notes:
+//  1) The entries are stored back to back in a byte ring; the oldest entries are
+//    dropped when a new one does not fit. Index 0 is the newest entry.
+//  2) An entry holds the key codes of the formula. With HISTORY_PROGRAMS (membudget.h)
+//    it also holds the last result and the compiled program, if they fit in the
+//    ring, so a recalled formula is evaluated again without compiling it.
+//  3) The program does not depend on Ans, Ran# or the angle base; they are read when
+//    it is evaluated.
+//  4) Prefix search: index[] holds the ring positions of the entries sorted by their
+//    keys, so the entries starting with the same keys are next to each other. A
+//    HISTORY_MATCH is the range of them that starts with the first depth keys typed;
+//    history_match_key narrows it by one more key with two binary searches inside the
+//    range. The range is only valid until the next history_add.
+
+#define HISTORY_NONE			0xFF
+
+typedef struct
+{
+	UCHAR ring[HISTORY_BYTES];
+	UCHAR tail;			//First byte of the oldest entry
+	UCHAR used;			//Bytes in use
+	UCHAR count;		//Entries
+	UCHAR index[HISTORY_MAX_ENTRIES];	//Ring positions of the entries sorted by keys
+} HISTORY;
+
+typedef struct
+{
+	UCHAR lo, hi;		//Matching entries: index[lo..hi-1]
+	UCHAR depth;		//Keys matched
+} HISTORY_MATCH;
+
+void history_clear(HISTORY *hist);
+void history_add(HISTORY *hist, GAP_BUFFER *formula, PARSER_CONTEXT *ctx, NUMBER result);
+BOOLEAN history_recall(HISTORY *hist, UCHAR index, GAP_BUFFER *formula, NUMBER *result);
+BOOLEAN history_program(HISTORY *hist, UCHAR index, PARSER_CONTEXT *ctx);
+void history_match_start(HISTORY *hist, HISTORY_MATCH *match);
+void history_match_key(HISTORY *hist, HISTORY_MATCH *match, UCHAR key);
+UCHAR history_match_get(HISTORY *hist, HISTORY_MATCH *match, UCHAR n);
+
+#endif
@@ -0,0 +1,12 @@
+//pgmspace.h : host stand-in for the AtmanAvr FLASH access macros (hosttest only)
+//
+
+#ifndef _HOST_PGMSPACE_H_
+#define _HOST_PGMSPACE_H_
+
+#include <string.h>
+
+#define FLASH					const
+#define memcpy_P			memcpy
+
+#endif
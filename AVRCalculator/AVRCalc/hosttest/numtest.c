@@ -0,0 +1,387 @@
+//************************************************************************//
+//   -- NUMBER CONVERSION HOST TEST --
+//Checks numfmt.c on the host (see Makefile): the shortest decimal of a float reads
+//  back as the same float, the result line layouts of the display modes, and the
+//  literal converter gives the float nearest to the typed digits (as strtof).
+//decfloat.c: literals, +, -, *, / and sqrt are rounded half to even to DEC_DIGITS digits and
+//  the result lines of floats and of DEC numbers read back as the same number.
+//The cycle counts are measured on the device only (diagnostics pages 7..9).
+//************************************************************************//
+
+//************************************************************************//
+//Include header files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "numfmt.h"
+#include "decfloat.h"
+//************************************************************************//
+
+//************************************************************************//
+//Definitions
+#define TEST_RANDOM_FLOATS		1000000
+#define TEST_STRIDE						0x0000F1A5UL		//Bits between the floats of the sweep
+
+static unsigned long test_failures;
+static unsigned long long test_seed = 88172645463325252ULL;
+//************************************************************************//
+
+//********************************************************************
+//xorshift64 random numbers
+static uint32_t test_random(void)
+{
+	test_seed ^= test_seed << 13;
+	test_seed ^= test_seed >> 7;
+	test_seed ^= test_seed << 17;
+	return((uint32_t) test_seed);
+}
+//********************************************************************
+
+//********************************************************************
+static void test_fail(const char *what, const char *detail)
+{
+	if(test_failures++ < 20)
+		printf("FAIL %s: %s\n", what, detail);
+}
+//********************************************************************
+
+//********************************************************************
+//The shortest decimal of f must read back as f (strtof) and have no more digits than
+//  the shortest %e that does.
+static void test_shortest(float f)
+{
+	FMT_DECIMAL dec;
+	char text[40];
+	float back;
+	uint32_t m;
+	int digits, n;
+
+	if(!fmt_decimal(f, &dec))
+		return;
+	sprintf(text, "%s%lue%d", dec.negative ? "-" : "", (unsigned long) dec.mantissa, dec.exponent);
+	back = strtof(text, NULL);
+	if(memcmp(&back, &f, sizeof(float)) != 0)
+	{
+		test_fail("round trip", text);
+		return;
+	}
+	for(digits = 0, m = dec.mantissa; m != 0; m /= 10)
+		digits++;
+	for(n = 1; n < digits; n++)
+	{
+		char shorter[40];
+
+		sprintf(shorter, "%.*e", n - 1, f);
+		if(strtof(shorter, NULL) == f)
+		{
+			test_fail("not shortest", text);
+			return;
+		}
+	}
+}
+//********************************************************************
+
+//********************************************************************
+static void test_layout(double value, UCHAR mode, UCHAR digits, const char *expected)
+{
+	char line[FMT_WIDTH + 1];
+
+	fmt_number(value, mode, digits, line);
+	line[FMT_WIDTH] = 0;
+	if(strcmp(line, expected) != 0)
+		test_fail("layout", line);
+}
+//********************************************************************
+
+//********************************************************************
+static void test_formatter(void)
+{
+	union { float value; uint32_t bits; } x;
+	uint32_t i;
+
+	for(i = 0; i < TEST_RANDOM_FLOATS; i++)
+	{
+		x.bits = test_random();
+		test_shortest(x.value);
+	}
+	//Every exponent, denormals and the largest floats
+	for(x.bits = 1; x.bits < 0x7F800000UL - TEST_STRIDE; x.bits += TEST_STRIDE)
+		test_shortest(x.value);
+	for(i = 1; i < 100000; i++)
+	{
+		x.bits = i;
+		test_shortest(x.value);
+		test_shortest((float) i);
+		test_shortest(i / 1000.0f);
+	}
+
+	test_layout(0, FMT_AUTO, 0, "              0.");
+	test_layout(42, FMT_ENG, 3, "        42.0E+00");
+	test_layout(0.1f, FMT_AUTO, 0, "             0.1");
+	test_layout(0.1f, FMT_SCI, 4, "       1.000E-01");
+	test_layout(1 / 3.0f, FMT_AUTO, 0, "      0.33333334");
+	test_layout(-2 / 3.0f, FMT_FIX, 2, "           -0.67");
+	test_layout(1e10f, FMT_AUTO, 0, "           1E+10");
+	test_layout(-1e-30f, FMT_AUTO, 0, "          -1E-30");
+	test_layout(-0.001f, FMT_FIX, 2, "            0.00");
+	test_layout(999.9f, FMT_ENG, 3, "        1.00E+03");
+	test_layout(NAN, FMT_AUTO, 0, "             NaN");
+	test_layout(-INFINITY, FMT_SCI, 3, "            -Inf");
+}
+//********************************************************************
+
+//********************************************************************
+//Reads "digits[.digits][e[+-]digits]" into a FMT_LITERAL as the parser does.
+static void test_read_literal(const char *text, FMT_LITERAL *lit, int *exp10)
+{
+	BOOLEAN fraction = False, negative = False;
+
+	fmt_literal_start(lit);
+	*exp10 = 0;
+	for(; *text && *text != 'e'; text++)
+	{
+		if(*text == '.')
+			fraction = True;
+		else
+			fmt_literal_digit(lit, *text - '0', fraction);
+	}
+	if(*text == 'e')
+	{
+		if(*++text == '-' || *text == '+')
+			negative = (*text++ == '-');
+		for(; *text; text++)
+			if(*exp10 < 1000)
+				*exp10 = *exp10 * 10 + *text - '0';
+	}
+	if(negative)
+		*exp10 = -*exp10;
+}
+//********************************************************************
+
+//********************************************************************
+static void test_literal(const char *text)
+{
+	FMT_LITERAL lit;
+	int exp10;
+	float value, expected;
+
+	test_read_literal(text, &lit, &exp10);
+	value = fmt_literal_value(&lit, exp10);
+	expected = strtof(text, NULL);
+	if(memcmp(&value, &expected, sizeof(float)) != 0)
+		test_fail("literal", text);
+}
+//********************************************************************
+
+//********************************************************************
+static void test_literals(void)
+{
+	union { float value; uint32_t bits; } x;
+	FMT_DECIMAL dec;
+	char text[60];
+	uint32_t i;
+	int k, n, point;
+
+	//The shortest decimals of the formatter read back (fast path)
+	for(i = 0; i < TEST_RANDOM_FLOATS; i++)
+	{
+		x.bits = test_random() & 0x7F7FFFFFUL;
+		fmt_decimal(x.value, &dec);
+		sprintf(text, "%lue%d", (unsigned long) dec.mantissa, dec.exponent);
+		test_literal(text);
+	}
+	//Up to FMT_LITERAL_DIGITS random digits (slow path beyond FMT_MAX_DIGITS)
+	for(i = 0; i < TEST_RANDOM_FLOATS; i++)
+	{
+		n = 1 + test_random() % FMT_LITERAL_DIGITS;
+		point = test_random() % (n + 1);
+		for(k = 0; n > 0; n--)
+		{
+			if(k == point && k != 0)
+				text[k++] = '.', point = -1;
+			text[k++] = '0' + test_random() % 10;
+		}
+		sprintf(text + k, "e%d", (int) (test_random() % 100) - 60);
+		test_literal(text);
+	}
+	//Near halfway between two floats
+	for(i = 0; i < TEST_RANDOM_FLOATS / 4; i++)
+	{
+		double mid;
+
+		x.bits = test_random() & 0x7F7FFFFFUL;
+		mid = ((double) x.value + (double) nextafterf(x.value, INFINITY)) / 2;
+		sprintf(text, "%.16e", mid);
+		test_literal(text);
+	}
+	test_literal("0.1");
+	test_literal("16777217");
+	test_literal("340282356779733661637539395e12");
+	test_literal("1e39");
+	test_literal("1e-46");
+	test_literal("7.006492321624085e-46");
+	test_literal("1.4e-45");
+	test_literal("123456789012345678901234e-10");
+}
+//********************************************************************
+
+//********************************************************************
+//Reads a result line ("  -1.25E-03") into a FMT_LITERAL.
+static void test_read_line(char *line, FMT_LITERAL *lit, int *exp10, BOOLEAN *negative)
+{
+	char *e;
+
+	line[FMT_WIDTH] = 0;
+	while(*line == ' ')
+		line++;
+	*negative = (*line == '-');
+	if(*negative)
+		line++;
+	e = strchr(line, 'E');
+	if(e != NULL)
+		*e = 'e';
+	test_read_literal(line, lit, exp10);
+}
+//********************************************************************
+
+//********************************************************************
+static DEC test_dec(const char *text)
+{
+	FMT_LITERAL lit;
+	int exp10;
+
+	test_read_literal(text, &lit, &exp10);
+	return(dec_from_literal(&lit, exp10));
+}
+//********************************************************************
+
+//********************************************************************
+static void test_dec_equal(const char *what, DEC value, int64_t mantissa, int exponent)
+{
+	char text[60];
+
+	if(value.mantissa != mantissa || (mantissa != 0 && value.exponent != exponent))
+	{
+		sprintf(text, "%lld E%d", (long long) value.mantissa, value.exponent);
+		test_fail(what, text);
+	}
+}
+//********************************************************************
+
+//********************************************************************
+//The result must be the exact value rounded to DEC_DIGITS digits: within half a unit
+//  of the last digit (long double has more than DEC_DIGITS + 6 digits).
+static void test_dec_result(const char *what, DEC result, long double exact)
+{
+	long double value, unit;
+	char text[60];
+
+	if(result.exponent == DEC_SPECIAL || result.mantissa == 0)
+		return;
+	value = result.mantissa * powl(10, result.exponent);
+	unit = powl(10, result.exponent);
+	if(fabsl(value - exact) > 0.500001L * unit ||
+			llabs(result.mantissa) < 100000000000LL || llabs(result.mantissa) >= 1000000000000LL)
+	{
+		sprintf(text, "%lld E%d vs %.20Le", (long long) result.mantissa, result.exponent, exact);
+		test_fail(what, text);
+	}
+}
+//********************************************************************
+
+//********************************************************************
+static void test_decimal(void)
+{
+	union { float value; uint32_t bits; } x;
+	FMT_LITERAL lit;
+	BOOLEAN negative;
+	DEC a, b, back;
+	char line[FMT_WIDTH + 1];
+	long double la, lb;
+	float f;
+	uint32_t i;
+	int exp10;
+
+	//Literals: the first dropped digit decides, the ones after it only break a tie
+	test_dec_equal("literal", test_dec("1.000000000010001"), 100000000001LL, -11);
+	test_dec_equal("literal", test_dec("1.000000000014999"), 100000000001LL, -11);
+	test_dec_equal("literal", test_dec("1.000000000016"), 100000000002LL, -11);
+	test_dec_equal("literal", test_dec("1.0000000000150001"), 100000000002LL, -11);
+	test_dec_equal("literal", test_dec("1.000000000015"), 100000000002LL, -11);
+	test_dec_equal("literal", test_dec("1.000000000025"), 100000000002LL, -11);
+	test_dec_equal("literal", test_dec("1.0000000000250001"), 100000000003LL, -11);
+	test_dec_equal("literal", test_dec("999999999999.5"), 100000000000LL, 1);
+	test_dec_equal("literal", test_dec("0.000000000000000000000000012345"), 123450000000LL, -37);
+
+	//Decimal fractions are exact
+	test_dec_equal("0.1+0.2", dec_add(test_dec("0.1"), test_dec("0.2")), 300000000000LL, -12);
+	test_dec_equal("1-0.9", dec_sub(test_dec("1"), test_dec("0.9")), 100000000000LL, -12);
+	test_dec_equal("4.35*100", dec_mul(test_dec("4.35"), test_dec("100")), 435000000000LL, -9);
+	test_dec_equal("2/3", dec_div(test_dec("2"), test_dec("3")), 666666666667LL, -12);
+	test_dec_equal("1+5E-12", dec_add(test_dec("1"), test_dec("5e-12")), 100000000000LL, -11);
+	test_dec_equal("1E99*10", dec_mul(test_dec("1e99"), test_dec("10")), 1, DEC_SPECIAL);
+	test_dec_equal("0/0", dec_div(test_dec("0"), test_dec("0")), 0, DEC_SPECIAL);
+
+	//Square roots beyond the float range, correctly rounded
+	test_dec_equal("sqrt 2", dec_sqrt(test_dec("2")), 141421356237LL, -11);
+	test_dec_equal("sqrt 16", dec_sqrt(test_dec("16")), 400000000000LL, -11);
+	test_dec_equal("sqrt 0.25", dec_sqrt(test_dec("0.25")), 500000000000LL, -12);
+	test_dec_equal("sqrt 1E50", dec_sqrt(test_dec("1e50")), 100000000000LL, 14);
+	test_dec_equal("sqrt 1E-50", dec_sqrt(test_dec("1e-50")), 100000000000LL, -36);
+	test_dec_equal("sqrt 1E99", dec_sqrt(test_dec("1e99")), 316227766017LL, 38);
+	if(dec_float_range(test_dec("1e50")) || dec_float_range(test_dec("1e-50")) ||
+			!dec_float_range(test_dec("1e37")) || !dec_float_range(test_dec("1e-37")))
+		test_fail("float range", "1E50, 1E-50, 1E37, 1E-37");
+
+	for(i = 0; i < TEST_RANDOM_FLOATS; i++)
+	{
+		a.mantissa = 100000000000LL + ((uint64_t) test_random() * test_random()) % 900000000000ULL;
+		b.mantissa = 100000000000LL + ((uint64_t) test_random() * test_random()) % 900000000000ULL;
+		if(test_random() & 1)
+			a.mantissa = -a.mantissa;
+		if(test_random() & 1)
+			b.mantissa = -b.mantissa;
+		a.exponent = (int) (test_random() % 40) - 31;
+		b.exponent = (int) (test_random() % 40) - 31;
+		la = a.mantissa * powl(10, a.exponent);
+		lb = b.mantissa * powl(10, b.exponent);
+		test_dec_result("add", dec_add(a, b), la + lb);
+		test_dec_result("sub", dec_sub(a, b), la - lb);
+		test_dec_result("mul", dec_mul(a, b), la * lb);
+		test_dec_result("div", dec_div(a, b), la / lb);
+		b.exponent = (int) (test_random() % 198) - 110;
+		test_dec_result("sqrt", dec_sqrt(dec_abs(b)), sqrtl(fabsl(b.mantissa * powl(10, b.exponent))));
+
+		//All 12 digits are on the result line from 0.1 to 1E12
+		a.exponent = (int) (test_random() % 13) - 12;
+		dec_format(a, FMT_AUTO, 0, line);
+		test_read_line(line, &lit, &exp10, &negative);
+		back = dec_from_literal(&lit, exp10);
+		if(negative)
+			back = dec_neg(back);
+		test_dec_equal("DEC line", back, a.mantissa, a.exponent);
+
+		//A float line has at least FMT_MAX_DIGITS digits
+		x.bits = test_random() & 0xFF7FFFFFUL;
+		fmt_number(x.value, FMT_AUTO, 0, line);
+		test_read_line(line, &lit, &exp10, &negative);
+		f = fmt_literal_value(&lit, exp10);
+		if(negative)
+			f = -f;
+		if(f != x.value)
+			test_fail("float line", line);
+	}
+}
+//********************************************************************
+
+//********************************************************************
+int main(void)
+{
+	test_formatter();
+	test_literals();
+	test_decimal();
+	printf("%s: %lu failures\n", (test_failures == 0) ? "PASS" : "FAIL", test_failures);
+	return((test_failures == 0) ? 0 : 1);
+}
+//********************************************************************
@@ -0,0 +1,214 @@
+//************************************************************************//
+//   -- PARSER HOST TEST --
+//Checks parser.c on the host (see Makefile) with pools far larger than the device
+//  has: operator precedence, nesting up to the PARSER_STACK_DEPTH and
+//  PARSER_VALUE_DEPTH limits and an error one level past them, formulas of more than
+//  100000 keys and numbers of any length. Built for both number backends.
+//************************************************************************//
+
+//************************************************************************//
+//Include header files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "parser.h"
+#include "keytable.h"
+//************************************************************************//
+
+//************************************************************************//
+//Definitions
+#define TEST_LONG_KEYS				100000		//Least keys of the long formulas
+
+static unsigned long test_failures;
+static GAP_BUFFER test_formula;
+static PARSER_CONTEXT test_ctx;
+//************************************************************************//
+
+//********************************************************************
+static void test_fail(const char *what, const char *detail)
+{
+	if(test_failures++ < 20)
+		printf("FAIL %s: %s\n", what, detail);
+}
+//********************************************************************
+
+//********************************************************************
+//Appends the keys of a string count times to the formula. Digits, operators, '.', '('
+//  and ')' are their own key codes (keytable.h); 'e' is the E key.
+static void test_keys(const char *s, long count)
+{
+	const char *p;
+	UCHAR key;
+
+	while(count-- > 0)
+	{
+		for(p = s; *p; p++)
+		{
+			key = (*p == 'e') ? BUTTON_E : (UCHAR) *p;
+			if(!gap_insert(&test_formula, gap_len(&test_formula), key))
+			{
+				printf("FORMULA_MAX_LEN too small\n");
+				exit(1);
+			}
+		}
+	}
+}
+//********************************************************************
+
+//********************************************************************
+//Compiles and evaluates the formula. ok tells whether it must succeed; then its
+//  result must be expected to 6 significant digits.
+static void test_run(const char *what, BOOLEAN ok, double expected)
+{
+	NUMBER result;
+	double value;
+	char detail[80];
+
+	parser_context_init(&test_ctx);
+	if(!parser_init(&test_ctx, &test_formula, &result))
+	{
+		if(ok)
+		{
+			sprintf(detail, "error at key %d of %d", test_ctx.errpos, gap_len(&test_formula));
+			test_fail(what, detail);
+		}
+		return;
+	}
+	value = num_to_double(result);
+	if(!ok)
+		test_fail(what, "no error");
+	else if(fabs(value - expected) > fabs(expected) * 1E-6)
+	{
+		sprintf(detail, "%.9g instead of %.9g", value, expected);
+		test_fail(what, detail);
+	}
+}
+//********************************************************************
+
+//********************************************************************
+//Runs a formula given as a string.
+static void test_formula_is(const char *s, BOOLEAN ok, double expected)
+{
+	gap_clear(&test_formula);
+	test_keys(s, 1);
+	test_run(s, ok, expected);
+}
+//********************************************************************
+
+//********************************************************************
+//Precedence: unary minus binds weaker than ^, all operators are left associative.
+static void test_precedence(void)
+{
+	test_formula_is("-2^2", True, -4);
+	test_formula_is("(-2)^2", True, 4);
+	test_formula_is("2^-2", True, 0.25);
+	test_formula_is("-2*3", True, -6);
+	test_formula_is("2+3*4", True, 14);
+	test_formula_is("2*3^2", True, 18);
+	test_formula_is("(2+3)*4", True, 20);
+	test_formula_is("2-3-4", True, -5);
+	test_formula_is("8/2/2", True, 2);
+	test_formula_is("2^3^2", True, 64);
+	test_formula_is("--3", True, 3);
+	test_formula_is("2*", False, 0);
+	test_formula_is("(2", False, 0);
+	test_formula_is("2)", False, 0);
+}
+//********************************************************************
+
+//********************************************************************
+//Nesting: every parenthesis takes one op_stack entry and every pending number of
+//  1+(1+(...)) one val_stack entry; one level more than the pool is an error.
+static void test_nesting(void)
+{
+	long depth;
+
+	depth = PARSER_STACK_DEPTH;
+	gap_clear(&test_formula);
+	test_keys("(", depth);
+	test_keys("7", 1);
+	test_keys(")", depth);
+	test_run("parentheses at PARSER_STACK_DEPTH", True, 7);
+	gap_clear(&test_formula);
+	test_keys("(", depth + 1);
+	test_keys("7", 1);
+	test_keys(")", depth + 1);
+	test_run("parentheses past PARSER_STACK_DEPTH", False, 0);
+
+	//1+(1+(...(1)...)) needs 2 op_stack entries per level
+	depth = PARSER_VALUE_DEPTH;
+	if(2 * depth > PARSER_STACK_DEPTH)
+		depth = PARSER_STACK_DEPTH / 2;
+	gap_clear(&test_formula);
+	test_keys("1+(", depth - 1);
+	test_keys("1", 1);
+	test_keys(")", depth - 1);
+	test_run("pending values at PARSER_VALUE_DEPTH", True, depth);
+	if(depth == PARSER_VALUE_DEPTH)
+	{
+		gap_clear(&test_formula);
+		test_keys("1+(", depth);
+		test_keys("1", 1);
+		test_keys(")", depth);
+		test_run("pending values past PARSER_VALUE_DEPTH", False, 0);
+	}
+}
+//********************************************************************
+
+//********************************************************************
+//Formulas of more than TEST_LONG_KEYS keys.
+static void test_long(void)
+{
+	long n;
+
+	n = TEST_LONG_KEYS / 2 + 1;
+	gap_clear(&test_formula);
+	test_keys("1", 1);
+	test_keys("+1", n - 1);
+	test_run("sum of 1s", True, n);
+
+	gap_clear(&test_formula);
+	test_keys("2", 1);
+	test_keys("*1-1+1", TEST_LONG_KEYS / 6 + 1);
+	test_run("mixed operators", True, 2);
+
+	n = TEST_LONG_KEYS / 4 + 1;
+	gap_clear(&test_formula);
+	test_keys("-(", n);
+	test_keys("5", 1);
+	test_keys(")", n);
+	test_run("nested negations", True, (n & 1) ? -5 : 5);
+}
+//********************************************************************
+
+//********************************************************************
+//Numbers of any length: digits beyond FMT_LITERAL_DIGITS only round.
+static void test_numbers(void)
+{
+	test_formula_is("0.000000000000000000000001", True, 1E-24);
+	test_formula_is("0.000000000000000000000000000000000000000000000000000000000123e50", True, 1.23E-8);
+	test_formula_is("1234567890123456789012345678901234567890e-30", True, 1234567890.123456789);
+	test_formula_is("1.00000000000000000000000000000000000000000000000000000000001", True, 1);
+	test_formula_is("1.2.3", False, 0);
+	test_formula_is("1e", False, 0);
+
+	gap_clear(&test_formula);
+	test_keys("3", 1);
+	test_keys("0", 999);
+	test_keys("e-999", 1);
+	test_run("1000 digits", True, 3);
+}
+//********************************************************************
+
+//********************************************************************
+int main(void)
+{
+	test_precedence();
+	test_nesting();
+	test_long();
+	test_numbers();
+	printf("%s: %lu failures\n", (test_failures == 0) ? "PASS" : "FAIL", test_failures);
+	return((test_failures == 0) ? 0 : 1);
+}
+//********************************************************************
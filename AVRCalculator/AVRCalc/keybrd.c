@@ -7,25 +7,35 @@
 //  Keyboard rows:    P4..P7 is Row0..3
 //
 //Notes:
-//  1) _KBD_CPU_CLOCK_FREQ_
-//    Define cpu clock frequency in KHz for correct debounce time delays
-//  2) _KBD_IOINIT_ALWAYS_
+//  1) _KBD_IOINIT_ALWAYS_
 //    Change to 1 to automatically set pin directions in call to any of the keyboard routines.
 //    If defined as 1, no kbd_init function is required.
 //This module can be used for any number of keyboards connected to AVR because it
 //  receives the keyboard port address as a parameter.
+//
+//Scanning and debouncing (two keyboards):
+//  kbd_scan_pair reads all 32 keys of two keyboards in one pass without waiting: each
+//  row is grounded on both ports at the same time. The result is a key bitmap with
+//  bit (row * 8 + keyboard * 4 + column) set for every pressed key, so any number of
+//  keys can be held (n-key rollover).
+//  kbd_debounce is called with that bitmap once per timer tick. All 32 keys are
+//  debounced in parallel with 2 bit vertical counters: a key changes state after 4
+//  consecutive scans that differ from its debounced state. Every change is put in a
+//  FIFO which the foreground reads with kbd_event_get.
+//  Chords: a press event has KBD_EVENT_CHORD set if the modifier key (kbd_set_modifier)
+//  was held at the same time. kbd_keys_down returns the debounced bitmap.
 //************************************************************************//
 
 //************************************************************************//
 //Include header files
-#include <delay.h>
+#include <io.h>
+#include <Interrupt.h>
+#include "types.h"
+#include "keybrd.h"
 //************************************************************************//
 
 //************************************************************************//
 //Definitions
-//Define cpu clock frequency in KHz for correct debounce time delays
-#define _KBD_CPU_CLOCK_FREQ_ 8000  //KHz
-
 //Change to 1 to automatically set pin directions in call to any of the keyboard routines
 #define _KBD_IOINIT_ALWAYS_		0
 
@@ -49,78 +59,141 @@ void kbd_init(volatile unsigned char *kbdport)
 //********************************************************************
 
 //********************************************************************
-int kbd_hit(volatile unsigned char *kbdport)
+unsigned long kbd_scan_pair(volatile unsigned char *kbdport1, volatile unsigned char *kbdport2)
 {
-  //Return value:  0  =  no key is available
-  //               >0 = a key is available
+  //Return value: bit (row * 8 + keyboard * 4 + column) is set if the key is pressed
+  //  (keyboard is 0 for kbdport1 and 1 for kbdport2)
+  unsigned long keys = 0;
+  unsigned char row_index, row_code;
 
-  #if _KBD_IO_INIT_ALWAYS_ != 0
-	  kbd_init(kbdport);
+  #if _KBD_IOINIT_ALWAYS_ != 0
+	  kbd_init(kbdport1);
+	  kbd_init(kbdport2);
   #endif
 
-  KBD_PORT = 0x0F;  //Ground all rows
-  if((KBD_PIN & 0x0F)==0x0F)
-  {
-    return(0);
-  }
-  else
+  for(row_index=4;row_index>0;row_index--)
   {
-    return(1);
+    *kbdport1=~(1<<(row_index+3));  //Ground one row, keep column pull-ups
+    *kbdport2=~(1<<(row_index+3));
+    __asm volatile ("nop");  //Wait for the input synchronizer
+    row_code=(*(kbdport1 - 2) & 0x0F) | (*(kbdport2 - 2) << 4);
+    keys=(keys << 8) | (unsigned char) ~row_code;
   }
+  *kbdport1 = 0x0F;  //Ground all rows
+  *kbdport2 = 0x0F;
+  return(keys);
 }
 //********************************************************************
 
 //********************************************************************
-void kbd_readkey(volatile unsigned char *kbdport,
-					unsigned char *row, unsigned char *col)
+//Debounce state and event FIFO
+static unsigned long kbd_state = 0;
+static unsigned long kbd_count0 = 0xFFFFFFFF, kbd_count1 = 0xFFFFFFFF;  //Vertical counters (bit n of count1:count0)
+static unsigned char kbd_modifier = KBD_NO_KEY;
+static unsigned char kbd_fifo[KBD_FIFO_LEN];
+static volatile unsigned char kbd_fifo_head = 0, kbd_fifo_tail = 0;
+//********************************************************************
+
+//********************************************************************
+void kbd_set_modifier(unsigned char key)
 {
-  unsigned char col_code;
-	unsigned char row_index, col_index;
+  //Sets the key whose presses are reported as chords (KBD_NO_KEY for none)
+  kbd_modifier = key;
+}
+//********************************************************************
 
-	#if _KBD_IO_INIT_ALWAYS_ != 0
-	  kbd_init(kbdport);
-  #endif
+//********************************************************************
+int kbd_debounce(unsigned long keys)
+{
+  //Called from the timer interrupt with the key bitmap of kbd_scan_pair.
+  //Puts key (pressed) or key | KBD_EVENT_RELEASE (released) in the FIFO when the
+  //  debounced state changes. Events are dropped if the FIFO is full.
+  //Return value:  0  =  no key press event was queued
+  //               >0 = at least one key press event was queued
+  unsigned long changed;
+  unsigned char key, event, head;
+  BOOLEAN chord;
+  int pressed = 0;
 
-  while(1)
-  {
-    //while( (KBD_PIN & 0x0F)!=0x0F );  //Check till all keys released
-    //delay(20, _KBD_CPU_CLOCK_FREQ_);
-  
-    while(!kbd_hit(kbdport));
-    delay(20, _KBD_CPU_CLOCK_FREQ_);  //Wait 20 msec debounce time
+  //Count down the keys that differ from their debounced state, reset the others
+  changed = kbd_state ^ keys;
+  kbd_count0 = ~(kbd_count0 & changed);
+  kbd_count1 = kbd_count0 ^ (kbd_count1 & changed);
+  changed &= kbd_count0 & kbd_count1;
+  if(changed == 0)
+    return(0);
+  kbd_state ^= changed;
 
-    if(!kbd_hit(kbdport))
-    {
+  chord = (kbd_modifier != KBD_NO_KEY) && (kbd_state & (1UL << kbd_modifier));
+  for(key=0;changed!=0;key++,changed>>=1)
+  {
+    if(!(changed & 1))
       continue;
-    }
-    
-    //Find key row
-    row_index=0;
-    do
+    if(kbd_state & (1UL << key))
     {
-      KBD_PORT=~(1<<(row_index+4));
-      col_code=KBD_PIN & 0x0F;
-      row_index++;
-    } while(col_code==0x0F && row_index<4);
-		row_index--;
-    
-    if(row_index>=4)
-    {
-      continue;
+      event = key;
+      if(chord && (key != kbd_modifier))
+        event |= KBD_EVENT_CHORD;
+      pressed = 1;
     }
-    
-    col_code=(~col_code) & 0x0F;
-    col_index=0;
-    while(col_code != 0x00)
+    else
+      event = key | KBD_EVENT_RELEASE;
+
+    head = (kbd_fifo_head + 1) % KBD_FIFO_LEN;
+    if(head != kbd_fifo_tail)
     {
-      col_code>>=1;
-      col_index++;
+      kbd_fifo[kbd_fifo_head] = event;
+      kbd_fifo_head = head;
     }
-    col_index--;
+  }
+  return(pressed);
+}
+//********************************************************************
+
+//********************************************************************
+unsigned long kbd_keys_down(void)
+{
+  //Return value: debounced key bitmap (same bits as kbd_scan_pair)
+  unsigned long keys;
+  unsigned char sreg = SREG;
+
+  cli();
+  keys = kbd_state;
+  SREG = sreg;
+  return(keys);
+}
+//********************************************************************
+
+//********************************************************************
+int kbd_event_get(unsigned char *event)
+{
+  //Return value:  0  =  no event is available
+  //               >0 = *event is the oldest key event
+  if(kbd_fifo_tail == kbd_fifo_head)
+  {
+    return(0);
+  }
+  *event = kbd_fifo[kbd_fifo_tail];
+  kbd_fifo_tail = (kbd_fifo_tail + 1) % KBD_FIFO_LEN;
+  return(1);
+}
+//********************************************************************
 
-		*row = row_index;
-		*col = col_index;
-		return;
-  }  
+//********************************************************************
+int kbd_press_pending(void)
+{
+  //Return value:  0  =  no key press event is waiting
+  //               >0 = a key press event is waiting (release events are ignored)
+  //Cheap enough to be polled by long foreground work that must give way to keys.
+  unsigned char i;
+
+  for(i = kbd_fifo_tail; i != kbd_fifo_head; i = (i + 1) % KBD_FIFO_LEN)
+  {
+    if(!(kbd_fifo[i] & KBD_EVENT_RELEASE))
+    {
+      return(1);
+    }
+  }
+  return(0);
 }
 //********************************************************************
@@ -1,5 +1,28 @@
+//keybrd.h : header file for the keyboard routines
+//
+
+#ifndef _KEYBRD_H_
+#define _KEYBRD_H_
+
+//Number of keys of the two keyboards read by kbd_scan_pair
+#define KBD_KEYS						32
+//Key event FIFO length (type-ahead)
+#define KBD_FIFO_LEN				16
+//Set in a key event if the key was released
+#define KBD_EVENT_RELEASE		0x80
+//Set in a key press event if the modifier key was held (chord)
+#define KBD_EVENT_CHORD			0x40
+//Key number of a key event
+#define KBD_EVENT_KEY				0x1F
+//No modifier key
+#define KBD_NO_KEY					0xFF
 
 void kbd_init(volatile unsigned char *kbdport);
-int kbd_hit(volatile unsigned char *kbdport);
-void kbd_readkey(volatile unsigned char *kbdport,
-					unsigned char *row, unsigned char *col);
+unsigned long kbd_scan_pair(volatile unsigned char *kbdport1, volatile unsigned char *kbdport2);
+void kbd_set_modifier(unsigned char key);
+int kbd_debounce(unsigned long keys);
+unsigned long kbd_keys_down(void);
+int kbd_event_get(unsigned char *event);
+int kbd_press_pending(void);
+
+#endif
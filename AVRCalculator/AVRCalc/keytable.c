@@ -0,0 +1,119 @@
+//************************************************************************//
+//   -- KEY TABLE MODULE --
+//Key descriptor table for AVRCalculator
+//
+//KEY_LIST is the only place where the formula keys are described. The glyph string
+//  pool and the 256 entry key_table are generated from it by the compiler:
+//  every key gets a char array member in KEY_GLYPH_POOL sized to its string, so
+//  offsetof() gives its offset in the pool and the strings are stored back to back
+//  without padding.
+//Notes:
+//  1) A char array initialized with a string literal of the same length does not
+//    store the terminating 0, so the pool contains no 0 bytes at all.
+//  2) Glyph bytes above 0x7F and below 0x08 are HD44780 ROM and custom characters.
+//************************************************************************//
+
+//************************************************************************//
+//Include header files
+#include <stddef.h>
+#include <string.h>
+#include <pgmspace.h>
+#include "keytable.h"
+#include "parser.h"
+//************************************************************************//
+
+//************************************************************************//
+//Formula keys
+//KEY(key code, member name, LCD glyph, parser opcode)
+#define KEY_LIST(KEY) \
+	KEY(NUMBER_0,					k_0,				"0",						OP_NUMBER) \
+	KEY(NUMBER_1,					k_1,				"1",						OP_NUMBER) \
+	KEY(NUMBER_2,					k_2,				"2",						OP_NUMBER) \
+	KEY(NUMBER_3,					k_3,				"3",						OP_NUMBER) \
+	KEY(NUMBER_4,					k_4,				"4",						OP_NUMBER) \
+	KEY(NUMBER_5,					k_5,				"5",						OP_NUMBER) \
+	KEY(NUMBER_6,					k_6,				"6",						OP_NUMBER) \
+	KEY(NUMBER_7,					k_7,				"7",						OP_NUMBER) \
+	KEY(NUMBER_8,					k_8,				"8",						OP_NUMBER) \
+	KEY(NUMBER_9,					k_9,				"9",						OP_NUMBER) \
+	KEY(BUTTON_PERIOD,		k_period,		".",						OP_NUMBER) \
+	KEY(BUTTON_E,					k_e,				"E",						OP_NUMBER) \
+	KEY(CONSTANT_PI,			k_pi,				"\xB6",					OP_NUMBER) \
+	KEY(OPERATOR_PLUS,		k_plus,			"+",						OP_PLUS) \
+	KEY(OPERATOR_MINUS,		k_minus,		"-",						OP_MINUS) \
+	KEY(OPERATOR_MUL,			k_mul,			"\x78",					OP_MUL) \
+	KEY(OPERATOR_DIV,			k_div,			"\xFD",					OP_DIV) \
+	KEY(OPERATOR_POWER,		k_power,		"^",						OP_POWER) \
+	KEY(BUTTON_LPAREN,		k_lparen,		"(",						OP_LPAREN) \
+	KEY(BUTTON_RPAREN,		k_rparen,		")",						OP_RPAREN) \
+	KEY(FUNCTION_SQRT,		k_sqrt,			"\xE8(",				OP_SQRT) \
+	KEY(FUNCTION_LN,			k_ln,				"Ln(",					OP_LN) \
+	KEY(FUNCTION_LOG,			k_log,			"log(",					OP_LOG) \
+	KEY(FUNCTION_EXP,			k_exp,			"exp(",					OP_EXP) \
+	KEY(FUNCTION_SIN,			k_sin,			"sin(",					OP_SIN) \
+	KEY(FUNCTION_COS,			k_cos,			"cos(",					OP_COS) \
+	KEY(FUNCTION_TAN,			k_tan,			"tan(",					OP_TAN) \
+	KEY(FUNCTION_ARCSIN,	k_arcsin,		"sin\x05(",			OP_ARCSIN) \
+	KEY(FUNCTION_ARCCOS,	k_arccos,		"cos\x05(",			OP_ARCCOS) \
+	KEY(FUNCTION_ARCTAN,	k_arctan,		"tan\x05(",			OP_ARCTAN) \
+	KEY(FUNCTION_SINH,		k_sinh,			"sinh(",				OP_SINH) \
+	KEY(FUNCTION_COSH,		k_cosh,			"cosh(",				OP_COSH) \
+	KEY(FUNCTION_TANH,		k_tanh,			"tanh(",				OP_TANH) \
+	KEY(FUNCTION_ARCSINH,	k_arcsinh,	"sinh\x05(",		OP_ARCSINH) \
+	KEY(FUNCTION_ARCCOSH,	k_arccosh,	"cosh\x05(",		OP_ARCCOSH) \
+	KEY(FUNCTION_ARCTANH,	k_arctanh,	"tanh\x05(",		OP_ARCTANH) \
+	KEY(FUNCTION_RAN,			k_ran,			"Ran#",					OP_RAND) \
+	KEY(VARIABLE_ANS,			k_ans,			"Ans",					OP_ANS)
+//************************************************************************//
+
+//************************************************************************//
+//Generated string pool and index
+
+#define KEY_GLYPH_MEMBER(code, name, glyph, opcode)	char name[sizeof(glyph) - 1];
+#define KEY_GLYPH_INIT(code, name, glyph, opcode)		glyph,
+#define KEY_DESC_INIT(code, name, glyph, opcode) \
+	[code] = {offsetof(KEY_GLYPH_POOL, name), sizeof(glyph) - 1, opcode},
+
+typedef struct
+{
+	KEY_LIST(KEY_GLYPH_MEMBER)
+} KEY_GLYPH_POOL;
+
+//Offsets are stored in one byte
+typedef char KEY_POOL_CHECK[(sizeof(KEY_GLYPH_POOL) <= 256) ? 1 : -1];
+
+FLASH KEY_GLYPH_POOL key_glyph_pool = {
+	KEY_LIST(KEY_GLYPH_INIT)
+};
+
+FLASH KEY_DESC key_table[256] = {
+	KEY_LIST(KEY_DESC_INIT)
+};
+//************************************************************************//
+
+//********************************************************************
+//Reads the descriptor of a key code from FLASH.
+void key_lookup(UCHAR code, KEY_DESC *desc)
+{
+	memcpy_P(desc, &key_table[code], sizeof(KEY_DESC));
+}
+//********************************************************************
+
+//********************************************************************
+//Returns the number of LCD cells used by a key (0 if it is not a formula key).
+UCHAR key_glyph_len(UCHAR code)
+{
+	UCHAR len;
+
+	memcpy_P(&len, &key_table[code].glyph_len, 1);
+	return(len);
+}
+//********************************************************************
+
+//********************************************************************
+//Returns the FLASH address of the display string of a key.
+FLASH char *key_glyph_addr(KEY_DESC *desc)
+{
+	return((FLASH char *) &key_glyph_pool + desc->glyph_ofs);
+}
+//********************************************************************
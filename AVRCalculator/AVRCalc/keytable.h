@@ -0,0 +1,103 @@
+//keytable.h : header file for the AVRCalculator key codes and key descriptor table
+//
+
+#ifndef _KEYTABLE_H_
+#define _KEYTABLE_H_
+
+#include <pgmspace.h>
+#include "types.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//Key codes
+//Every button has a one byte key code. Formulas are stored as strings of key codes.
+
+////////////////////////////////////////////////////////////////////////////
+//All used buttons
+#define								BUTTON_UNDEFINED				0xFF
+//Numbers
+#define								NUMBER_0								'0'
+#define								NUMBER_1								'1'
+#define								NUMBER_2								'2'
+#define								NUMBER_3								'3'
+#define								NUMBER_4								'4'
+#define								NUMBER_5								'5'
+#define								NUMBER_6								'6'
+#define								NUMBER_7								'7'
+#define								NUMBER_8								'8'
+#define								NUMBER_9								'9'
+//Main operators
+#define								OPERATOR_PLUS						'+'
+#define								OPERATOR_MINUS					'-'
+#define								OPERATOR_MUL						'*'
+#define								OPERATOR_DIV						'/'
+//Other operators
+#define								OPERATOR_POWER					'^'
+//Function buttons
+  //Triangular functions
+#define								FUNCTION_SIN						0
+#define								FUNCTION_COS						1
+#define								FUNCTION_TAN						2
+#define								FUNCTION_ARCSIN					3
+#define								FUNCTION_ARCCOS					4
+#define								FUNCTION_ARCTAN					5
+#define								FUNCTION_SINH						6
+#define								FUNCTION_COSH						7
+#define								FUNCTION_TANH						8
+#define								FUNCTION_ARCSINH				9
+#define								FUNCTION_ARCCOSH				10
+#define								FUNCTION_ARCTANH				11
+  //Other functions
+#define								FUNCTION_LN							12
+#define								FUNCTION_LOG						13
+#define								FUNCTION_EXP						14
+#define								FUNCTION_RAN						15
+#define								FUNCTION_SQRT						16
+//Formula control buttons
+#define								FORMULA_LEFT						17
+#define								FORMULA_RIGHT						18
+#define								FORMULA_HOME						19
+#define								FORMULA_END							20
+#define								FORMULA_DEL							21
+#define								FORMULA_INS							22
+//Constants
+#define								CONSTANT_PI							23
+//Variables
+#define								VARIABLE_ANS						24
+//Other buttons
+#define								BUTTON_ON								25
+#define								BUTTON_OFF							26
+#define								BUTTON_SHIFT						27
+#define								BUTTON_E								28
+#define								BUTTON_PERIOD						'.'
+#define								BUTTON_DRG							29
+#define								BUTTON_HYP							30
+#define								BUTTON_DIAG							31
+#define								BUTTON_PREVIEW					32
+#define								BUTTON_WELCOME					33
+#define								BUTTON_HISTORY					34
+#define								BUTTON_FORMAT						35
+#define								BUTTON_LPAREN						'('
+#define								BUTTON_RPAREN						')'
+#define								BUTTON_EQUAL						'='
+
+/////////////////////////////////////////////////////////////////////////////
+//Key descriptor table
+//One FLASH entry per key code (256 entries) gives, in a single lookup, what the key
+//  shows on the LCD and the parser opcode (the parser reads the key codes directly).
+//Glyphs are stored back to back in a string pool without padding; an entry only
+//  holds the offset and length.
+//Keys that can not be part of a formula have glyph_len 0.
+
+typedef struct
+{
+	UCHAR glyph_ofs, glyph_len;		//Display string in key_glyph_pool
+	UCHAR opcode;									//Parser opcode (OP_NUMBER for the parts of a number)
+} KEY_DESC;
+
+extern FLASH KEY_DESC key_table[256];
+
+void key_lookup(UCHAR code, KEY_DESC *desc);
+UCHAR key_glyph_len(UCHAR code);
+FLASH char *key_glyph_addr(KEY_DESC *desc);
+
+#endif
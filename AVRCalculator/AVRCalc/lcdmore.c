@@ -1,13 +1,446 @@
-
 //************************************************************************//
 //LCD routines for AVRCalculator                                          //
 //These routines are not defined in LCD.H.
+//
+//All of them go through a shadow copy of the DDRAM (see lcdmore.h), so a refresh
+//  only costs the characters that really changed. The CGRAM manager does the same
+//  for custom characters.
+//
+//Output queue:
+//  After lcd_init (lcd.h) nothing writes to the LCD synchronously. Every command and
+//  data byte is put in a ring buffer and the Timer0 compare match ISR sends one byte
+//  per tick when the busy flag of the HD44780 is clear, so no worst case delays are
+//  used. The Timer0 interrupt is only enabled while the queue is not empty.
+//  Nothing waits for a full queue: the byte is dropped, the shadow is invalidated and
+//  no more output is queued until lcd_resync reports that the screen must be redrawn.
+//
+//LCD connection (4 bit mode, CodeVisionAVR lcd.h layout on PORTB):
+//  RS: P0, RW: P1, E: P2, D4..D7: P4..P7
 //************************************************************************//
 
+#include "AVRCalculator.h"
 #include <LCD.H>
+#include <string.h>
+#include <pgmspace.h>
 #include "types.h"
+#include "membudget.h"
 
 #include "lcdmore.h"
+#include "diag.h"
+#include "sched.h"
+
+//********************************************************************
+//Definitions
+#define LCD_PORT_OUT		PORTB
+#define LCD_PORT_DDR		DDRB
+#define LCD_PORT_IN			PINB
+#define LCD_RS					0
+#define LCD_RW					1
+#define LCD_E						2
+#define LCD_DATA_MASK		0xF0
+#define LCD_BUSY_FLAG		0x80
+
+//HD44780 commands
+#define LCD_CMD_CLEAR		0x01
+#define LCD_CMD_CGRAM		0x40
+#define LCD_CMD_DDRAM		0x80
+#define LCD_ROW1_ADDR		0x40
+
+#define LCD_QUEUE_MASK	(LCD_QUEUE_LEN - 1)
+
+//Compile time check: the queue index wraps with LCD_QUEUE_MASK
+typedef char LCD_QUEUE_CHECK[((LCD_QUEUE_LEN & LCD_QUEUE_MASK) == 0) ? 1 : -1];
+//********************************************************************
+
+//********************************************************************
+//Global variables
+char lcd_shadow[LCD_ROWS][LCD_COLS];
+unsigned long lcd_bus_writes = 0;
+
+//Rows of lcd_shadow that match the LCD (bit masks are 1 << row)
+static UCHAR lcd_shadow_valid = 0;
+//DDRAM address after the last queued byte (LCD_POS_UNKNOWN if unknown)
+static UCHAR lcd_cur_col = LCD_POS_UNKNOWN, lcd_cur_row = LCD_POS_UNKNOWN;
+//Last display control command (LCD_POS_UNKNOWN if not sent yet)
+static UCHAR lcd_disp_code = LCD_POS_UNKNOWN;
+//Output was dropped because the queue was full
+static BOOLEAN lcd_lost = False;
+
+//Glyph ID held by each CGRAM slot (LCD_GLYPH_NONE if empty), requests since it was
+//  last requested (0xFF if empty) and pinned slots (bit masks are 1 << slot)
+static UCHAR lcd_slot_glyph[LCD_CGRAM_SLOTS];
+static UCHAR lcd_slot_age[LCD_CGRAM_SLOTS];
+static UCHAR lcd_slot_pinned = 0;
+
+//Output queue: bytes and their RS bits (1 = data), written at head and sent from tail
+static UCHAR lcd_queue[LCD_QUEUE_LEN];
+static UCHAR lcd_queue_rs[LCD_QUEUE_LEN / 8];
+static volatile UCHAR lcd_queue_head = 0, lcd_queue_tail = 0;
+//********************************************************************
+
+//********************************************************************
+//Pulses the E line (at least 230ns high).
+static void lcd_strobe(void)
+{
+	LCD_PORT_OUT |= (1 << LCD_E);
+	__asm volatile ("nop\n    nop\n    nop");
+	LCD_PORT_OUT &= ~(1 << LCD_E);
+}
+//********************************************************************
+
+//********************************************************************
+//Reads the busy flag and address counter.
+static UCHAR lcd_read_status(void)
+{
+	UCHAR status;
+
+	LCD_PORT_DDR &= ~LCD_DATA_MASK;
+	LCD_PORT_OUT &= ~(LCD_DATA_MASK | (1 << LCD_RS));
+	LCD_PORT_OUT |= (1 << LCD_RW);
+
+	LCD_PORT_OUT |= (1 << LCD_E);
+	__asm volatile ("nop\n    nop\n    nop");
+	status = LCD_PORT_IN & LCD_DATA_MASK;
+	LCD_PORT_OUT &= ~(1 << LCD_E);
+	LCD_PORT_OUT |= (1 << LCD_E);
+	__asm volatile ("nop\n    nop\n    nop");
+	status |= (LCD_PORT_IN & LCD_DATA_MASK) >> 4;
+	LCD_PORT_OUT &= ~(1 << LCD_E);
+
+	LCD_PORT_OUT &= ~(1 << LCD_RW);
+	LCD_PORT_DDR |= LCD_DATA_MASK;
+	return(status);
+}
+//********************************************************************
+
+//********************************************************************
+//Sends one byte to the LCD as two nibbles.
+static void lcd_send(UCHAR byte, BOOLEAN data)
+{
+	if(data)
+		LCD_PORT_OUT |= (1 << LCD_RS);
+	else
+		LCD_PORT_OUT &= ~(1 << LCD_RS);
+	LCD_PORT_OUT = (LCD_PORT_OUT & ~LCD_DATA_MASK) | (byte & LCD_DATA_MASK);
+	lcd_strobe();
+	LCD_PORT_OUT = (LCD_PORT_OUT & ~LCD_DATA_MASK) | (byte << 4);
+	lcd_strobe();
+}
+//********************************************************************
+
+//********************************************************************
+//Sends the byte at the tail of the queue if the LCD is not busy (if wait is True,
+//  waits for the busy flag instead). Returns False if the queue is empty.
+static BOOLEAN lcd_queue_send(BOOLEAN wait)
+{
+	UCHAR tail = lcd_queue_tail;
+
+	if(tail == lcd_queue_head)
+		return(False);
+	while(lcd_read_status() & LCD_BUSY_FLAG)
+	{
+		if(!wait)
+			return(True);
+	}
+	lcd_send(lcd_queue[tail], (lcd_queue_rs[tail >> 3] & (1 << (tail & 7))) != 0);
+	lcd_queue_tail = (tail + 1) & LCD_QUEUE_MASK;
+	return(True);
+}
+//********************************************************************
+
+//********************************************************************
+//Interrupt Service Routine for Timer0 Compare Match:
+//  -- Send the next queued byte to the LCD if it is ready.
+//  -- Signal EV_LCD_READY when the queue became empty.
+ISR(SIG_OUTPUT_COMPARE0)
+{
+	DIAG_ISR_BEGIN();
+
+	lcd_queue_send(False);
+	if(lcd_queue_tail == lcd_queue_head)
+	{
+		TIMSK &= ~(1 << OCIE0);
+		sched_signal(EV_LCD_READY);
+	}
+
+	DIAG_ISR_END(DIAG_ISR_LCD);
+}
+//********************************************************************
+
+//********************************************************************
+//Adds a byte to the output queue. Returns False if output is lost: the queue is full
+//  (the shadow, the DDRAM address and the display control command are then forgotten)
+//  or was full since the last lcd_resync.
+static BOOLEAN lcd_enqueue(UCHAR byte, BOOLEAN data)
+{
+	UCHAR head, sreg;
+
+	if(lcd_lost)
+		return(False);
+	sreg = SREG;
+	cli();
+	head = lcd_queue_head;
+	if(((head + 1) & LCD_QUEUE_MASK) == lcd_queue_tail)
+	{
+		SREG = sreg;
+		lcd_lost = True;
+		lcd_shadow_invalidate();
+		lcd_disp_code = LCD_POS_UNKNOWN;
+		return(False);
+	}
+	lcd_queue[head] = byte;
+	if(data)
+		lcd_queue_rs[head >> 3] |= (1 << (head & 7));
+	else
+		lcd_queue_rs[head >> 3] &= ~(1 << (head & 7));
+	lcd_queue_head = (head + 1) & LCD_QUEUE_MASK;
+	lcd_bus_writes++;
+	TIMSK |= (1 << OCIE0);
+	SREG = sreg;
+	return(True);
+}
+//********************************************************************
+
+//********************************************************************
+//Takes over the LCD after lcd_init: all further output goes through the queue.
+void lcd_queue_init(void)
+{
+	LCD_PORT_DDR |= (1 << LCD_RS) | (1 << LCD_RW) | (1 << LCD_E) | LCD_DATA_MASK;
+	LCD_PORT_OUT &= ~((1 << LCD_RW) | (1 << LCD_E));
+	lcd_shadow_invalidate();
+}
+//********************************************************************
+
+//********************************************************************
+//Returns True if every queued byte has been sent (else EV_LCD_READY is signalled
+//  when the last one is sent).
+BOOLEAN lcd_queue_empty(void)
+{
+	return(lcd_queue_tail == lcd_queue_head);
+}
+//********************************************************************
+
+//********************************************************************
+//Returns True once when output was lost and the queue has been sent since: output is
+//  queued again and the caller must redraw the whole screen.
+BOOLEAN lcd_resync(void)
+{
+	if(!lcd_lost || (lcd_queue_tail != lcd_queue_head))
+		return(False);
+	lcd_lost = False;
+	return(True);
+}
+//********************************************************************
+
+//********************************************************************
+//Queues a command byte.
+void lcd_cmd(UCHAR cmd_code)
+{
+	lcd_enqueue(cmd_code, False);
+}
+//********************************************************************
+
+//********************************************************************
+//Forgets the shadow contents and the DDRAM address.
+void lcd_shadow_invalidate(void)
+{
+	lcd_shadow_valid = 0;
+	lcd_cur_col = LCD_POS_UNKNOWN;
+	lcd_cur_row = LCD_POS_UNKNOWN;
+}
+//********************************************************************
+
+//********************************************************************
+//Clears the LCD (and returns the display shift to 0).
+void lcd_cls(void)
+{
+	UCHAR row, col;
+
+	if(!lcd_enqueue(LCD_CMD_CLEAR, False))
+		return;
+	for(row=0;row<LCD_ROWS;row++)
+		for(col=0;col<LCD_COLS;col++)
+			lcd_shadow[row][col] = ' ';
+	lcd_shadow_valid = (1 << LCD_ROWS) - 1;
+	lcd_cur_col = 0;
+	lcd_cur_row = 0;
+}
+//********************************************************************
+
+//********************************************************************
+//Sets the DDRAM address unless it is already there.
+void lcd_moveto(UCHAR col, UCHAR row)
+{
+	if((col != lcd_cur_col) || (row != lcd_cur_row))
+	{
+		if(!lcd_enqueue(LCD_CMD_DDRAM | (row ? LCD_ROW1_ADDR : 0) | col, False))
+			return;
+		lcd_cur_col = col;
+		lcd_cur_row = row;
+	}
+}
+//********************************************************************
+
+//********************************************************************
+//Writes one character at the current DDRAM address and records it in the shadow.
+void lcd_write(char c)
+{
+	if(!lcd_enqueue(c, True))
+		return;
+	if(lcd_cur_col != LCD_POS_UNKNOWN)
+	{
+		if(lcd_cur_col < LCD_COLS)
+			lcd_shadow[lcd_cur_row][lcd_cur_col] = c;
+		lcd_cur_col++;
+	}
+}
+//********************************************************************
+
+//********************************************************************
+//Writes a string at the current DDRAM address.
+void lcd_print(char *s)
+{
+	while(*s)
+		lcd_write(*s++);
+}
+//********************************************************************
+
+//********************************************************************
+//Writes a FLASH string at the current DDRAM address.
+void lcd_print_P(FLASH char *s)
+{
+	char c;
+
+	memcpy_P(&c, s++, 1);
+	while(c != 0)
+	{
+		lcd_write(c);
+		memcpy_P(&c, s++, 1);
+	}
+}
+//********************************************************************
+
+//********************************************************************
+//Makes one LCD row show line[0..LCD_COLS-1], sending only the changed characters.
+void lcd_update_row(UCHAR row, char *line)
+{
+	UCHAR col;
+	BOOLEAN valid;
+
+	valid = (lcd_shadow_valid & (1 << row)) != 0;
+	for(col=0;col<LCD_COLS;col++)
+	{
+		if(!valid || (line[col] != lcd_shadow[row][col]))
+		{
+			lcd_moveto(col, row);
+			lcd_write(line[col]);
+		}
+	}
+	if(!lcd_lost)
+		lcd_shadow_valid |= (1 << row);
+}
+//********************************************************************
+
+//********************************************************************
+//Sends a display on/off control command if it differs from the last one.
+void lcd_set_display(UCHAR cmd_code)
+{
+	if(cmd_code != lcd_disp_code)
+	{
+		if(lcd_enqueue(cmd_code, False))
+			lcd_disp_code = cmd_code;
+	}
+}
+//********************************************************************
+
+//********************************************************************
+//Defines custom character n. This leaves the LCD in CGRAM address mode, so the
+//  next write must set the DDRAM address again. Returns False if output was lost
+//  (the character may be partly defined).
+BOOLEAN lcd_define_char(UCHAR n, LCC *lcc)
+{
+	UCHAR i;
+	BOOLEAN sent;
+
+	sent = lcd_enqueue(LCD_CMD_CGRAM | (n << 3), False);
+	for(i=0;i<8;i++)
+		sent = lcd_enqueue(((UCHAR *) lcc)[i], True);
+	lcd_cur_col = LCD_POS_UNKNOWN;
+	lcd_cur_row = LCD_POS_UNKNOWN;
+	return(sent);
+}
+//********************************************************************
+
+//********************************************************************
+//Forgets the CGRAM contents (call after lcd_init).
+void lcd_glyph_reset(void)
+{
+	UCHAR slot;
+
+	for(slot=0;slot<LCD_CGRAM_SLOTS;slot++)
+	{
+		lcd_slot_glyph[slot] = LCD_GLYPH_NONE;
+		lcd_slot_age[slot] = 0xFF;
+	}
+	lcd_slot_pinned = 0;
+}
+//********************************************************************
+
+//********************************************************************
+//Uploads a glyph to a CGRAM slot unless the slot already holds it.
+static void lcd_glyph_load(UCHAR slot, UCHAR id, FLASH LCC *bitmap)
+{
+	LCC lcc;
+
+	if(lcd_slot_glyph[slot] != id)
+	{
+		memcpy_P(&lcc, bitmap, 8);
+		if(lcd_define_char(slot, &lcc))
+			lcd_slot_glyph[slot] = id;
+		else
+			lcd_slot_glyph[slot] = LCD_GLYPH_NONE;
+	}
+}
+//********************************************************************
+
+//********************************************************************
+//Puts a glyph in a fixed CGRAM slot which will not be reused by lcd_glyph.
+void lcd_glyph_pin(UCHAR slot, UCHAR id, FLASH LCC *bitmap)
+{
+	lcd_glyph_load(slot, id, bitmap);
+	lcd_slot_pinned |= (1 << slot);
+}
+//********************************************************************
+
+//********************************************************************
+//Returns the CGRAM slot of a glyph, uploading it to the least recently used
+//  unpinned slot if it is not in CGRAM.
+UCHAR lcd_glyph(UCHAR id, FLASH LCC *bitmap)
+{
+	UCHAR slot, lru = 0, lru_age = 0, found = LCD_GLYPH_NONE;
 
+	for(slot=0;slot<LCD_CGRAM_SLOTS;slot++)
+	{
+		if(lcd_slot_glyph[slot] == id)
+			found = slot;
+		else if(!(lcd_slot_pinned & (1 << slot)))
+		{
+			//Every other slot gets one request older (saturating)
+			if(lcd_slot_age[slot] < 0xFE)
+				lcd_slot_age[slot]++;
+			if(lcd_slot_age[slot] >= lru_age)
+			{
+				lru = slot;
+				lru_age = lcd_slot_age[slot];
+			}
+		}
+	}
+	if(found == LCD_GLYPH_NONE)
+	{
+		found = lru;
+		lcd_glyph_load(found, id, bitmap);
+	}
+	lcd_slot_age[found] = 0;
+	return(found);
+}
 //********************************************************************
-//LCD routines prototypes
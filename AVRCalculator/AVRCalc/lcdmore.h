@@ -1,6 +1,68 @@
+//lcdmore.h : header file for the AVRCalculator LCD routines
+//
 
 #ifndef _LCDMORE_H_
 #define _LCDMORE_H_
 
+#include <LCD.H>
+#include <pgmspace.h>
+#include "types.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//Shadow framebuffer
+//
+//Notes:
+//  1) lcd_shadow holds what the LCD currently shows. lcd_update_row only sends the
+//    characters that differ from it and moves the DDRAM address only when the next
+//    changed character is not where the LCD auto-increment already points.
+//  2) All LCD output after lcd_init must go through these routines (never the lcd.h
+//    ones), so the shadow and the DDRAM address always match the queued output.
+//  3) The routines only queue the bytes (see lcdmore.c) and never wait. When the queue
+//    is full the output is dropped until the queue has been sent; then lcd_resync
+//    returns True once and the whole screen must be drawn again (the shadow is invalid,
+//    so lcd_update_row rewrites every character).
+//  4) lcd_bus_writes counts every command and data byte queued.
+
+#define LCD_COLS					16
+#define LCD_ROWS					2
+#define LCD_POS_UNKNOWN		0xFF
+
+extern char lcd_shadow[LCD_ROWS][LCD_COLS];
+extern unsigned long lcd_bus_writes;
+
+void lcd_queue_init(void);
+BOOLEAN lcd_resync(void);
+BOOLEAN lcd_queue_empty(void);
+void lcd_cmd(UCHAR cmd_code);
+void lcd_cls(void);
+void lcd_shadow_invalidate(void);
+void lcd_moveto(UCHAR col, UCHAR row);
+void lcd_write(char c);
+void lcd_print(char *s);
+void lcd_print_P(FLASH char *s);
+void lcd_update_row(UCHAR row, char *line);
+void lcd_set_display(UCHAR cmd_code);
+BOOLEAN lcd_define_char(UCHAR n, LCC *lcc);
+
+/////////////////////////////////////////////////////////////////////////////
+//CGRAM manager
+//
+//Notes:
+//  1) Custom characters are requested by a glyph ID chosen by the caller together with
+//    their FLASH bitmap. lcd_glyph returns the CGRAM slot (= the character code to
+//    write) and only uploads the bitmap when the glyph is not in CGRAM already.
+//  2) When a glyph must be uploaded, the least recently requested unpinned slot is
+//    reused, so any number of glyphs can be used over time. A glyph that is still on
+//    the screen is only replaced when more unpinned glyphs are visible at the same time
+//    than there are unpinned slots.
+//  3) Pinned slots hold glyphs whose code is fixed (e.g. in key_table glyph strings or
+//    written by the cursor blinking of the display task) and are never reused.
+
+#define LCD_CGRAM_SLOTS		8
+#define LCD_GLYPH_NONE		0xFF
+
+void lcd_glyph_reset(void);
+void lcd_glyph_pin(UCHAR slot, UCHAR id, FLASH LCC *bitmap);
+UCHAR lcd_glyph(UCHAR id, FLASH LCC *bitmap);
 
 #endif
@@ -0,0 +1,152 @@
+//membudget.h : static SRAM budget for the AVRCalculator project
+//
+//The firmware does not use the heap. Every buffer and pool is sized here at compile
+//  time from FORMULA_MAX_LEN, so the worst case SRAM use is known before flashing.
+//Run memreport.sh to print the budget; given the linked ELF, it checks the real
+//  .data/.bss against it.
+//Notes:
+//  1) Keep the MEM_* expressions plain integer arithmetic (no sizeof) so that
+//    memreport.sh can evaluate them.
+//  2) The budget counts every global of the firmware in avr-gcc sizes (int and
+//    pointers 2 bytes, long 4, jmp_buf 24). A new or changed global must be added to
+//    its MEM_*_BYTES figure.
+
+#ifndef _MEMBUDGET_H_
+#define _MEMBUDGET_H_
+
+/////////////////////////////////////////////////////////////////////////////
+//Target
+
+#define		MEM_SRAM_SIZE				2048	//ATmega32 internal SRAM
+#define		MEM_DOUBLE_SIZE			4			//avr-gcc double is a 32 bit float
+//Stack reserved for the deepest call chain and ISRs. The deepest chain is a literal
+//  with more than 9 digits (binary numbers) compiled by the benchmark on the
+//  diagnostics screen: sched_run, editor task, diagnostics_key and
+//  show_diagnostics_page (~50 bytes), diag_bench (~60), parser_compile, compile and
+//  getlex (~60), getnumber with its FMT_LITERAL (~55), fmt_literal_value (~30),
+//  fmt_literal_exact with its two 36 byte integers (~100) and fmt_big_mul_pow (~20):
+//  ~400 bytes with the saved registers, plus ~45 for the Timer1 ISR (ISRs do not
+//  nest). The decimal arithmetic under calc stays below it. Diagnostics page 0 shows
+//  the stack left free since reset.
+#define		MEM_STACK_RESERVE		448
+
+//Number type of the evaluator (number.h): 0 = binary double, 1 = 12 digit decimal
+#ifndef _DECIMAL_NUMBERS_
+#define		_DECIMAL_NUMBERS_		0
+#endif
+#if _DECIMAL_NUMBERS_
+#define		MEM_NUMBER_SIZE			9			//DEC (decfloat.h)
+#else
+#define		MEM_NUMBER_SIZE			MEM_DOUBLE_SIZE
+#endif
+
+#include "diag.h"  //_DIAG_ENABLED_
+
+/////////////////////////////////////////////////////////////////////////////
+//Formula editor
+
+//Keys in the formula gap buffer (gapbuf.h). The parser reads the key codes from it,
+//  so there is no expanded copy of the formula.
+//The parser pools below hold any formula of FORMULA_MAX_LEN keys. The decimal numbers
+//  are more than twice as large, so their formulas are shorter. hosttest/parsertest
+//  overrides the length and the pools.
+#ifndef FORMULA_MAX_LEN
+#if _DECIMAL_NUMBERS_
+#define 	FORMULA_MAX_LEN				64
+#else
+#define 	FORMULA_MAX_LEN				120
+#endif
+#endif
+#define		FORMULA_BLINK_BOUND		(FORMULA_MAX_LEN - 5)
+//Gap buffer keys and its two positions
+#define		FORMULA_DATA_BYTES		(FORMULA_MAX_LEN + 2 * 2)
+
+/////////////////////////////////////////////////////////////////////////////
+//LCD
+
+//Output queue entries (power of 2). A redraw of both rows fits; a longer burst (glyph
+//  uploads too) is dropped and drawn again when the queue has been sent (lcdmore.h).
+#define		LCD_QUEUE_LEN					64
+//Shadow framebuffer, lcd_line0/1 and the output queue with its RS bits
+#define		LCD_DATA_BYTES				(3 * 2 * 16 + LCD_QUEUE_LEN + LCD_QUEUE_LEN / 8)
+
+/////////////////////////////////////////////////////////////////////////////
+//Parser pools
+//Every key adds at most one nesting level and one opcode.
+//A pending value or a further number needs at least a number and an operator key
+//  before it.
+//op_stack and val_stack share their memory (PARSER_CONTEXT, parser.h).
+
+#ifndef PARSER_STACK_DEPTH
+#define		PARSER_STACK_DEPTH		FORMULA_MAX_LEN
+#endif
+#ifndef PARSER_VALUE_DEPTH
+#define		PARSER_VALUE_DEPTH		(FORMULA_MAX_LEN / 2 + 1)
+#endif
+#ifndef PARSER_PROGRAM_LEN
+#define		PARSER_PROGRAM_LEN		FORMULA_MAX_LEN
+#endif
+#ifndef PARSER_CONST_LEN
+#define		PARSER_CONST_LEN			(FORMULA_MAX_LEN / 2 + 1)
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+//Formula history
+
+//Ring of the last formulas (history.h). An entry takes 3 bytes and its keys; with
+//  HISTORY_PROGRAMS also its result and compiled program (1 byte per opcode and
+//  MEM_NUMBER_SIZE bytes per number), which the '=' key runs without compiling.
+//Low memory mode: HISTORY_PROGRAMS 0 keeps only the keys, so a smaller ring holds
+//  as many formulas.
+#ifndef HISTORY_PROGRAMS
+#define		HISTORY_PROGRAMS			1
+#endif
+#ifndef HISTORY_BYTES
+#define		HISTORY_BYTES					192		//Up to 255
+#endif
+//An entry takes at least 4 bytes; the prefix search index has one byte per entry
+#define		HISTORY_MAX_ENTRIES		(HISTORY_BYTES / 4)
+//Ring bytes, its three positions and the index
+#define		HISTORY_DATA_BYTES		(HISTORY_BYTES + 3 + HISTORY_MAX_ENTRIES)
+
+/////////////////////////////////////////////////////////////////////////////
+//Module state
+
+//PARSER_CONTEXT without its pools: status (angle base, Ans), seed, jmp_buf, lexer and
+//  evaluation positions, preemption and pool counts
+#define		PARSER_STATE_BYTES		(48 + MEM_NUMBER_SIZE)
+//AVRCalculator.c: calculator, LCD, formula display and evaluator status, history
+//  search, power, menu and format screen state; tick (AVRCalculatorTimer.c) and errno
+//  (avr-libc strtod)
+#define		MAIN_STATE_BYTES			42
+//Keyboard counters and FIFO (keybrd.c), task table (sched.c), LCD cursor, CGRAM slot
+//  tables, bus write counter and lost output flag (lcdmore.c)
+#define		IO_STATE_BYTES				(31 + 22 + 28)
+//EEPROM store: cache of the 5 keys, record being written and writer state (eestore.c);
+//  copy of the state snapshot being written and its position (persist.c)
+#define		EESTORE_DATA_BYTES		(13 + 6 * MEM_NUMBER_SIZE + 26)
+//Diagnostics counters (diag.c), current page and benchmark formula (AVRCalculator.c)
+#if _DIAG_ENABLED_
+#define		DIAG_DATA_BYTES				(62 + FORMULA_DATA_BYTES)
+#else
+#define		DIAG_DATA_BYTES				0
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+//Budget totals
+
+//.data and .bss: MEM_DATA_BYTES + MEM_POOL_BYTES
+#define		MEM_DATA_BYTES		(FORMULA_DATA_BYTES + LCD_DATA_BYTES + HISTORY_DATA_BYTES + \
+														 PARSER_STATE_BYTES + MAIN_STATE_BYTES + IO_STATE_BYTES + \
+														 EESTORE_DATA_BYTES + DIAG_DATA_BYTES)
+#define		MEM_STACKS_BYTES	((PARSER_STACK_DEPTH > PARSER_VALUE_DEPTH * MEM_NUMBER_SIZE) ? \
+														 PARSER_STACK_DEPTH : PARSER_VALUE_DEPTH * MEM_NUMBER_SIZE)
+#define		MEM_POOL_BYTES		(MEM_STACKS_BYTES + PARSER_PROGRAM_LEN + PARSER_CONST_LEN * MEM_NUMBER_SIZE)
+#define		MEM_TOTAL_BYTES		(MEM_DATA_BYTES + MEM_POOL_BYTES + MEM_STACK_RESERVE)
+
+//Compile time check: fails with a negative array size if the budget exceeds the SRAM.
+#ifndef MEM_NO_BUDGET_CHECK
+typedef char MEM_BUDGET_CHECK[(MEM_TOTAL_BYTES <= MEM_SRAM_SIZE) ? 1 : -1];
+#endif
+
+#endif
@@ -0,0 +1,63 @@
+#!/bin/sh
+#memreport.sh : prints the static SRAM budget of the AVRCalculator project
+#
+#Usage: memreport.sh [AVRCalculator.elf]
+#  The budget is evaluated from membudget.h with the C preprocessor.
+#  If the linked ELF file is given, its .data/.bss/.noinit are compared with the
+#  budget and the real headroom is printed; the exit status is 1 if the stack reserve
+#  does not fit. Without the ELF the figures are those of membudget.h only.
+#  Set CPP to use another preprocessor (default: avr-gcc -E).
+
+DIR=`dirname "$0"`
+CPP=${CPP:-"avr-gcc -E -P -x c"}
+
+eval_macro()
+{
+	VALUE=`printf '#include "membudget.h"\n%s\n' "$1" | $CPP -I"$DIR" - | tail -n 1`
+	echo $(( $VALUE ))
+}
+
+TOTAL=`eval_macro MEM_TOTAL_BYTES`
+SRAM=`eval_macro MEM_SRAM_SIZE`
+STACK=`eval_macro MEM_STACK_RESERVE`
+STATIC=$(( `eval_macro MEM_DATA_BYTES` + `eval_macro MEM_POOL_BYTES` ))
+
+echo "AVRCalculator static SRAM budget (FORMULA_MAX_LEN = `eval_macro FORMULA_MAX_LEN`)"
+for M in MEM_DATA_BYTES MEM_POOL_BYTES MEM_STACK_RESERVE MEM_TOTAL_BYTES MEM_SRAM_SIZE
+do
+	printf "  %-20s %6d\n" $M `eval_macro $M`
+done
+printf "  %-20s %6d\n" "Headroom" $(( SRAM - TOTAL ))
+
+echo "Data:"
+for M in FORMULA_DATA_BYTES LCD_DATA_BYTES HISTORY_DATA_BYTES PARSER_STATE_BYTES MAIN_STATE_BYTES IO_STATE_BYTES EESTORE_DATA_BYTES DIAG_DATA_BYTES
+do
+	printf "  %-20s %6d\n" $M `eval_macro $M`
+done
+
+echo "Parser pools:"
+for M in PARSER_STACK_DEPTH PARSER_VALUE_DEPTH PARSER_PROGRAM_LEN PARSER_CONST_LEN
+do
+	printf "  %-20s %6d\n" $M `eval_macro $M`
+done
+
+if [ -n "$1" ]
+then
+	echo "Linker view ($1):"
+	avr-size -C --mcu=atmega32 "$1"
+	avr-nm -S --size-sort -t d "$1" | grep " [bBdD] "
+
+	LINKED=`avr-size -A "$1" | awk '$1 == ".data" || $1 == ".bss" || $1 == ".noinit" { n += $2 } END { print n + 0 }'`
+	printf "  %-20s %6d\n" ".data+.bss+.noinit" $LINKED
+	printf "  %-20s %6d\n" "Budgeted" $STATIC
+	printf "  %-20s %6d\n" "Headroom" $(( SRAM - LINKED - STACK ))
+	if [ $LINKED -gt $STATIC ]
+	then
+		echo "Warning: the globals exceed the budget, update membudget.h"
+	fi
+	if [ $(( SRAM - LINKED - STACK )) -lt 0 ]
+	then
+		echo "Error: no room for MEM_STACK_RESERVE"
+		exit 1
+	fi
+fi
@@ -0,0 +1,74 @@
+//number.h : header file for the AVRCalculator number type of the evaluator
+//
+
+#ifndef _NUMBER_H_
+#define _NUMBER_H_
+
+#include <math.h>
+#include "membudget.h"  //_DECIMAL_NUMBERS_
+#include "numfmt.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//Number type
+//
+//Notes:
+//  1) The evaluator (calc in parser.c) and everything that keeps its values (Ans,
+//    compiled constants, history, EEPROM store, result line) use NUMBER and the num_*
+//    operations, so they are built for either backend by _DECIMAL_NUMBERS_
+//    (membudget.h):
+//      0: NUMBER is the avr-gcc double (32 bit binary float) and the num_* are the
+//        plain operators, so this is the code it always was.
+//      1: NUMBER is a DEC (decfloat.h): 12 decimal digits, +, -, *, / and sqrt
+//        rounded in decimal, literals and results with no base conversion.
+//  2) The functions without a num_* operation (trigonometry, logarithms, powers) are
+//    evaluated in double between num_to_double and num_from_double. Their arguments
+//    must pass num_float_range, so a decimal number beyond the float range is an
+//    error instead of silently becoming infinity or 0.
+//  3) Keep NUMBER values in plain assignments and memcpy; compare them only through
+//    num_sign.
+
+#if _DECIMAL_NUMBERS_
+
+#include "decfloat.h"
+
+typedef DEC NUMBER;
+
+#define num_add(a, b)						dec_add((a), (b))
+#define num_sub(a, b)						dec_sub((a), (b))
+#define num_mul(a, b)						dec_mul((a), (b))
+#define num_div(a, b)						dec_div((a), (b))
+#define num_neg(a)							dec_neg(a)
+#define num_abs(a)							dec_abs(a)
+#define num_sign(a)							dec_sign(a)
+#define num_sqrt(a)							dec_sqrt(a)
+#define num_from_int(i)					dec_from_int(i)
+#define num_from_double(x)			dec_from_double(x)
+#define num_to_double(a)				dec_to_double(a)
+#define num_float_range(a)			dec_float_range(a)
+#define num_pi()								dec_pi()
+#define num_literal(lit, exp10)	dec_from_literal((lit), (exp10))
+#define num_format(a, mode, digits, line)	dec_format((a), (mode), (digits), (line))
+
+#else
+
+typedef double NUMBER;
+
+#define num_add(a, b)						((a) + (b))
+#define num_sub(a, b)						((a) - (b))
+#define num_mul(a, b)						((a) * (b))
+#define num_div(a, b)						((a) / (b))
+#define num_neg(a)							(-(a))
+#define num_abs(a)							fabs(a)
+#define num_sign(a)							(((a) > 0) - ((a) < 0))
+#define num_sqrt(a)							sqrt(a)
+#define num_from_int(i)					((double) (i))
+#define num_from_double(x)			(x)
+#define num_to_double(a)				(a)
+#define num_float_range(a)			True
+#define num_pi()								M_PI
+#define num_literal(lit, exp10)	fmt_literal_value((lit), (exp10))
+#define num_format(a, mode, digits, line)	fmt_number((a), (mode), (digits), (line))
+
+#endif
+
+#endif
@@ -0,0 +1,742 @@
+//************************************************************************//
+//   -- NUMBER FORMATTER MODULE --
+//Float to decimal conversion for the AVRCalculator result line and decimal to float
+//  conversion of the numeric literals (see numfmt.h)
+//
+//fmt_decimal is the Ryu float algorithm (Ulf Adams, PLDI 2018): the interval of
+//  decimals that read back as the float is scaled by a power of 5 from a table, and
+//  digits are removed from its bounds until one more would leave it. avr-gcc double
+//  is IEEE binary32, so the 32 bit tables and 32 x 64 bit multiplies are enough.
+//fmt_s2f is the Ryu parse algorithm for the same format, with the same tables.
+//************************************************************************//
+
+//************************************************************************//
+//Include header files
+#include <string.h>
+#include <pgmspace.h>
+#include "numfmt.h"
+//************************************************************************//
+
+//************************************************************************//
+//Definitions
+#define FMT_MANTISSA_BITS		23
+#define FMT_EXPONENT_MASK		0xFF
+#define FMT_BIAS						127
+#define FMT_POW5_INV_BITS		59
+#define FMT_POW5_BITS				61
+
+#define FMT_INFINITY				0x7F800000UL
+
+//fmt_s2f limits: digits + exponent of literals that are 0 or infinity
+#define FMT_S2F_ZERO				(-46)
+#define FMT_S2F_INFINITY		40
+
+//Big integers of the exact literal path (little endian bytes)
+#define FMT_BIG_BYTES				36
+
+//Plain FMT_AUTO range: exponent of the first digit
+#define FMT_PLAIN_MIN				(-5)
+#define FMT_PLAIN_MAX				9
+
+typedef union
+{
+	float value;
+	uint32_t bits;
+} FMT_FLOAT;
+//************************************************************************//
+
+//************************************************************************//
+//Power of 5 tables (generated)
+//floor(2^(pow5bits(q) - 1 + FMT_POW5_INV_BITS) / 5^q) + 1
+FLASH uint64_t fmt_pow5_inv[55] = {
+	576460752303423489ULL, 461168601842738791ULL, 368934881474191033ULL,
+	295147905179352826ULL, 472236648286964522ULL, 377789318629571618ULL,
+	302231454903657294ULL, 483570327845851670ULL, 386856262276681336ULL,
+	309485009821345069ULL, 495176015714152110ULL, 396140812571321688ULL,
+	316912650057057351ULL, 507060240091291761ULL, 405648192073033409ULL,
+	324518553658426727ULL, 519229685853482763ULL, 415383748682786211ULL,
+	332306998946228969ULL, 531691198313966350ULL, 425352958651173080ULL,
+	340282366920938464ULL, 544451787073501542ULL, 435561429658801234ULL,
+	348449143727040987ULL, 557518629963265579ULL, 446014903970612463ULL,
+	356811923176489971ULL, 570899077082383953ULL, 456719261665907162ULL,
+	365375409332725730ULL, 292300327466180584ULL, 467680523945888934ULL,
+	374144419156711148ULL, 299315535325368918ULL, 478904856520590269ULL,
+	383123885216472215ULL, 306499108173177772ULL, 490398573077084435ULL,
+	392318858461667548ULL, 313855086769334039ULL, 502168138830934462ULL,
+	401734511064747569ULL, 321387608851798056ULL, 514220174162876889ULL,
+	411376139330301511ULL, 329100911464241209ULL, 526561458342785934ULL,
+	421249166674228747ULL, 336999333339382998ULL, 539198933343012796ULL,
+	431359146674410237ULL, 345087317339528190ULL, 552139707743245103ULL,
+	441711766194596083ULL
+};
+
+//floor(5^i / 2^(pow5bits(i) - FMT_POW5_BITS))
+FLASH uint64_t fmt_pow5[48] = {
+	1152921504606846976ULL, 1441151880758558720ULL, 1801439850948198400ULL,
+	2251799813685248000ULL, 1407374883553280000ULL, 1759218604441600000ULL,
+	2199023255552000000ULL, 1374389534720000000ULL, 1717986918400000000ULL,
+	2147483648000000000ULL, 1342177280000000000ULL, 1677721600000000000ULL,
+	2097152000000000000ULL, 1310720000000000000ULL, 1638400000000000000ULL,
+	2048000000000000000ULL, 1280000000000000000ULL, 1600000000000000000ULL,
+	2000000000000000000ULL, 1250000000000000000ULL, 1562500000000000000ULL,
+	1953125000000000000ULL, 1220703125000000000ULL, 1525878906250000000ULL,
+	1907348632812500000ULL, 1192092895507812500ULL, 1490116119384765625ULL,
+	1862645149230957031ULL, 1164153218269348144ULL, 1455191522836685180ULL,
+	1818989403545856475ULL, 2273736754432320594ULL, 1421085471520200371ULL,
+	1776356839400250464ULL, 2220446049250313080ULL, 1387778780781445675ULL,
+	1734723475976807094ULL, 2168404344971008868ULL, 1355252715606880542ULL,
+	1694065894508600678ULL, 2117582368135750847ULL, 1323488980084844279ULL,
+	1654361225106055349ULL, 2067951531382569187ULL, 1292469707114105741ULL,
+	1615587133892632177ULL, 2019483917365790221ULL, 1262177448353618888ULL
+};
+//************************************************************************//
+
+//********************************************************************
+//Returns ceil(log2(5^e)) for 0 <= e <= 3528.
+static int fmt_pow5bits(int e)
+{
+	return((int) (((uint32_t) e * 1217359UL) >> 19) + 1);
+}
+//********************************************************************
+
+//********************************************************************
+//Returns floor(log10(2^e)) for 0 <= e <= 1650.
+static int fmt_log10_pow2(int e)
+{
+	return((int) (((uint32_t) e * 78913UL) >> 18));
+}
+//********************************************************************
+
+//********************************************************************
+//Returns floor(log10(5^e)) for 0 <= e <= 2620.
+static int fmt_log10_pow5(int e)
+{
+	return((int) (((uint32_t) e * 732923UL) >> 20));
+}
+//********************************************************************
+
+//********************************************************************
+//Returns True if value is divisible by 5^p.
+static BOOLEAN fmt_multiple_of_pow5(uint32_t value, int p)
+{
+	int count = 0;
+
+	while(value % 5 == 0)
+	{
+		value /= 5;
+		count++;
+	}
+	return(count >= p);
+}
+//********************************************************************
+
+//********************************************************************
+//Returns (m * factor) >> shift with the factor read from FLASH (shift > 32).
+static uint32_t fmt_mul_shift(uint32_t m, FLASH uint64_t *table, int index, int shift)
+{
+	uint64_t factor, sum;
+
+	memcpy_P(&factor, &table[index], sizeof(factor));
+	sum = (((uint64_t) m * (uint32_t) factor) >> 32) + (uint64_t) m * (uint32_t) (factor >> 32);
+	return((uint32_t) (sum >> (shift - 32)));
+}
+//********************************************************************
+
+//********************************************************************
+//Converts value to its shortest decimal. Returns False for NaN and infinity.
+BOOLEAN fmt_decimal(double value, FMT_DECIMAL *dec)
+{
+	FMT_FLOAT f;
+	uint32_t ieee_mantissa, m2, mv, mp, mm, vr, vp, vm;
+	UCHAR ieee_exponent, mm_shift, last_removed = 0;
+	BOOLEAN accept_bounds, vm_zeros = False, vr_zeros = False;
+	int e2, e10, q, i, k, removed = 0;
+
+	f.value = value;
+	ieee_mantissa = f.bits & ((1UL << FMT_MANTISSA_BITS) - 1);
+	ieee_exponent = (UCHAR) (f.bits >> FMT_MANTISSA_BITS) & FMT_EXPONENT_MASK;
+	dec->negative = (f.bits >> 31) != 0;
+	if(ieee_exponent == FMT_EXPONENT_MASK)
+		return(False);
+	if(ieee_exponent == 0 && ieee_mantissa == 0)
+	{
+		dec->mantissa = 0;
+		dec->exponent = 0;
+		return(True);
+	}
+
+	//value = m2 * 2^e2, with two more bits for the interval bounds
+	if(ieee_exponent == 0)
+	{
+		e2 = 1 - FMT_BIAS - FMT_MANTISSA_BITS - 2;
+		m2 = ieee_mantissa;
+	}
+	else
+	{
+		e2 = (int) ieee_exponent - FMT_BIAS - FMT_MANTISSA_BITS - 2;
+		m2 = (1UL << FMT_MANTISSA_BITS) | ieee_mantissa;
+	}
+	accept_bounds = (m2 & 1) == 0;
+	mv = 4 * m2;
+	mp = 4 * m2 + 2;
+	mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+	mm = 4 * m2 - 1 - mm_shift;
+
+	//Interval bounds in decimal: vr * 10^e10 (vm, vp)
+	if(e2 >= 0)
+	{
+		q = fmt_log10_pow2(e2);
+		e10 = q;
+		k = FMT_POW5_INV_BITS + fmt_pow5bits(q) - 1;
+		i = -e2 + q + k;
+		vr = fmt_mul_shift(mv, fmt_pow5_inv, q, i);
+		vp = fmt_mul_shift(mp, fmt_pow5_inv, q, i);
+		vm = fmt_mul_shift(mm, fmt_pow5_inv, q, i);
+		if(q != 0 && (vp - 1) / 10 <= vm / 10)
+		{
+			//One removed digit is needed even if the loops below remove none
+			k = FMT_POW5_INV_BITS + fmt_pow5bits(q - 1) - 1;
+			last_removed = fmt_mul_shift(mv, fmt_pow5_inv, q - 1, -e2 + q - 1 + k) % 10;
+		}
+		if(q <= 9)
+		{
+			if(mv % 5 == 0)
+				vr_zeros = fmt_multiple_of_pow5(mv, q);
+			else if(accept_bounds)
+				vm_zeros = fmt_multiple_of_pow5(mm, q);
+			else
+				vp -= fmt_multiple_of_pow5(mp, q);
+		}
+	}
+	else
+	{
+		q = fmt_log10_pow5(-e2);
+		e10 = q + e2;
+		i = -e2 - q;
+		k = fmt_pow5bits(i) - FMT_POW5_BITS;
+		vr = fmt_mul_shift(mv, fmt_pow5, i, q - k);
+		vp = fmt_mul_shift(mp, fmt_pow5, i, q - k);
+		vm = fmt_mul_shift(mm, fmt_pow5, i, q - k);
+		if(q != 0 && (vp - 1) / 10 <= vm / 10)
+		{
+			k = fmt_pow5bits(i + 1) - FMT_POW5_BITS;
+			last_removed = fmt_mul_shift(mv, fmt_pow5, i + 1, q - 1 - k) % 10;
+		}
+		if(q <= 1)
+		{
+			//mv has at least q trailing zero bits
+			vr_zeros = True;
+			if(accept_bounds)
+				vm_zeros = mm_shift == 1;
+			else
+				vp--;
+		}
+		else if(q < 31)
+			vr_zeros = (mv & ((1UL << (q - 1)) - 1)) == 0;
+	}
+
+	//Remove the digits while the bounds still differ
+	if(vm_zeros || vr_zeros)
+	{
+		//Rare: the exact bounds matter
+		while(vp / 10 > vm / 10)
+		{
+			vm_zeros &= vm % 10 == 0;
+			vr_zeros &= last_removed == 0;
+			last_removed = vr % 10;
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+			removed++;
+		}
+		if(vm_zeros)
+			while(vm % 10 == 0)
+			{
+				vr_zeros &= last_removed == 0;
+				last_removed = vr % 10;
+				vr /= 10;
+				vp /= 10;
+				vm /= 10;
+				removed++;
+			}
+		//Exactly halfway: round to even
+		if(vr_zeros && last_removed == 5 && vr % 2 == 0)
+			last_removed = 4;
+		dec->mantissa = vr + ((vr == vm && (!accept_bounds || !vm_zeros)) || last_removed >= 5);
+	}
+	else
+	{
+		while(vp / 10 > vm / 10)
+		{
+			last_removed = vr % 10;
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+			removed++;
+		}
+		dec->mantissa = vr + (vr == vm || last_removed >= 5);
+	}
+	dec->exponent = e10 + removed;
+	return(True);
+}
+//********************************************************************
+
+//********************************************************************
+//Rounds digits[] half up to n significant digits. A carry out of the first digit
+//  increments *x (the exponent of the first digit). *nd = 0 means zero.
+static void fmt_round(UCHAR *digits, UCHAR *nd, int *x, int n)
+{
+	UCHAR i;
+
+	if(n >= *nd)
+		return;
+	if(n < 0)
+	{
+		*nd = 0;
+		return;
+	}
+	i = n;
+	*nd = n;
+	if(digits[n] >= 5)
+	{
+		//Trailing 9s become 0s and are dropped
+		while(i > 0 && digits[i - 1] == 9)
+			i--;
+		if(i == 0)
+		{
+			digits[0] = 1;
+			i = 1;
+			(*x)++;
+		}
+		else
+			digits[i - 1]++;
+		*nd = i;
+	}
+}
+//********************************************************************
+
+//********************************************************************
+//Writes the digits with the first one at 10^x (up to x_max) and the given number of
+//  decimals, right aligned (digits beyond nd are 0). Returns False if it does not fit.
+static BOOLEAN fmt_plain(char *line, BOOLEAN negative, UCHAR *digits, UCHAR nd, int x, int x_max, UCHAR decimals)
+{
+	int i, len;
+	char *p;
+
+	i = (x >= 0) ? x : 0;
+	len = negative + i + 2 + decimals;
+	if(x > x_max || len > FMT_WIDTH)
+		return(False);
+	p = line + FMT_WIDTH - len;
+	if(negative)
+		*p++ = '-';
+	for(; i >= -(int) decimals; i--)
+	{
+		if(i == -1)
+			*p++ = '.';
+		*p++ = (x - i >= 0 && x - i < nd) ? '0' + digits[x - i] : '0';
+	}
+	if(decimals == 0)
+		*p = '.';
+	return(True);
+}
+//********************************************************************
+
+//********************************************************************
+//Writes total digits with ints of them before the point and the exponent exp,
+//  right aligned (digits beyond nd are 0).
+static void fmt_sci(char *line, BOOLEAN negative, UCHAR *digits, UCHAR nd, UCHAR ints, UCHAR total, int exp)
+{
+	UCHAR i, exp_len;
+	char *p;
+
+	exp_len = (exp >= 100 || exp <= -100) ? 3 : 2;
+	p = line + FMT_WIDTH - (negative + total + (total > ints) + 2 + exp_len);
+	if(negative)
+		*p++ = '-';
+	for(i = 0; i < total; i++)
+	{
+		if(i == ints)
+			*p++ = '.';
+		*p++ = (i < nd) ? '0' + digits[i] : '0';
+	}
+	*p++ = 'E';
+	if(exp < 0)
+	{
+		*p++ = '-';
+		exp = -exp;
+	}
+	else
+		*p++ = '+';
+	if(exp_len == 3)
+	{
+		*p++ = '0' + exp / 100;
+		exp %= 100;
+	}
+	*p++ = '0' + exp / 10;
+	*p = '0' + exp % 10;
+}
+//********************************************************************
+
+//********************************************************************
+//Drops the trailing zeros of digits[]. Zero (no digits left) is not negative.
+static void fmt_trim(UCHAR *digits, UCHAR *nd, int *x, BOOLEAN *negative)
+{
+	while(*nd > 0 && digits[*nd - 1] == 0)
+		(*nd)--;
+	if(*nd == 0)
+	{
+		*x = 0;
+		*negative = False;
+	}
+}
+//********************************************************************
+
+//********************************************************************
+//Writes NaN or (-)Inf right aligned into the FMT_WIDTH characters of line.
+void fmt_special(BOOLEAN nan, BOOLEAN negative, char *line)
+{
+	static FLASH char msg_nan[] = "NaN";
+	static FLASH char msg_inf[] = "-Inf";
+
+	memset(line, ' ', FMT_WIDTH);
+	if(nan)
+		memcpy_P(line + FMT_WIDTH - 3, msg_nan, 3);
+	else if(negative)
+		memcpy_P(line + FMT_WIDTH - 4, msg_inf, 4);
+	else
+		memcpy_P(line + FMT_WIDTH - 3, msg_inf + 1, 3);
+}
+//********************************************************************
+
+//********************************************************************
+//Writes the number with the nd decimal digits[] (most significant first, changed by
+//  rounding) and the first digit at 10^x into the FMT_WIDTH characters of line (not 0
+//  terminated) in the given mode (see numfmt.h). precision is the number of digits
+//  the number type has (Sci and Eng 0).
+void fmt_layout(UCHAR *digits, UCHAR nd, int x, BOOLEAN negative, UCHAR mode, UCHAR n, UCHAR precision, char *line)
+{
+	UCHAR shift, room;
+	int x_max;
+
+	memset(line, ' ', FMT_WIDTH);
+	fmt_trim(digits, &nd, &x, &negative);
+	//Plain up to 1E10, or as long as the number type has all the integer digits
+	x_max = (precision > FMT_PLAIN_MAX) ? precision - 1 : FMT_PLAIN_MAX;
+	//Most digits of the scientific layout: sign, point and E+dd take the rest
+	room = FMT_WIDTH - 5 - negative;
+	if(n == 0 && mode != FMT_FIX)
+		n = precision;
+	if(n > room && mode != FMT_FIX)
+		n = room;
+	switch(mode)
+	{
+		case FMT_FIX:
+			if(x > x_max)
+				break;
+			fmt_round(digits, &nd, &x, x + 1 + n);
+			if(fmt_plain(line, negative && nd != 0, digits, nd, x, x_max, n))
+				return;
+			memset(line, ' ', FMT_WIDTH);
+			fmt_trim(digits, &nd, &x, &negative);
+			break;
+
+		case FMT_SCI:
+			fmt_round(digits, &nd, &x, n);
+			fmt_sci(line, negative && nd != 0, digits, nd, 1, n, (nd != 0) ? x : 0);
+			return;
+
+		case FMT_ENG:
+			fmt_round(digits, &nd, &x, n);
+			if(nd == 0)
+				x = 0;
+			shift = ((x % 3) + 3) % 3;
+			fmt_sci(line, negative && nd != 0, digits, nd, shift + 1, (n > shift) ? n : shift + 1, x - shift);
+			return;
+
+		default:
+			if(x >= FMT_PLAIN_MIN && x <= x_max)
+			{
+				//As many decimals as fit
+				fmt_round(digits, &nd, &x, FMT_WIDTH - 1 - negative + ((x >= 0) ? 0 : x));
+				fmt_trim(digits, &nd, &x, &negative);
+				if(fmt_plain(line, negative, digits, nd, x, x_max, (nd > x + 1) ? nd - x - 1 : 0))
+					return;
+			}
+			break;
+	}
+	fmt_round(digits, &nd, &x, room);
+	fmt_trim(digits, &nd, &x, &negative);
+	fmt_sci(line, negative, digits, nd, 1, (nd != 0) ? nd : 1, x);
+}
+//********************************************************************
+
+//********************************************************************
+//Writes value into the FMT_WIDTH characters of line (not 0 terminated) in the given
+//  mode (see numfmt.h).
+void fmt_number(double value, UCHAR mode, UCHAR digits, char *line)
+{
+	FMT_DECIMAL dec;
+	UCHAR d[FMT_MAX_DIGITS + 1], nd, i, c;
+	uint32_t m;
+
+	if(!fmt_decimal(value, &dec))
+	{
+		fmt_special(value != value, dec.negative, line);
+		return;
+	}
+
+	//Digits of the mantissa, most significant first (one division per digit)
+	nd = 0;
+	for(m = dec.mantissa; m != 0; m /= 10)
+		d[nd++] = m % 10;
+	for(i = 0; i < nd / 2; i++)
+	{
+		c = d[i];
+		d[i] = d[nd - 1 - i];
+		d[nd - 1 - i] = c;
+	}
+	fmt_layout(d, nd, dec.exponent + nd - 1, dec.negative, mode, digits, FMT_MAX_DIGITS, line);
+}
+//********************************************************************
+
+//********************************************************************
+//Returns floor(log2(value)) for value > 0.
+static int fmt_log2(uint32_t value)
+{
+	int n = 0;
+
+	while(value >= 0x100)
+	{
+		value >>= 8;
+		n += 8;
+	}
+	while(value > 1)
+	{
+		value >>= 1;
+		n++;
+	}
+	return(n);
+}
+//********************************************************************
+
+//********************************************************************
+//Returns the number of decimal digits of value (value < 10^FMT_MAX_DIGITS).
+static UCHAR fmt_length(uint32_t value)
+{
+	UCHAR n = 1;
+	uint32_t limit = 10;
+
+	while(n < FMT_MAX_DIGITS && value >= limit)
+	{
+		limit *= 10;
+		n++;
+	}
+	return(n);
+}
+//********************************************************************
+
+//********************************************************************
+//Returns the bits of the float nearest to m10 * 10^e10 (0 < m10 < 10^FMT_MAX_DIGITS),
+//  ties to even.
+static uint32_t fmt_s2f(uint32_t m10, int e10)
+{
+	int e2, j, ieee_e2, shift;
+	uint32_t m2;
+	BOOLEAN zeros, round_up;
+	UCHAR len;
+
+	len = fmt_length(m10);
+	if(len + e10 <= FMT_S2F_ZERO)
+		return(0);
+	if(len + e10 >= FMT_S2F_INFINITY)
+		return(FMT_INFINITY);
+
+	//m10 * 10^e10 = m2 * 2^e2 with m2 of 25 or 26 bits (truncated: zeros is False
+	//  if bits were lost)
+	if(e10 >= 0)
+	{
+		e2 = fmt_log2(m10) + e10 + fmt_pow5bits(e10) - 1 - (FMT_MANTISSA_BITS + 1);
+		j = e2 - e10 - fmt_pow5bits(e10) + FMT_POW5_BITS;
+		m2 = fmt_mul_shift(m10, fmt_pow5, e10, j);
+		zeros = e2 < e10 || (e2 - e10 < 32 && (m10 & ((1UL << (e2 - e10)) - 1)) == 0);
+	}
+	else
+	{
+		e2 = fmt_log2(m10) + e10 - fmt_pow5bits(-e10) - (FMT_MANTISSA_BITS + 1);
+		j = e2 - e10 + fmt_pow5bits(-e10) - 1 + FMT_POW5_INV_BITS;
+		m2 = fmt_mul_shift(m10, fmt_pow5_inv, -e10, j);
+		//Exact if m10 is a multiple of 5^-e10 and of the power of 2 it is divided by
+		zeros = fmt_multiple_of_pow5(m10, -e10) &&
+						(e2 <= e10 || (e2 - e10 < 32 && (m10 & ((1UL << (e2 - e10)) - 1)) == 0));
+	}
+
+	//Drop the bits below the float mantissa (more for subnormals) and round
+	ieee_e2 = e2 + FMT_BIAS + fmt_log2(m2);
+	if(ieee_e2 < 0)
+		ieee_e2 = 0;
+	if(ieee_e2 > FMT_EXPONENT_MASK - 1)
+		return(FMT_INFINITY);
+	shift = ((ieee_e2 == 0) ? 1 : ieee_e2) - e2 - FMT_BIAS - FMT_MANTISSA_BITS;
+	zeros &= (m2 & ((1UL << (shift - 1)) - 1)) == 0;
+	round_up = ((m2 >> (shift - 1)) & 1) && (!zeros || ((m2 >> shift) & 1));
+	m2 = ((m2 >> shift) + round_up) & ((1UL << FMT_MANTISSA_BITS) - 1);
+	//A carry out of the mantissa goes to the exponent (up to infinity)
+	if(m2 == 0 && round_up)
+		ieee_e2++;
+	return(((uint32_t) ieee_e2 << FMT_MANTISSA_BITS) | m2);
+}
+//********************************************************************
+
+//********************************************************************
+//Returns the float nearest to mantissa * 10^exp10 (mantissa < 10^FMT_MAX_DIGITS).
+double fmt_value(uint32_t mantissa, int exp10)
+{
+	FMT_FLOAT f;
+
+	f.bits = (mantissa != 0) ? fmt_s2f(mantissa, exp10) : 0;
+	return(f.value);
+}
+//********************************************************************
+
+//********************************************************************
+//big = big * factor + add.
+static void fmt_big_mul_add(UCHAR *big, UCHAR factor, UCHAR add)
+{
+	UCHAR i;
+	UINT acc = add;
+
+	for(i = 0; i < FMT_BIG_BYTES; i++)
+	{
+		acc += (UINT) big[i] * factor;
+		big[i] = (UCHAR) acc;
+		acc >>= 8;
+	}
+}
+//********************************************************************
+
+//********************************************************************
+//big = big * base^n (base^2 <= 255 or base = 2).
+static void fmt_big_mul_pow(UCHAR *big, UCHAR base, int n)
+{
+	if(base == 2)
+	{
+		for(; n >= 7; n -= 7)
+			fmt_big_mul_add(big, 128, 0);
+		fmt_big_mul_add(big, 1 << n, 0);
+		return;
+	}
+	for(; n >= 2; n -= 2)
+		fmt_big_mul_add(big, base * base, 0);
+	if(n)
+		fmt_big_mul_add(big, base, 0);
+}
+//********************************************************************
+
+//********************************************************************
+//Returns the float bits nearest to a literal with more than FMT_MAX_DIGITS
+//  significant digits (e10: exponent of the last digit). bits is the float of its
+//  first FMT_MAX_DIGITS digits: the literal is at most one unit of the last of them
+//  above, so the answer is bits or the next float, depending on the side of the
+//  halfway point between them the literal is.
+//Kept out of line so the big integers use stack only on this path.
+static uint32_t fmt_literal_exact(FMT_LITERAL *lit, int e10, uint32_t bits) __attribute__ ((noinline));
+static uint32_t fmt_literal_exact(FMT_LITERAL *lit, int e10, uint32_t bits)
+{
+	UCHAR d[FMT_BIG_BYTES], h[FMT_BIG_BYTES], i;
+	uint32_t mb;
+	int eb;
+
+	//bits = mb * 2^eb
+	eb = (int) (bits >> FMT_MANTISSA_BITS);
+	mb = bits & ((1UL << FMT_MANTISSA_BITS) - 1);
+	if(eb == 0)
+		eb = 1;
+	else
+		mb |= 1UL << FMT_MANTISSA_BITS;
+	eb -= FMT_BIAS + FMT_MANTISSA_BITS;
+
+	//d = digits * 10^e10 and h = (2 * mb + 1) * 2^(eb - 1), both scaled to integers
+	memset(d, 0, sizeof(d));
+	for(i = 0; i < lit->count; i++)
+		fmt_big_mul_add(d, 10, lit->digit[i]);
+	memset(h, 0, sizeof(h));
+	mb = 2 * mb + 1;
+	for(i = 0; i < sizeof(mb); i++)
+		h[i] = (UCHAR) (mb >> (8 * i));
+	if(e10 >= 0)
+		fmt_big_mul_pow(d, 10, e10);
+	else
+		fmt_big_mul_pow(h, 10, -e10);
+	if(eb >= 1)
+		fmt_big_mul_pow(h, 2, eb - 1);
+	else
+		fmt_big_mul_pow(d, 2, 1 - eb);
+
+	//Above halfway, or on it with an odd mantissa: the next float
+	for(i = FMT_BIG_BYTES; i-- > 0; )
+		if(d[i] != h[i])
+			return((d[i] > h[i]) ? bits + 1 : bits);
+	return(bits + (bits & 1));
+}
+//********************************************************************
+
+//********************************************************************
+//Starts reading a literal.
+void fmt_literal_start(FMT_LITERAL *lit)
+{
+	memset(lit, 0, sizeof(FMT_LITERAL));
+}
+//********************************************************************
+
+//********************************************************************
+//Adds the next digit (0..9) of the literal, before or after the decimal point.
+void fmt_literal_digit(FMT_LITERAL *lit, UCHAR digit, BOOLEAN fraction)
+{
+	if(lit->count == 0 && digit == 0)
+	{
+		//Leading zero
+		if(fraction)
+			lit->exponent--;
+		return;
+	}
+	if(lit->count < FMT_LITERAL_DIGITS)
+	{
+		if(lit->count < FMT_MAX_DIGITS)
+			lit->mantissa = lit->mantissa * 10 + digit;
+		else if(digit != 0)
+			lit->rest = True;
+		lit->digit[lit->count++] = digit;
+		if(fraction)
+			lit->exponent--;
+	}
+	else
+	{
+		if(digit != 0)
+			lit->rest = True;
+		if(!fraction)
+			lit->exponent++;
+	}
+}
+//********************************************************************
+
+//********************************************************************
+//Returns the float nearest to the literal times 10^exp10 (ties to even).
+double fmt_literal_value(FMT_LITERAL *lit, int exp10)
+{
+	FMT_FLOAT f;
+	int e10;
+
+	if(lit->count == 0)
+		return(0);
+	//Exponent of the last digit in mantissa
+	e10 = lit->exponent + exp10;
+	if(lit->count > FMT_MAX_DIGITS)
+		e10 += lit->count - FMT_MAX_DIGITS;
+	f.bits = fmt_s2f(lit->mantissa, e10);
+	if(lit->rest && f.bits != FMT_INFINITY &&
+			e10 > FMT_S2F_ZERO - FMT_MAX_DIGITS && e10 < FMT_S2F_INFINITY - FMT_MAX_DIGITS)
+		f.bits = fmt_literal_exact(lit, e10 - (lit->count - FMT_MAX_DIGITS), f.bits);
+	return(f.value);
+}
+//********************************************************************
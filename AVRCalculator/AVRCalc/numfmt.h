@@ -0,0 +1,70 @@
+//numfmt.h : header file for the AVRCalculator number formatter
+//
+
+#ifndef _NUMFMT_H_
+#define _NUMFMT_H_
+
+#include <inttypes.h>
+#include "types.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//Number formatter
+//
+//Notes:
+//  1) fmt_decimal gives the shortest decimal that reads back as the same float
+//    (Ryu, specialised for the 32 bit double of avr-gcc): only integer multiplies
+//    with two FLASH tables of 64 bit factors, no float arithmetic and no loop over
+//    the digits of the exact binary value.
+//  2) fmt_number lays that decimal out right aligned in the FMT_WIDTH columns of the
+//    result line. The length is known before the first character is written, so the
+//    line is filled in one pass with no moves.
+//  3) FIX, SCI and ENG round the shortest decimal half up, as a calculator shows it.
+//    FIX falls back to the FMT_AUTO scientific layout when the value does not fit.
+//  4) The other way, a numeric literal is read one key at a time into a FMT_LITERAL
+//    (fmt_literal_digit) and fmt_literal_value gives the nearest float. Literals with
+//    up to FMT_MAX_DIGITS significant digits take the fast path: the same tables as
+//    fmt_decimal, integer math only. Longer ones start from the float of their first
+//    FMT_MAX_DIGITS digits and compare the exact literal with the halfway point to
+//    the next float in big integers. Every float printed by fmt_decimal reads back
+//    as the same float.
+
+#define FMT_WIDTH					16
+
+//Display modes
+#define FMT_AUTO					0			//Shortest digits, plain when 1E-5 <= |x| < 1E10 (or 10^precision)
+#define FMT_FIX						1			//digits decimals
+#define FMT_SCI						2			//digits significant digits (0 = 9)
+#define FMT_ENG						3			//As FMT_SCI with the exponent a multiple of 3
+#define FMT_MODES					4
+
+#define FMT_MAX_DIGITS		9
+
+typedef struct
+{
+	uint32_t mantissa;		//Shortest decimal digits (0 for zero)
+	int exponent;					//Value = mantissa * 10^exponent
+	BOOLEAN negative;
+} FMT_DECIMAL;
+
+//Longest literal mantissa kept (digits after it are dropped)
+#define FMT_LITERAL_DIGITS	24
+
+typedef struct
+{
+	uint32_t mantissa;		//First FMT_MAX_DIGITS significant digits
+	int exponent;					//Value = all the digits * 10^exponent
+	UCHAR count;					//Significant digits (leading zeros are skipped)
+	BOOLEAN rest;					//Non-zero digits after the first FMT_MAX_DIGITS
+	UCHAR digit[FMT_LITERAL_DIGITS];
+} FMT_LITERAL;
+
+BOOLEAN fmt_decimal(double value, FMT_DECIMAL *dec);
+void fmt_number(double value, UCHAR mode, UCHAR digits, char *line);
+void fmt_layout(UCHAR *digits, UCHAR nd, int x, BOOLEAN negative, UCHAR mode, UCHAR n, UCHAR precision, char *line);
+void fmt_special(BOOLEAN nan, BOOLEAN negative, char *line);
+void fmt_literal_start(FMT_LITERAL *lit);
+void fmt_literal_digit(FMT_LITERAL *lit, UCHAR digit, BOOLEAN fraction);
+double fmt_literal_value(FMT_LITERAL *lit, int exp10);
+double fmt_value(uint32_t mantissa, int exp10);
+
+#endif
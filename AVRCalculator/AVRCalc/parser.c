@@ -27,8 +27,12 @@ Notes:
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <setjmp.h>
 #include <pgmspace.h>
 #include "parser.h"
+#include "keytable.h"
+#include "diag.h"
+#include "numfmt.h"
 //********************************************************************
 
 
@@ -39,74 +43,24 @@ Notes:
 
 #define DecimalSeparator '.'
 
-//********************************************************************
-
-
-//********************************************************************
-//Type definitions
-
-typedef struct {
-  int num;
-  char *con;
-  void *l, *r;
-} TTree;
+//Larger exponents are not accumulated (the number is 0 or infinity long before)
+#define NUMBER_MAX_EXP	1000
 
-typedef TTree* PTree;
 //********************************************************************
 
-//********************************************************************
-//Names of functions stored as strings in FLASH
-FLASH char COS_STR[] = "cos";
-FLASH char SIN_STR[] = "sin";
-FLASH char TAN_STR[] = "tan";
-FLASH char ABS_STR[] = "abs";
-FLASH char SIGN_STR[] = "sign";
-FLASH char SQRT_STR[] = "sqrt";
-FLASH char LN_STR[] = "ln";
-FLASH char LOG_STR[] = "log";
-FLASH char EXP_STR[] = "exp";
-FLASH char ARCSIN_STR[] = "arcsin";
-FLASH char ARCCOS_STR[] = "arccos";
-FLASH char ARCTAN_STR[] = "arctan";
-FLASH char SINH_STR[] = "sinh";
-FLASH char COSH_STR[] = "cosh";
-FLASH char TANH_STR[] = "tanh";
-FLASH char ARCSINH_STR[] = "arcsinh";
-FLASH char ARCCOSH_STR[] = "arccosh";
-FLASH char ARCTANH_STR[] = "arctanh";
-
-FLASH char RAND_STR[] = "rand";
-FLASH char ANS_STR[] = "ans";
-//********************************************************************
-
-//********************************************************************
-//Parser global variables
-  BOOLEAN Err;
-  int bc;
-  int prevlex, curlex;
-  int pos;
-  
-  int n;
-  char *c;
-	char *gn_res;  //getnumber() function result goes to this dynamically allocated string
-	
-//********************************************************************
 
 //********************************************************************
 //Function prototypes
-char *strcpy_alloc(char **des, const char *src);
-char *strcat_alloc(char **des, const char *src);
-char *strcatchar_alloc(char **des, char srcchar);
-BOOLEAN parser_init(char *formula, double *result);
-double calc(PTree t);
-void Error(void);
-void *deltree(PTree t);
-PTree gettree(char *formula);
-void *getop(char *s);
-void getlex(char *s, int *num, char **con);
-char *getnumber(char *s);
-void *getsingleop(char *s);
-PTree newnode(void);
+void compile(PARSER_CONTEXT *ctx, GAP_BUFFER *f);
+UCHAR calc(PARSER_CONTEXT *ctx, NUMBER *result);
+double calc_function(PARSER_CONTEXT *ctx, UCHAR op, double r);
+void Error(PARSER_CONTEXT *ctx);
+void poll_preempt(PARSER_CONTEXT *ctx);
+void emit(PARSER_CONTEXT *ctx, UCHAR op);
+UCHAR op_priority(UCHAR op);
+void getlex(PARSER_CONTEXT *ctx, GAP_BUFFER *f, int *num, NUMBER *value);
+NUMBER getnumber(PARSER_CONTEXT *ctx, GAP_BUFFER *f);
+char numchar(PARSER_CONTEXT *ctx, GAP_BUFFER *f);
 //********************************************************************
 
 //********************************************************************
@@ -122,6 +76,7 @@ PTree newnode(void);
 // 6 : /
 // 7 : Number
 // 8 : User defined variable
+// 9 : Unary minus
 //
 // 10: cos
 // 11: sin
@@ -147,52 +102,9 @@ PTree newnode(void);
 //////////////////////////////////////////////////////////////////////
 
 //********************************************************************
-char *strcpy_alloc(char **des, const char *src)
-{
-	free(*des);
-	*des = (char *)malloc(strlen(src)+1);
-	strcpy(*des, src);
-	return *des;
-}
-//********************************************************************
-
-//********************************************************************
-char *strcat_alloc(char **des, const char *src)
-{
-	char *des_temp = NULL;
-
-	strcpy_alloc(&des_temp, *des);
-	free(*des);
-	*des = (char *)malloc(strlen(des_temp)+strlen(src)+1);
-	strcpy(*des, des_temp);
-	free(des_temp);
-	strcpy(&((*des)[strlen(*des)]), src);
-	return *des;
-}
-//********************************************************************
-
-//********************************************************************
-char *strcatchar_alloc(char **des, char srcchar)
-{
-  char *des_temp = NULL;
-	UCHAR l;
-
-	strcpy_alloc(&des_temp, *des);
-	free(*des);
-	*des = (char *)malloc(strlen(des_temp)+2);
-	strcpy(*des, des_temp);
-	free(des_temp);
-	l=strlen(*des);
-	(*des)[l+1] = 0;
-	(*des)[l] = srcchar;
-	return *des;
-}
-//********************************************************************
-
-//********************************************************************
-double correct_angle(double angle)
+double correct_angle(PARSER_CONTEXT *ctx, double angle)
 {
-	switch(parser_status.anglebase)
+	switch(ctx->status.anglebase)
 	{
 	case DEGREE:
 		{
@@ -221,9 +133,9 @@ double correct_angle(double angle)
 //********************************************************************
 
 //********************************************************************
-double correct_arcangle(double arcangle)
+double correct_arcangle(PARSER_CONTEXT *ctx, double arcangle)
 {
-	switch(parser_status.anglebase)
+	switch(ctx->status.anglebase)
 	{
 	case DEGREE:
 		{
@@ -252,570 +164,503 @@ double correct_arcangle(double arcangle)
 //********************************************************************
 
 //********************************************************************
-BOOLEAN parser_init(char *formula, double *result)
+void parser_context_init(PARSER_CONTEXT *ctx)
 {
-  PTree tree = NULL;
-
-  Err = False;
-  
-  prevlex = 0;  
-  curlex = 0;  
-  pos = 0;
-  bc = 0;
-  tree = gettree(strlwr(formula));
-  Err = ( (bc != 0) || Err );
-  if(!Err)
+	memset(ctx, 0, sizeof(PARSER_CONTEXT));
+	ctx->status.anglebase = RADIANS;
+	ctx->seed = 1;
+}
+//********************************************************************
+
+//********************************************************************
+//Compiles the formula (key codes, see keytable.h) into the program of the context.
+//On a syntax error False is returned and ctx->errpos is the index of the key
+//  that caused it (gap_len(formula) if the formula ended too early).
+//If ctx->preempt is set and returns non zero, compiling is cancelled: False is
+//  returned with ctx->preempted set.
+BOOLEAN parser_compile(PARSER_CONTEXT *ctx, GAP_BUFFER *formula)
+{
+  ctx->pos = 0;
+  ctx->lexpos = 0;
+  ctx->prog_len = 0;
+  ctx->const_len = 0;
+  ctx->preempted = False;
+  if(setjmp(ctx->abort))
   {
-		*result=calc(tree);
+		//Aborted by Error() or preempted: discard the partly compiled program
+		ctx->prog_len = 0;
+		ctx->const_len = 0;
+		return(False);
   }
-	tree = deltree(tree);
-	free(gn_res);
-	gn_res = NULL;
-  return !Err;
+  compile(ctx, formula);
+  return(True);
 }
 //********************************************************************
 
 //********************************************************************
-double calc(PTree t)
+//Evaluates the program compiled by parser_compile. It may be called again
+//  to re-run the same program (e.g. after Ans or the angle base changed).
+//Runs to the end unless ctx->preempt is set (see parser_eval_resume).
+BOOLEAN parser_evaluate(PARSER_CONTEXT *ctx, NUMBER *result)
 {
-  double r;
-  double cr;
-	char *endpos;
-
-	cr = 0.0;
-	switch(t->num) {
-	  case 3: cr = calc(t->l) + calc(t->r); break;
-		case 4: cr = calc(t->l) - calc(t->r); break;
-		case 5: cr = calc(t->l) * calc(t->r); break;
-		case 6: cr = calc(t->l) / calc(t->r); break;
-		case 7:
-			{
-				//cr = atof(t->con); break;
-				cr = strtod(t->con, &endpos);
-				break;
-			}
-		//case 8: cr = args[StrToInt(t->con)]; break;  //For user defined variables
-		case 9: cr = -calc(t->l); break;
-		case 10: cr = cos(correct_angle(calc(t->l))); break;
-		case 11: cr = sin(correct_angle(calc(t->l))); break;
-		case 12: cr = tan(correct_angle(calc(t->l))); break;
-		case 13:
-			{
-				cr = log10(calc(t->l));
-				break;
-			}
-		case 14: cr = abs(calc(t->l)); break;
-		case 15:
-	    {
-				r = calc(t->l);
-				if( r < 0 ) cr = -1 ;
-				else if( r > 0 ) cr = 1;
-				else
-					cr = 0;
-        break;
-      }
-		case 16: cr = sqrt(calc(t->l)); break;
-		case 17: cr = log(calc(t->l)); break;
-		case 18: cr = exp(calc(t->l)); break;
-		case 19: cr = correct_arcangle(asin(calc(t->l))); break;
-		case 20: cr = correct_arcangle(acos(calc(t->l))); break;
-		case 21: cr = correct_arcangle(atan(calc(t->l))); break;
-		case 23: 
-      {
-        r = calc(t->l);
-        cr = (exp(r) - exp(-r)) / 2;
-        break;
-      }
-		case 24: 
-			{
-        r = calc(t->l);
-				cr = (exp(r) + exp(-r)) / 2;
-				break;
-      }
-		case 25:
-			{
-        r = calc(t->l);
-        cr = (exp(r) - exp(-r)) / (exp(r) + exp(-r));
-        break;
-      }
-		case 26:
-			{
-				srand(rand());
-				cr = (double)rand() / (double) RAND_MAX;
-				break;
-			}
-		case 27:
-			{
-				cr = parser_status.ans;
-				break;
-			}
-		case 28:
-			{
-				r = calc(t->l);
-				cr = log(r + sqrt(r * r + 1));
-				break;
-			}
-		case 29:
-			{
-				r = calc(t->l);
-				cr = log(r + sqrt(r * r - 1));
-				break;
-			}
-		case 30:
-			{
-				r = calc(t->l);
-				cr = log((1 + r) / (1 - r)) / 2;
-				break;
-			}
-		case 31: cr = pow(calc(t->l), calc(t->r)); break;
-	} //switch
-	return cr;
-} 
+	parser_eval_start(ctx);
+	return( parser_eval_resume(ctx, result) == PARSER_DONE );
+}
 //********************************************************************
 
 //********************************************************************
-void Error(void)
+//Starts a new evaluation of the compiled program for parser_eval_resume.
+void parser_eval_start(PARSER_CONTEXT *ctx)
 {
-  Err = True;
+	ctx->eval_pc = 0;
+	ctx->eval_k = 0;
+	ctx->eval_sp = 0;
 }
 //********************************************************************
 
 //********************************************************************
-//Tree deletion
-void *deltree(PTree t)
+//Continues the evaluation started by parser_eval_start. ctx->preempt (if set) is
+//  polled before every opcode; when it returns non zero the evaluation is suspended
+//  and PARSER_PREEMPTED is returned, so the caller can call this again later to go
+//  on from the same opcode. Nothing else may use the context in between.
+//Returns PARSER_DONE with *result set, PARSER_PREEMPTED or PARSER_ERROR.
+UCHAR parser_eval_resume(PARSER_CONTEXT *ctx, NUMBER *result)
 {
-  if( t == NULL ) return(NULL);
-  if( t->l != NULL) deltree(t->l);
-  if( t->r != NULL) deltree(t->r);
-	free(t->con);
-  free(t);
-  return(NULL);
+	UCHAR status;
+
+	if(ctx->prog_len == 0)
+		return(PARSER_ERROR);
+  ctx->lexpos = -1;  //Evaluation errors have no position in the formula
+	DIAG_BEGIN(DIAG_SITE_CALC);
+  if(setjmp(ctx->abort))
+  {
+		DIAG_END(DIAG_SITE_CALC);
+		return(PARSER_ERROR);
+  }
+	status=calc(ctx, result);
+	DIAG_END(DIAG_SITE_CALC);
+  return(status);
 }
 //********************************************************************
 
 //********************************************************************
-PTree gettree(char *formula)
+BOOLEAN parser_init(PARSER_CONTEXT *ctx, GAP_BUFFER *formula, NUMBER *result)
 {
-	
-  PTree l = NULL, r = NULL, res = NULL;
-	int op;
-
-	//#########################
-	if(Err) return(NULL); //###
-	//#########################
-
-	//s=s1;
-  l = NULL;
-	//  try
-	l = (PTree) getop(formula);
-	while( True )
-	{
-		if( (n==0) || (n==2) )  //n in [0,2] )
-		{
-			if( n == 2 ) bc--;
-			return(l);
-		}
-		if( !( (n==3) || (n==4) ) )  //n in [3,4]) ) Error();
-		{
-			deltree(l);
-		  Error();
-			return(NULL);
-		}
-		op = n;
-		r = (PTree) getop(formula);
-		res = malloc(sizeof(TTree));
-		res->l = l;
-		res->r = r;
-		res->num = op;
-		res->con = NULL;
-		l = res;
-	}
-	return(l);
-	//   except
-  //     deltree(l);
-  //     Result = NULL;
-  //   end;
+	return( parser_compile(ctx, formula) && parser_evaluate(ctx, result) );
 }
 //********************************************************************
 
 //********************************************************************
-void *getop(char *s)
+//Priority of the operators kept on ctx->stacks.op_stack. Parenthesis and functions have
+//  the lowest priority so no operator is ever popped across them.
+UCHAR op_priority(UCHAR op)
 {
-  BOOLEAN neg;
-  int op;
-  PTree l = NULL, r = NULL, res = NULL;
-
-	//#########################
-	if(Err) return(NULL); //###
-	//#########################
-
-	neg = False;
-  getlex(s, &n, &c);
-  // Unary - or +
-  if( (prevlex==0) || (prevlex==1) )  //prevlex in [0,1] )
-  {
-    if( n == 4 )
-    {
-      neg = True; 
-      getlex(s, &n, &c);
-    }
-    if( n == 3 ) getlex(s, &n, &c);
-  }
-	l = (PTree) getsingleop(s);
-	// 2nd operand **************
-	while( (n==5) || (n==6) )  //n in [5,6] )
+	switch(op)
 	{
-		op = n;
-		getlex(s, &n, &c);
-		r = (PTree) getsingleop(s);
-		res = malloc(sizeof(TTree));
-		res->l = l;
-		res->r = r;
-		res->num = op;
-		res->con = NULL;
-		l = res;
+	case OP_PLUS:
+	case OP_MINUS:
+		return(1);
+	case OP_MUL:
+	case OP_DIV:
+		return(2);
+	case OP_NEG:
+		return(3);
+	case OP_POWER:
+		return(4);
+	default:
+		return(0);
 	}
-	// Unary minus
-	if( neg )
+}
+//********************************************************************
+
+//********************************************************************
+//Appends an opcode to the compiled program.
+void emit(PARSER_CONTEXT *ctx, UCHAR op)
+{
+	if(ctx->prog_len >= PARSER_PROGRAM_LEN)
 	{
-		res = malloc(sizeof(TTree));
-		res->l = l;
-		res->r = NULL;
-		res->num = 9;
-		res->con = NULL;
-		l = res;
+		Error(ctx);  //Program too long
 	}
-	return (l);
+	ctx->prog_ops[ctx->prog_len++] = op;
+	DIAG_POOL_ALLOC(DIAG_POOL_PROGRAM, ctx->prog_len);
 }
 //********************************************************************
 
 //********************************************************************
-//Read lexem from string
-void getlex(char *s, int *num, char **con)
+//Compiles the formula to ctx->prog_ops[] in postfix order (shunting-yard).
+//A function key includes its opening parenthesis; the function is pushed on
+//  ctx->stacks.op_stack in place of it, so each parenthesis level uses only one entry
+//  of the stack.
+void compile(PARSER_CONTEXT *ctx, GAP_BUFFER *f)
 {
-	//#########################
-	if(Err) return;  //###
-	//#########################
+	int n;
+	NUMBER lexval;
+	int sp = 0;
+	BOOLEAN operand = True;  //True when an operand is expected next
+	UCHAR op;
 
-	strcpy_alloc(con, "");  //con[0] = 0;
-	//skip spaces
-	while( (pos < strlen(s)) && (s[pos] == ' ') ) 
-	{
-		pos++;
-	}
-	if( pos >= strlen(s) )
-	{
-		*num = 0;
-		return;
-	}
-	
-	switch(s[pos])
+	while(True)
 	{
-	  case '(':
-			{
-				*num = 1; break;
-			}
-		case ')':
-			{
-				*num = 2; break;
-			}
-		case '+':
-			{
-				*num = 3; break;
-			}
-		case '-': 
+		poll_preempt(ctx);
+		getlex(ctx, f, &n, &lexval);
+
+		if(operand)
+		{
+			switch(n)
 			{
-				*num = 4;
-				if( ( pos < (strlen(s)-1) ) && isdigit(s[pos + 1]) && ((curlex==0) || (curlex==1)) )
+			case OP_NUMBER:
 				{
-					pos++;
-					strcpy_alloc(con, "-");
-				  strcat_alloc(con, getnumber(s));
-					pos--;
-					*num = 7;
+					if(ctx->const_len >= PARSER_CONST_LEN)
+					{
+						Error(ctx);  //Too many numbers
+					}
+					ctx->prog_consts[ctx->const_len++] = lexval;
+					DIAG_POOL_ALLOC(DIAG_POOL_CONST, ctx->const_len);
+					emit(ctx, OP_NUMBER);
+					operand = False;
+					break;
 				}
+			case OP_RAND:
+			case OP_ANS:
+				{
+					//No argument
+					emit(ctx, n);
+					operand = False;
+					break;
+				}
+			case OP_PLUS:
+				//Unary plus
 				break;
+			case OP_MINUS:
+				n = OP_NEG;
+				//no break
+			default:
+				{
+					if( (n!=OP_NEG) && (n!=OP_LPAREN) && ( (n<OP_FUNC_FIRST) || (n>OP_FUNC_LAST) ) )
+					{
+						Error(ctx);
+					}
+					if(sp >= PARSER_STACK_DEPTH)
+					{
+						Error(ctx);  //Nesting too deep
+					}
+					ctx->stacks.op_stack[sp++] = n;
+					DIAG_POOL_ALLOC(DIAG_POOL_OPSTACK, sp);
+				}
 			}
-		case '*':
-			{
-				*num = 5; break;
-			}
-		case '/':
-			{
-				*num = 6; break;
-			}
-		case '^':
-			{
-				*num = 31; break;
-			}
-		case 'a': case 'A':
-		case 'b': case 'B':
-		case 'c': case 'C':
-		case 'd': case 'D':
-		case 'e': case 'E':
-		case 'f': case 'F':
-		case 'g': case 'G':
-		case 'h': case 'H':
-		case 'i': case 'I':
-		case 'j': case 'J':
-		case 'k': case 'K':
-		case 'l': case 'L':
-		case 'm': case 'M':
-		case 'n': case 'N':
-		case 'o': case 'O':
-		case 'p': case 'P':
-		case 'q': case 'Q':
-		case 'r': case 'R':
-		case 's': case 'S':
-		case 't': case 'T':
-		case 'u': case 'U':
-		case 'v': case 'V':
-		case 'w': case 'W':
-		case 'x': case 'X':
-		case 'y': case 'Y':
-		case 'z': case 'Z':
-		case '_':
+		}
+		else
+		{
+			switch(n)
 			{
-				while( (pos < strlen(s)) && ( isalnum(s[pos]) || (s[pos]=='_') ) )  //(s[pos] in ['a'..'z', 'A'..'Z', '_', '1'..'9', '0']) )
+			case OP_PLUS:
+			case OP_MINUS:
+			case OP_MUL:
+			case OP_DIV:
+			case OP_POWER:
+				{
+					//All operators are left associative
+					while( (sp > 0) && (op_priority(ctx->stacks.op_stack[sp-1]) >= op_priority(n)) )
+						emit(ctx, ctx->stacks.op_stack[--sp]);
+					if(sp >= PARSER_STACK_DEPTH)
+					{
+						Error(ctx);  //Nesting too deep
+					}
+					ctx->stacks.op_stack[sp++] = n;
+					DIAG_POOL_ALLOC(DIAG_POOL_OPSTACK, sp);
+					operand = True;
+					break;
+				}
+			case OP_RPAREN:
+			case OP_END:
 				{
-					strcatchar_alloc(con, s[pos]);
-					pos++;
+					while( (sp > 0) && (op_priority(ctx->stacks.op_stack[sp-1]) != 0) )
+						emit(ctx, ctx->stacks.op_stack[--sp]);
+					if(n == OP_END)
+					{
+						if(sp != 0) Error(ctx);  //Unclosed parenthesis
+						return;
+					}
+					if(sp == 0)
+					{
+						Error(ctx);  //Unopened parenthesis
+					}
+					op = ctx->stacks.op_stack[--sp];
+					if(op != OP_LPAREN)
+						emit(ctx, op);
+					break;
 				}
-				pos--;
-				*num = 8;
-        if( strcmp_P(*con , COS_STR) == 0 ) *num = 10;
-        if( strcmp_P(*con , SIN_STR) == 0 ) *num = 11;
-        if( strcmp_P(*con , TAN_STR) == 0 ) *num = 12;
-        if( strcmp_P(*con , ABS_STR) == 0 ) *num = 14;
-        if( strcmp_P(*con , SIGN_STR) == 0 ) *num = 15;
-        if( strcmp_P(*con , SQRT_STR) == 0 ) *num = 16;
-        if( strcmp_P(*con , LN_STR) == 0 ) *num = 17;
-        if( strcmp_P(*con , LOG_STR) == 0 ) *num = 13;
-        if( strcmp_P(*con , EXP_STR) == 0 ) *num = 18;
-        if( strcmp_P(*con , ARCSIN_STR) == 0 ) *num = 19;
-        if( strcmp_P(*con , ARCCOS_STR) == 0 ) *num = 20;
-        if( strcmp_P(*con , ARCTAN_STR) == 0 ) *num = 21;
-        if( strcmp_P(*con , SINH_STR) == 0 ) *num = 23;
-        if( strcmp_P(*con , COSH_STR) == 0 ) *num = 24;
-        if( strcmp_P(*con , TANH_STR) == 0 ) *num = 25;
-        if( strcmp_P(*con , ARCSINH_STR) == 0 ) *num = 28;
-        if( strcmp_P(*con , ARCCOSH_STR) == 0 ) *num = 29;
-        if( strcmp_P(*con , ARCTANH_STR) == 0 ) *num = 30;
-
-        if( strcmp_P(*con , RAND_STR) == 0 ) *num = 26;
-        if( strcmp_P(*con , ANS_STR) == 0 ) *num = 27;
-				//if( *num == 8 ) con = IntToStr(FVariables.IndexOf(con));
-        break;
+			default:
+				Error(ctx);
 			}
-		case '0':
-		case '1':
-		case '2':
-		case '3':
-		case '4':
-		case '5':
-		case '6':
-		case '7':
-		case '8':
-		case '9':
-			{
-        strcpy_alloc(con, getnumber(s));
-        pos--;
-        *num = 7;
-        break;
-      }
-	}  //switch
-	pos++;
-	prevlex = curlex;
-	curlex = *num;
+		}
+	}
 }
 //********************************************************************
 
 //********************************************************************
-//Get number from string
-char *getnumber(char *s)
+//Evaluates the compiled program using ctx->stacks.val_stack, from the opcode and
+//  stack position saved in the context (instruction boundary).
+//Returns PARSER_PREEMPTED if ctx->preempt returned non zero before an opcode.
+UCHAR calc(PARSER_CONTEXT *ctx, NUMBER *result)
 {
-	//#########################
-	if(Err) return(NULL); //###
-	//#########################
-
-	strcpy_alloc(&gn_res, "");
-	
-// try
- 
-      //Begin
-	while( (pos < strlen(s)) && isdigit(s[pos]) )
+  NUMBER r;
+  NUMBER cr;
+	int pc, k, sp;
+	UCHAR op;
+
+	sp = ctx->eval_sp;
+	k = ctx->eval_k;
+	for(pc=ctx->eval_pc;pc<ctx->prog_len;pc++)
 	{
-		strcatchar_alloc(&gn_res, s[pos]);
-		pos++;
-	}  
-	if(pos >= strlen(s)) return(gn_res);
-	if(s[pos] == DecimalSeparator)
-	{
-		//Fraction part
-		strcatchar_alloc(&gn_res, DecimalSeparator);
-		pos++;
-		if( (pos >= strlen(s)) || (!(isdigit(s[pos]))) )
+		if( (ctx->preempt != NULL) && ctx->preempt() )
+		{
+			ctx->eval_pc = pc;
+			ctx->eval_k = k;
+			ctx->eval_sp = sp;
+			return(PARSER_PREEMPTED);
+		}
+		op = ctx->prog_ops[pc];
+		if(op == OP_NUMBER)
+		{
+			if(sp >= PARSER_VALUE_DEPTH)
+			{
+				Error(ctx);  //Expression too deep
+			}
+			ctx->stacks.val_stack[sp++] = ctx->prog_consts[k++];
+			DIAG_POOL_ALLOC(DIAG_POOL_VALSTACK, sp);
+			continue;
+		}
+		if( (op == OP_RAND) || (op == OP_ANS) )
 		{
-			Error();  //"Wrong number.");
-			return(NULL);
+			//No argument: make room for the value
+			if(sp >= PARSER_VALUE_DEPTH)
+			{
+				Error(ctx);  //Expression too deep
+			}
+			sp++;
+			DIAG_POOL_ALLOC(DIAG_POOL_VALSTACK, sp);
 		}
-		while( (pos < strlen(s)) && isdigit(s[pos]) )
+		//Binary operators take their left operand from ctx->stacks.val_stack[sp-2]
+		if( (op==OP_PLUS) || (op==OP_MINUS) || (op==OP_MUL) || (op==OP_DIV) || (op==OP_POWER) )
 		{
-			strcatchar_alloc(&gn_res, s[pos]);
-			pos++;
+			sp--;
+			cr = ctx->stacks.val_stack[sp-1];
+			r = ctx->stacks.val_stack[sp];
 		}
+		else
+		{
+			r = ctx->stacks.val_stack[sp-1];
+		}
+		switch(op) {
+		  case 3: cr = num_add(cr, r); break;
+			case 4: cr = num_sub(cr, r); break;
+			case 5: cr = num_mul(cr, r); break;
+			case 6: cr = num_div(cr, r); break;
+			case 9: cr = num_neg(r); break;
+			case 14: cr = num_abs(r); break;
+			case 15: cr = num_from_int(num_sign(r)); break;
+			case 16: cr = num_sqrt(r); break;
+			case 26:
+				{
+					//Linear congruential generator kept in the context instead of the
+					//  global state of rand()
+					ctx->seed = ctx->seed * 1103515245UL + 12345UL;
+					cr = num_div(num_from_int((ctx->seed >> 16) & 0x7FFF), num_from_int(0x7FFF));
+					break;
+				}
+			case 27: cr = ctx->status.ans; break;
+			case 31:
+				{
+					if( !num_float_range(cr) || !num_float_range(r) )
+					{
+						Error(ctx);  //Beyond the float kernels (number.h)
+					}
+					cr = num_from_double(pow(num_to_double(cr), num_to_double(r)));
+					break;
+				}
+			default:
+				{
+					if( !num_float_range(r) )
+					{
+						Error(ctx);  //Beyond the float kernels (number.h)
+					}
+					cr = num_from_double(calc_function(ctx, op, num_to_double(r)));
+				}
+		} //switch
+		ctx->stacks.val_stack[sp-1] = cr;
 	}
-	if(pos >= strlen(s))
-	{
-		return(gn_res);
+	ctx->eval_pc = pc;
+	*result = ctx->stacks.val_stack[0];
+	return(PARSER_DONE);
+} 
+//********************************************************************
+
+//********************************************************************
+//Functions of one argument without a NUMBER operation (number.h): evaluated in double.
+double calc_function(PARSER_CONTEXT *ctx, UCHAR op, double r)
+{
+	switch(op) {
+		case 10: return(cos(correct_angle(ctx, r)));
+		case 11: return(sin(correct_angle(ctx, r)));
+		case 12: return(tan(correct_angle(ctx, r)));
+		case 13: return(log10(r));
+		case 17: return(log(r));
+		case 18: return(exp(r));
+		case 19: return(correct_arcangle(ctx, asin(r)));
+		case 20: return(correct_arcangle(ctx, acos(r)));
+		case 21: return(correct_arcangle(ctx, atan(r)));
+		case 23: return((exp(r) - exp(-r)) / 2);
+		case 24: return((exp(r) + exp(-r)) / 2);
+		case 25: return((exp(r) - exp(-r)) / (exp(r) + exp(-r)));
+		case 28: return(log(r + sqrt(r * r + 1)));
+		case 29: return(log(r + sqrt(r * r - 1)));
+		case 30: return(log((1 + r) / (1 - r)) / 2);
+		default: return(0.0);
 	}
-	//Power
-	if( (s[pos] != 'e') && (s[pos] != 'E') ) return(gn_res);
-	strcatchar_alloc(&gn_res, s[pos]);
-	pos++;
-	if( pos >= strlen(s) )
+}
+//********************************************************************
+
+//********************************************************************
+//Aborts parser_compile or parser_evaluate: records the position of the current
+//  lexem and unwinds straight to the setjmp there, so no function has to check
+//  for errors on the success path.
+void Error(PARSER_CONTEXT *ctx)
+{
+  ctx->errpos = ctx->lexpos;
+  longjmp(ctx->abort, 1);
+}
+//********************************************************************
+
+//********************************************************************
+//Cancels parser_compile (like Error, but with ctx->preempted set) if ctx->preempt
+//  is set and returns non zero.
+void poll_preempt(PARSER_CONTEXT *ctx)
+{
+	if( (ctx->preempt != NULL) && ctx->preempt() )
 	{
-		Error();  //"Wrong number.");
-		return(NULL);
+		ctx->preempted = True;
+		ctx->errpos = -1;
+		longjmp(ctx->abort, 1);
 	}
-	if( (s[pos]=='-') || (s[pos]=='+') )
+}
+//********************************************************************
+
+//********************************************************************
+//Read lexem from the formula: one key, or all keys of a number.
+//Keys that are not part of a formula are skipped.
+void getlex(PARSER_CONTEXT *ctx, GAP_BUFFER *f, int *num, NUMBER *value)
+{
+	int len;
+	UCHAR key;
+	KEY_DESC desc;
+
+	len = gap_len(f);
+	while( (ctx->pos < len) && (key_glyph_len(gap_at(f, ctx->pos)) == 0) )
 	{
-		strcatchar_alloc(&gn_res, s[pos]);
-		pos++;
+		ctx->pos++;
 	}
-	if( (pos >= strlen(s)) || (!(isdigit(s[pos]))) )
+	ctx->lexpos = ctx->pos;
+	if( ctx->pos >= len )
 	{
-		Error();  //"Wrong number.");
-		return(NULL);
+		*num = OP_END;
+		return;
 	}
-	while( (pos < strlen(s)) && isdigit(s[pos]) )
+
+	key = gap_at(f, ctx->pos);
+	key_lookup(key, &desc);
+	*num = desc.opcode;
+	if( *num == OP_NUMBER )
 	{
-		strcatchar_alloc(&gn_res, s[pos]);
-		pos++;
+		if( key == CONSTANT_PI )
+		{
+			*value = num_pi();
+		}
+		else
+		{
+			*value = getnumber(ctx, f);
+			return;
+		}
 	}
+	ctx->pos++;
+}
+//********************************************************************
 
-//    except  **********
-    //    end;
-
-	return gn_res;
+//********************************************************************
+//Returns the character of the key at ctx->pos as it is written in a number
+//  (0 at the end of the formula). Digits, '.', '+' and '-' keys are their own
+//  characters (keytable.h).
+char numchar(PARSER_CONTEXT *ctx, GAP_BUFFER *f)
+{
+	UCHAR key;
+
+	if( ctx->pos >= gap_len(f) )
+		return(0);
+	key = gap_at(f, ctx->pos);
+	if( key == BUTTON_E )
+		return('e');
+	return(key);
 }
 //********************************************************************
 
 //********************************************************************
-void *getsingleop(char *s)
+//Get number from the formula
+//The digits are accumulated straight from the keys into a FMT_LITERAL, which gives
+//  the nearest NUMBER (numfmt.h, number.h); ctx->pos is left after the last key of
+//  the number. A number may have any length: the significant digits beyond
+//  FMT_LITERAL_DIGITS only count for the rounding (fmt_literal_digit).
+NUMBER getnumber(PARSER_CONTEXT *ctx, GAP_BUFFER *f)
 {
-  int op, bracket;
-  PTree l = NULL, r = NULL, res = NULL;
-	char *opc = NULL;
-
-	//#########################
-	if(Err) return(NULL); //###
-	//#########################
-	
-  l = NULL;
-//    try
-	if( n == 1 )
+	FMT_LITERAL lit;
+	int exp10 = 0;
+	BOOLEAN negative = False;
+	char c;
+
+	fmt_literal_start(&lit);
+	if( !isdigit(numchar(ctx, f)) )
 	{
-		bc++;
-		l = gettree(s);
+		Error(ctx);  //"Wrong number.");
 	}
-	else
+	while( isdigit(c = numchar(ctx, f)) )
 	{
-		// First operand
-		if( !( (n==7) || (n==8) || ( (n>=10) && (n<=30) ) ) )  //n in [7,8,10..30]) ) Error('');
+		fmt_literal_digit(&lit, c - '0', False);
+		ctx->pos++;
+	}
+	if( numchar(ctx, f) == DecimalSeparator )
+	{
+		//Fraction part
+		ctx->pos++;
+		if( !isdigit(numchar(ctx, f)) )
 		{
-		  Error();  //Error('');
-			return(NULL);
+			Error(ctx);  //"Wrong number.");
 		}
-		op = n;
-		strcpy_alloc(&opc, c);
-		if( (n==7) || (n==8) )  // n in [7,8] )
+		while( isdigit(c = numchar(ctx, f)) )
 		{
-			// Number or variable
-			l = newnode();
-			l->num = op;
-			strcpy_alloc(&(l->con), opc);
+			fmt_literal_digit(&lit, c - '0', True);
+			ctx->pos++;
 		}
-		else
-		{
-			//Function
-			getlex(s, &n, &c);
-			if( n != 1 )
-			{
-				Error();  //'');
-				free(opc);
-				opc = NULL;
-				return(NULL);
-			}
-			bc++;
-			l = newnode();
-			l->l = gettree(s);
-			l->num = op;
-			strcpy_alloc(&(l->con), opc);
-		}
-		free(opc);
-		opc = NULL;
 	}
-	//Operation symbol
-	getlex(s, &n, &c);
-	//Power symbol
-	while( n == 31 )
+	//Power
+	if( numchar(ctx, f) == 'e' )
 	{
-		getlex(s, &n, &c);
-		bracket = 0;
-		if( n == 1 )
+		ctx->pos++;
+		if( (numchar(ctx, f) == '-') || (numchar(ctx, f) == '+') )
 		{
-			bracket = 1;
-			getlex(s, &n, &c);
+			negative = numchar(ctx, f) == '-';
+			ctx->pos++;
 		}
-		if( (n != 7) && (n != 8) )
+		if( !isdigit(numchar(ctx, f)) )
 		{
-			Error();  //'');
-			deltree(l);
-			return(NULL);
+			Error(ctx);  //"Wrong number.");
 		}
-		r = newnode();
-		r->num = n;
-		strcpy_alloc(&(r->con) , c);
-		res = newnode();
-		res->l = l;
-		res->r = r;
-
-		res->num = 31;
-		l = res;
-		if( bracket == 1 )
+		while( isdigit(c = numchar(ctx, f)) )
 		{
-			getlex(s, &n, &c);
-			if( n != 2 )
-			{
-				Error();  //'');
-				deltree(res);
-				return(NULL);
-			}
+			if( exp10 < NUMBER_MAX_EXP )
+				exp10 = exp10 * 10 + (c - '0');
+			ctx->pos++;
 		}
-		getlex(s, &n, &c);
 	}
-	return(l);
-	//     except
-	//       deltree(l);
-	//       return(NULL);
-	//     end;
-}
-//********************************************************************
 
-//********************************************************************
-PTree newnode(void)
-{
-  PTree Result;
-	
-	//#########################
-	if(Err) return(NULL); //###
-	//#########################
-
-	Result = malloc(sizeof(TTree));
-  Result->l = NULL;
-  Result->r = NULL;
-	Result->con = NULL;
-  return(Result);
+	return(num_literal(&lit, negative ? -exp10 : exp10));
 }
 //********************************************************************
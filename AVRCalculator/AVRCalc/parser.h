@@ -1,16 +1,98 @@
 
 #ifndef _PARSER_INCLUDED_
 #define _PARSER_INCLUDED_
+#include <setjmp.h>
 #include "types.h"
 
+#include "membudget.h"  //Pool sizes (PARSER_STACK_DEPTH, PARSER_PROGRAM_LEN, ...)
+#include "gapbuf.h"  //The formula is read from the editor gap buffer
+#include "number.h"  //NUMBER: binary or decimal numbers of the evaluator
+
+//Opcodes of the compiled program (numbering of the original TTree->num is kept,
+//  see the functions table in parser.c).
+#define OP_END				0
+#define OP_LPAREN			1
+#define OP_RPAREN			2
+#define OP_PLUS				3
+#define OP_MINUS			4
+#define OP_MUL				5
+#define OP_DIV				6
+#define OP_NUMBER			7
+#define OP_VARIABLE		8
+#define OP_NEG				9
+#define OP_FUNC_FIRST	10
+#define OP_COS				10
+#define OP_SIN				11
+#define OP_TAN				12
+#define OP_LOG				13
+#define OP_ABS				14
+#define OP_SIGN				15
+#define OP_SQRT				16
+#define OP_LN					17
+#define OP_EXP				18
+#define OP_ARCSIN			19
+#define OP_ARCCOS			20
+#define OP_ARCTAN			21
+#define OP_SINH				23
+#define OP_COSH				24
+#define OP_TANH				25
+#define OP_RAND				26
+#define OP_ANS				27
+#define OP_ARCSINH		28
+#define OP_ARCCOSH		29
+#define OP_ARCTANH		30
+#define OP_FUNC_LAST	30
+#define OP_POWER			31
+
+//Results of parser_eval_resume
+#define PARSER_DONE				0
+#define PARSER_PREEMPTED	1
+#define PARSER_ERROR			2
+
 typedef struct
 {
 	unsigned char anglebase;
-	double ans;
+	NUMBER ans;
 } PARSER_STATUS;
 
-PARSER_STATUS parser_status;
+//Parser context: all state of a parser. It is owned by the caller, so independent
+//  contexts can compile and evaluate formulas at the same time.
+typedef struct
+{
+	PARSER_STATUS status;
+	unsigned long seed;  //Ran# generator state
+	jmp_buf abort;  //Error() unwinds to parser_compile/parser_evaluate through this
+	int pos;  //Lexer position in the formula (key index)
+	int lexpos;  //Key index of the current lexem
+	int errpos;  //Key index of the last syntax error (-1 if the evaluation failed)
+
+	//Polled between lexems and before every opcode (NULL: never preempted). Returns
+	//  non zero to cancel compiling or suspend the evaluation.
+	int (*preempt)(void);
+	BOOLEAN preempted;  //Set if the last parser_compile was cancelled by preempt
+	int eval_pc, eval_k, eval_sp;  //Where a suspended evaluation goes on
+
+	//Compiled program in postfix (RPN) order. Numbers are stored in prog_consts[] in
+	//  the order their OP_NUMBER opcodes appear in prog_ops[].
+	UCHAR prog_ops[PARSER_PROGRAM_LEN];
+	int prog_len;
+	NUMBER prog_consts[PARSER_CONST_LEN];
+	int const_len;
+
+	//Explicit stacks used instead of recursion (depth fixed at compile time).
+	//op_stack is only used while compiling and val_stack only while evaluating.
+	union
+	{
+		UCHAR op_stack[PARSER_STACK_DEPTH];
+		NUMBER val_stack[PARSER_VALUE_DEPTH];
+	} stacks;
+} PARSER_CONTEXT;
 
-BOOLEAN parser_init(char *formula, double *result);
+void parser_context_init(PARSER_CONTEXT *ctx);
+BOOLEAN parser_compile(PARSER_CONTEXT *ctx, GAP_BUFFER *formula);
+BOOLEAN parser_evaluate(PARSER_CONTEXT *ctx, NUMBER *result);
+void parser_eval_start(PARSER_CONTEXT *ctx);
+UCHAR parser_eval_resume(PARSER_CONTEXT *ctx, NUMBER *result);
+BOOLEAN parser_init(PARSER_CONTEXT *ctx, GAP_BUFFER *formula, NUMBER *result);
 
 #endif
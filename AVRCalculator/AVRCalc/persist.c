@@ -0,0 +1,155 @@
+//************************************************************************//
+//   -- PERSIST MODULE --
+//EEPROM state snapshot for AVRCalculator (see persist.h)
+//************************************************************************//
+
+//************************************************************************//
+//Include header files
+#include <eeprom.h>
+#include "persist.h"
+#include "sched.h"
+//************************************************************************//
+
+//************************************************************************//
+//EEPROM layout
+typedef struct
+{
+	UCHAR magic;
+	PERSIST_STATE state;
+	UCHAR len;
+	UCHAR keys[FORMULA_MAX_LEN];
+	USHORT check;
+} PERSIST_IMAGE;
+
+//Checksum of the bytes from magic to keys[len - 1] (Fletcher-16)
+typedef struct
+{
+	UCHAR sum1, sum2;
+} PERSIST_SUM;
+
+EEMEM PERSIST_IMAGE persist_image;
+
+//Snapshot being written: offsets of the bytes in persist_image
+#define PERSIST_LEN_POS		(1 + sizeof(PERSIST_STATE))
+#define PERSIST_KEYS_POS	(PERSIST_LEN_POS + 1)
+#define PERSIST_CHECK_POS	(PERSIST_KEYS_POS + FORMULA_MAX_LEN)
+#define PERSIST_IDLE			0xFF		//Nothing to write
+
+typedef char PERSIST_CHECK_SIZE[(sizeof(PERSIST_IMAGE) < PERSIST_IDLE) ? 1 : -1];
+
+static PERSIST_STATE persist_state;
+static GAP_BUFFER *persist_formula;
+static UCHAR persist_len;
+static PERSIST_SUM persist_sum;
+static UCHAR persist_pos = PERSIST_IDLE;		//Next byte to write
+//************************************************************************//
+
+//********************************************************************
+static void persist_sum_add(PERSIST_SUM *sum, UCHAR value)
+{
+	sum->sum1 = (sum->sum1 + value) % 255;
+	sum->sum2 = (sum->sum2 + sum->sum1) % 255;
+}
+//********************************************************************
+
+//********************************************************************
+//Reads a block from EEPROM and adds it to the checksum.
+static void persist_get_block(PERSIST_SUM *sum, UCHAR *dst, UCHAR *addr, UCHAR len)
+{
+	eeprom_read_block(dst, addr, len);
+	while(len--)
+		persist_sum_add(sum, *dst++);
+}
+//********************************************************************
+
+//********************************************************************
+//Starts saving the state and the keys of the formula. The bytes are written by
+//  eestore_task; the formula must not change until they are (or persist_cancel).
+void persist_save(PERSIST_STATE *state, GAP_BUFFER *formula)
+{
+	persist_state = *state;
+	persist_formula = formula;
+	persist_len = gap_len(formula);
+	persist_sum.sum1 = 0;
+	persist_sum.sum2 = 0;
+	persist_pos = 0;
+	sched_signal(EV_STORE);
+}
+//********************************************************************
+
+//********************************************************************
+//Stops the save started by persist_save. The snapshot stays invalid if it was
+//  changed already.
+void persist_cancel(void)
+{
+	persist_pos = PERSIST_IDLE;
+}
+//********************************************************************
+
+//********************************************************************
+//Writes the next byte of the snapshot if it differs from the EEPROM (the EEPROM
+//  must be ready). Returns False when there is nothing to write.
+BOOLEAN persist_step(void)
+{
+	UCHAR value;
+
+	if(persist_pos == PERSIST_IDLE)
+		return(False);
+	if(persist_pos == PERSIST_KEYS_POS + persist_len)
+		persist_pos = PERSIST_CHECK_POS;
+
+	if(persist_pos == 0)
+		value = PERSIST_MAGIC;
+	else if(persist_pos < PERSIST_LEN_POS)
+		value = ((UCHAR *) &persist_state)[persist_pos - 1];
+	else if(persist_pos == PERSIST_LEN_POS)
+		value = persist_len;
+	else if(persist_pos < PERSIST_CHECK_POS)
+		value = gap_at(persist_formula, persist_pos - PERSIST_KEYS_POS);
+	else if(persist_pos == PERSIST_CHECK_POS)
+		value = persist_sum.sum1;
+	else
+		value = persist_sum.sum2;
+	//The checksum does not cover itself
+	if(persist_pos < PERSIST_CHECK_POS)
+		persist_sum_add(&persist_sum, value);
+
+	if(eeprom_read_byte((UCHAR *) &persist_image + persist_pos) != value)
+		eeprom_write_byte((UCHAR *) &persist_image + persist_pos, value);
+	if(++persist_pos == sizeof(PERSIST_IMAGE))
+		persist_pos = PERSIST_IDLE;
+	return(True);
+}
+//********************************************************************
+
+//********************************************************************
+//Loads the saved state and formula.
+//Returns False (and the formula is empty) if no valid snapshot is stored.
+BOOLEAN persist_load(PERSIST_STATE *state, GAP_BUFFER *formula)
+{
+	PERSIST_SUM sum = {0, 0};
+	UCHAR magic, len, key, i;
+	USHORT check;
+
+	gap_clear(formula);
+	persist_get_block(&sum, &magic, &persist_image.magic, 1);
+	if(magic != PERSIST_MAGIC)
+		return(False);
+	persist_get_block(&sum, (UCHAR *) state, (UCHAR *) &persist_image.state, sizeof(PERSIST_STATE));
+	persist_get_block(&sum, &len, &persist_image.len, 1);
+	if(len > FORMULA_MAX_LEN)
+		return(False);
+	for(i=0;i<len;i++)
+	{
+		persist_get_block(&sum, &key, &persist_image.keys[i], 1);
+		gap_insert(formula, i, key);
+	}
+	eeprom_read_block(&check, &persist_image.check, sizeof(check));
+	if(check != (sum.sum1 | (sum.sum2 << 8)))
+	{
+		gap_clear(formula);
+		return(False);
+	}
+	return(True);
+}
+//********************************************************************
@@ -0,0 +1,41 @@
+//persist.h : header file for the AVRCalculator EEPROM state snapshot
+//
+
+#ifndef _PERSIST_H_
+#define _PERSIST_H_
+
+#include "types.h"
+#include "gapbuf.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//State snapshot
+//
+//Notes:
+//  1) persist_save saves the editor state and the formula to EEPROM when the
+//    calculator is switched off; persist_load reads them back after a reset, so the
+//    calculator continues with the same formula and result line. Ans, the angle base
+//    and the settings are kept in the EEPROM store (eestore.h).
+//  2) persist_save only starts the save: eestore_task writes the snapshot a byte at a
+//    time with persist_step, after the store values, while the EEPROM is ready. Only
+//    the bytes that differ from the EEPROM are written (an EEPROM write takes ~8.5ms
+//    and wears the cell), so a save after a few edits is short.
+//  3) The snapshot ends with a checksum; a snapshot cut by a reset or persist_cancel
+//    during the save, or written by a program version with another layout
+//    (PERSIST_MAGIC), is not loaded.
+
+#define PERSIST_MAGIC			0xA2		//Change when PERSIST_STATE changes
+
+typedef struct
+{
+	UCHAR submode;					//SM_FORMULA or SM_NEWFORMULA
+	UCHAR cursorpos, displeftpos;
+	BOOLEAN insertmode;
+	char result[16];				//Result line
+} PERSIST_STATE;
+
+void persist_save(PERSIST_STATE *state, GAP_BUFFER *formula);
+void persist_cancel(void);
+BOOLEAN persist_step(void);
+BOOLEAN persist_load(PERSIST_STATE *state, GAP_BUFFER *formula);
+
+#endif
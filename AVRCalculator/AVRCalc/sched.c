@@ -0,0 +1,94 @@
+//************************************************************************//
+//   -- SCHEDULER MODULE --
+//Cooperative run to completion task scheduler for AVRCalculator (see sched.h)
+//************************************************************************//
+
+//************************************************************************//
+//Include header files
+#include "AVRCalculator.h"
+#include "sched.h"
+//************************************************************************//
+
+//************************************************************************//
+//Global variables
+static void (*sched_tasks[SCHED_TASKS])(UCHAR events);
+static UCHAR sched_wait[SCHED_TASKS];						//Events taken from sched_signal
+static volatile UCHAR sched_events[SCHED_TASKS];	//Pending events of each task
+static volatile UCHAR sched_ready = 0;						//Bit n: task n has events
+static UCHAR sched_running = SCHED_TASKS;					//Running task (SCHED_TASKS: none)
+//************************************************************************//
+
+//********************************************************************
+//Registers a task. wait are the events it takes from sched_signal.
+//Must be called before interrupts are enabled.
+void sched_task(UCHAR id, UCHAR wait, void (*run)(UCHAR events))
+{
+	sched_tasks[id] = run;
+	sched_wait[id] = wait;
+}
+//********************************************************************
+
+//********************************************************************
+//Posts events to a task.
+void sched_post(UCHAR id, UCHAR events)
+{
+	UCHAR sreg = SREG;
+
+	cli();
+	sched_events[id] |= events;
+	sched_ready |= (1 << id);
+	SREG = sreg;
+}
+//********************************************************************
+
+//********************************************************************
+//Posts events to every task that waits for them.
+void sched_signal(UCHAR events)
+{
+	UCHAR id;
+
+	for(id=0;id<SCHED_TASKS;id++)
+	{
+		if(sched_wait[id] & events)
+			sched_post(id, sched_wait[id] & events);
+	}
+}
+//********************************************************************
+
+//********************************************************************
+//Returns non zero if a task with a higher priority than the running one is ready.
+//Can be used as PARSER_CONTEXT preempt function.
+int sched_preempt(void)
+{
+	return((sched_ready & ((1 << sched_running) - 1)) != 0);
+}
+//********************************************************************
+
+//********************************************************************
+//Runs the ready tasks forever, highest priority first.
+void sched_run(void (*idle)(void))
+{
+	UCHAR id, events;
+
+	while(True)
+	{
+		cli();
+		if(sched_ready == 0)
+		{
+			//Enables the interrupts
+			idle();
+			continue;
+		}
+		for(id=0;!(sched_ready & (1 << id));id++)
+			;
+		events = sched_events[id];
+		sched_events[id] = 0;
+		sched_ready &= ~(1 << id);
+		sei();
+
+		sched_running = id;
+		sched_tasks[id](events);
+		sched_running = SCHED_TASKS;
+	}
+}
+//********************************************************************
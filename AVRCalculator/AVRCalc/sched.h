@@ -0,0 +1,41 @@
+//sched.h : header file for the AVRCalculator task scheduler
+//
+
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#include "types.h"
+
+/////////////////////////////////////////////////////////////////////////////
+//Cooperative run to completion scheduler
+//
+//Notes:
+//  1) A task is a function that handles the events posted to it and returns. The task
+//    ID is its priority (0 = highest): sched_run always runs the ready task with the
+//    lowest ID, so a task only waits for the one that is running, never longer.
+//  2) Events are bits. sched_post gives events to one task, sched_signal gives them to
+//    every task that waits for them (sched_task). Both may be called from ISRs.
+//  3) Long work polls sched_preempt and returns (posting EV_WORK to itself) when a
+//    higher priority task became ready.
+//  4) When no task is ready, sched_run calls the idle function with interrupts
+//    disabled; it must enable them together with going to sleep.
+
+#define SCHED_TASKS				5		//Up to 8
+
+//Events
+#define EV_KEY						0x01	//A key press is in the key event FIFO
+#define EV_BLINK					0x02	//The cursor must blink (Timer1 tick)
+#define EV_REDRAW					0x04	//The screen must be refreshed
+#define EV_LCD_READY			0x08	//The LCD output queue became empty
+#define EV_POWER_OFF			0x10	//OFF key or auto power off time
+#define EV_POWER_ON				0x20	//ON key while the calculator is off
+#define EV_WORK						0x40	//Unfinished work of the task itself
+#define EV_STORE					0x80	//EEPROM store write-back due or EEPROM ready
+
+void sched_task(UCHAR id, UCHAR wait, void (*run)(UCHAR events));
+void sched_post(UCHAR id, UCHAR events);
+void sched_signal(UCHAR events);
+int sched_preempt(void);
+void sched_run(void (*idle)(void));
+
+#endif